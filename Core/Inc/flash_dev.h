@@ -0,0 +1,67 @@
+/*
+ * flash_dev.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  NOR flash device abstraction: an ops table and the geometry of each part, so
+ *  the SPI1 and SPI3 flashes, and the striped or mirrored pair built on them,
+ *  are used the same way.
+ */
+
+#ifndef INC_FLASH_DEV_H_
+#define INC_FLASH_DEV_H_
+
+#include <stdint.h>
+#include "flash_job.h"
+
+struct flash_dev;
+
+/* All return 0 or a negative spi_flash error code */
+struct flash_dev_ops
+{
+	int (*read)(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size);
+	int (*prog)(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size);
+	int (*erase)(struct flash_dev *dev, uint32_t addr, uint32_t size);
+	int (*sync)(struct flash_dev *dev);
+
+	/* Start a job in the background, NULL if the device only has blocking ops */
+	int (*submit)(struct flash_dev *dev, struct flash_job *job);
+};
+
+struct flash_dev
+{
+	const char				   *name;
+	const struct flash_dev_ops *ops;
+	uint32_t					size;		/* usable bytes, 0 if the part is missing */
+	uint32_t					page_size;
+	uint32_t					erase_size;	/* erase ranges must be aligned to it */
+
+	/* Striped and mirrored pairs */
+	struct flash_dev		   *sub[2];
+	uint32_t					stripe;		/* bytes per device before switching */
+	uint8_t						next;		/* device of the next small mirrored read */
+};
+
+extern struct flash_dev		flash_dev_spi1;
+extern struct flash_dev		flash_dev_spi3;
+
+/* Identify the SPI3 part and fill the geometry of both buses, after SPI_FLASH_Init() */
+int flash_dev_init(void);
+
+/* Interleave a and b every stripe bytes, stripe must divide the erase size of both.
+ * Stripes of a device which can run jobs in the background are transferred while
+ * the other device works, its erase size is twice the one of a single part.
+ * Return: 0 on success, -1 if a part is missing or the stripe does not fit. */
+int flash_dev_stripe_init(struct flash_dev *dev, struct flash_dev *a, struct flash_dev *b, uint32_t stripe);
+
+/* Keep the same data on a and b, programs and erases go to both at once and reads
+ * alternate between them, or are split in two halves for long ones. */
+int flash_dev_mirror_init(struct flash_dev *dev, struct flash_dev *a, struct flash_dev *b);
+
+int flash_dev_read(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size);
+int flash_dev_prog(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size);
+int flash_dev_erase(struct flash_dev *dev, uint32_t addr, uint32_t size);
+int flash_dev_sync(struct flash_dev *dev);
+
+#endif /* INC_FLASH_DEV_H_ */
@@ -0,0 +1,81 @@
+/*
+ * flash_job.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Non-blocking SPI1 NOR flash job queue. Jobs progress from flash_job_poll(),
+ *  called by the idle loops and by the submit/wait functions, so the caller can
+ *  keep receiving on the UART while a page programs or a block erases.
+ */
+
+#ifndef INC_FLASH_JOB_H_
+#define INC_FLASH_JOB_H_
+
+#include <stdint.h>
+
+enum flash_job_type
+{
+	FLASH_JOB_READ,
+	FLASH_JOB_PROGRAM,
+	FLASH_JOB_ERASE,
+};
+
+/* job->status while the job is queued or running */
+#define FLASH_JOB_PENDING	1
+
+struct flash_job;
+
+/* Called from flash_job_poll() when the job is done, status is 0 or a negative
+ * spi_flash error code. It must not call the blocking spi_flash.h API. */
+typedef void (*flash_job_cb_t)(struct flash_job *job, int status);
+
+/* Job storage is owned by the caller, and buf must stay valid until the job is done */
+struct flash_job
+{
+	enum flash_job_type		type;
+	uint32_t				addr;
+	uint8_t				   *buf;		/* unused for FLASH_JOB_ERASE */
+	uint32_t				len;
+	flash_job_cb_t			cb;			/* may be NULL */
+	void				   *ctx;
+
+	/* Private to the job engine */
+	volatile int			status;
+	uint32_t				pos;
+	struct flash_job	   *next;
+};
+
+/* Queue a job, it is started right away if the bus is free. A program job skips its
+ * pages of 0xFF and is read back with the program mode of SPI_FLASH_SetVerify() once
+ * written, a mismatch finishes it with -1.
+ * Return: 0 on success, -2 if the range is out of the flash. */
+int flash_job_submit(struct flash_job *job);
+
+/* Wait until the job is done and return its status */
+int flash_job_wait(struct flash_job *job);
+
+/* Wait until the queue is empty */
+void flash_job_flush(void);
+
+/* Return 1 if no job is queued or running */
+int flash_job_idle(void);
+
+/* Advance the running job, called from the idle loops. It issues polled SPI
+ * commands with HAL_GetTick() timeouts, never call it from an interrupt. */
+void flash_job_poll(void);
+
+/* Stop the engine at the next step boundary and wait for it, so the blocking
+ * spi_flash.h API can use the bus. Calls nest, the engine restarts on the last
+ * flash_job_resume(). */
+void flash_job_pause(void);
+void flash_job_resume(void);
+
+/* Same as flash_job_pause() for a blocking read of [addr, addr+len): the queued
+ * erases/programs of that range run first, then if the running one does not touch
+ * the range it is suspended instead of waited for, and resumed on the last
+ * flash_job_resume(). Called with the engine already paused, the queued jobs are
+ * not run. */
+void flash_job_pause_read(uint32_t addr, uint32_t len);
+
+#endif /* INC_FLASH_JOB_H_ */
@@ -0,0 +1,77 @@
+/*
+ * flash_part.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Partition map of the SPI1 flash: named regions for the raw image slots, the
+ *  littlefs file system and scratch space, kept in a small table in the first
+ *  sector of the part.
+ *
+ *  Version 2 adds the "lfshint" partition of the littlefs mount hints. A
+ *  version 1 table is migrated when it is loaded: the partition is taken from
+ *  the start of the scratch partition, the rest of the layout does not move.
+ */
+
+#ifndef INC_FLASH_PART_H_
+#define INC_FLASH_PART_H_
+
+#include <stdint.h>
+
+#define FLASH_PART_TABLE_ADDR	0x000000
+#define FLASH_PART_MAGIC		0x54504C46	/* "FLPT" */
+#define FLASH_PART_VERSION		2
+#define FLASH_PART_MAX			8
+#define FLASH_PART_NAME_LEN		12
+
+/* A size of 0 in the table runs the partition to the end of the part */
+#define FLASH_PART_SIZE_REST	0
+
+enum
+{
+	FLASH_PART_TABLE,		/* this table */
+	FLASH_PART_RAW,			/* image slot, streamed without a file system */
+	FLASH_PART_LFS,			/* littlefs */
+	FLASH_PART_SCRATCH,		/* free for temporary data */
+};
+
+struct flash_part
+{
+	char				name[FLASH_PART_NAME_LEN];
+	uint32_t			offset;
+	uint32_t			size;
+	uint8_t				type;
+	uint8_t				flags;
+	uint16_t			reserved;
+};
+
+/* On-flash layout, little endian, the CRC16 covers everything before it */
+struct flash_part_table
+{
+	uint32_t			magic;
+	uint16_t			version;
+	uint16_t			count;
+	struct flash_part	part[FLASH_PART_MAX];
+	uint16_t			crc;
+	uint16_t			reserved;
+};
+
+/* Load the table after SPI_FLASH_Init(). A blank first sector gets the built-in
+ * layout written, anything else unreadable falls back to it in RAM only.
+ * Return: 0 on success, <0 if the built-in table could not be written */
+int flash_part_init(void);
+
+/* Write the table in use back to the first sector */
+int flash_part_save(void);
+
+const struct flash_part *flash_part_find(const char *name);
+void flash_part_dump(void);
+
+/* Raw access inside a partition, off is relative to its start.
+ * Return: 0 on success, -2 if the range does not fit in the partition, or the
+ * spi_flash error code */
+int flash_part_read(const struct flash_part *part, uint32_t off, uint8_t *buf, uint32_t size);
+int flash_part_prog(const struct flash_part *part, uint32_t off, const uint8_t *buf, uint32_t size);
+int flash_part_erase(const struct flash_part *part, uint32_t off, uint32_t size);
+
+#endif /* INC_FLASH_PART_H_ */
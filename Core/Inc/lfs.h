@@ -65,6 +65,18 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Maximum number of lines in the block device read cache, see
+// lfs_config.rcache_lines. Each line takes a few words in lfs_t.
+#ifndef LFS_RCACHE_LINES_MAX
+#define LFS_RCACHE_LINES_MAX 8
+#endif
+
+// Custom attribute type reserved for the extent record of files written with
+// lfs_file_config.extent_size, it must not be used by the application.
+#ifndef LFS_EXTENT_ATTR
+#define LFS_EXTENT_ATTR 0xe5
+#endif
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -143,6 +155,7 @@ enum lfs_open_flags {
     LFS_F_ERRED   = 0x080000, // An error occurred during write
 #endif
     LFS_F_INLINE  = 0x100000, // Currently inlined in directory entry
+    LFS_F_EXTENT  = 0x200000, // Extent record on disk
 };
 
 // File seek flags
@@ -283,6 +296,23 @@ struct lfs_config {
     // Set to -1 to disable inlined files.
     lfs_size_t inline_max;
 
+    // Optional number of lines in a second read cache below the read cache,
+    // at most LFS_RCACHE_LINES_MAX. The read cache and the file caches are
+    // refilled from its lines, so metadata and file data reads which take
+    // turns no longer read the same bytes from the device again. Lines are
+    // replaced least recently used first and dropped when their range is
+    // programmed or erased. Disabled when zero.
+    lfs_size_t rcache_lines;
+
+    // Size of a line in bytes. Must be a multiple of the read size and a
+    // factor of the block size. Defaults to cache_size when zero, smaller
+    // lines cannot hold a whole read cache refill.
+    lfs_size_t rcache_line_size;
+
+    // Optional statically allocated buffer of rcache_lines*rcache_line_size
+    // bytes. By default lfs_malloc is used to allocate this buffer.
+    void *rcache_buffer;
+
 #ifdef LFS_MULTIVERSION
     // On-disk version to use when writing in the form of 16-bit major version
     // + 16-bit minor version. This limiting metadata to what is supported by
@@ -363,6 +393,19 @@ struct lfs_file_config {
 
     // Number of custom attributes in the list
     lfs_size_t attr_count;
+
+    // Expected size of the file in bytes, or zero. When set, a file written
+    // from the start is placed in a run of physically contiguous blocks where
+    // the allocator finds one, and the run is recorded in an LFS_EXTENT_ATTR
+    // attribute so later opens find any block without walking the CTZ list.
+    lfs_size_t extent_size;
+
+    // Optional CTZ index cache of index_size block addresses. Seeks remember
+    // the blocks they pass on the skip-list, later seeks start from the
+    // nearest one at or after their target instead of the head of the file.
+    // Files of more than index_size blocks keep every n-th block.
+    lfs_block_t *index_buffer;
+    lfs_size_t index_size;
 };
 
 
@@ -414,6 +457,23 @@ typedef struct lfs_file {
     lfs_off_t off;
     lfs_cache_t cache;
 
+    // blocks start..start+count-1 hold the first count blocks of the file in
+    // order, count is zero if the file is not contiguous
+    struct lfs_extent {
+        lfs_block_t start;
+        lfs_block_t count;
+    } extent;
+
+    // slot i of blocks holds block i*stride of the CTZ list, or
+    // LFS_BLOCK_NULL, stride is zero until the slots are cleared for it
+    struct lfs_ctz_index {
+        lfs_block_t *blocks;
+        lfs_size_t size;
+        lfs_off_t stride;
+        uint32_t reads;     // pointer reads done by seeks
+        uint32_t saved;     // pointer reads the index avoided
+    } index;
+
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
@@ -457,6 +517,19 @@ typedef struct lfs {
         uint8_t *buffer;
     } lookahead;
 
+    // lines of the block device read cache, block is LFS_BLOCK_NULL while
+    // a line is empty
+    struct lfs_rline {
+        lfs_block_t block;
+        lfs_off_t off;
+        uint32_t stamp;
+        uint32_t hits;      // reads served from the line
+        uint32_t fills;     // reads which loaded the line from the device
+    } rlines[LFS_RCACHE_LINES_MAX];
+    uint8_t *rline_buffer;
+    lfs_size_t rline_size;
+    uint32_t rline_clock;
+
     const struct lfs_config *cfg;
     lfs_size_t block_count;
     lfs_size_t name_max;
@@ -469,6 +542,33 @@ typedef struct lfs {
 #endif
 } lfs_t;
 
+// Mount hint, the state lfs_mount rebuilds from the superblock and the first
+// block allocation rebuilds by traversing the filesystem
+#ifndef LFS_MOUNT_HINT_BITMAP
+#define LFS_MOUNT_HINT_BITMAP 256
+#endif
+
+struct lfs_mount_hint {
+    // metadata pairs in the tail list, and the seed a mount collects from
+    // the crc of every commit in them
+    lfs_size_t mdir_count;
+    uint32_t seed;
+
+    lfs_block_t root[2];
+    lfs_size_t block_size;
+    lfs_size_t block_count;
+    lfs_size_t name_max;
+    lfs_size_t file_max;
+    lfs_size_t attr_max;
+    lfs_size_t inline_max;
+
+    // used blocks from lookahead_start, the window the first allocation of
+    // a mount scans, one bit per block
+    lfs_block_t lookahead_start;
+    lfs_block_t lookahead_size;
+    uint8_t bitmap[LFS_MOUNT_HINT_BITMAP];
+};
+
 
 /// Filesystem functions ///
 
@@ -499,6 +599,30 @@ int lfs_mount(lfs_t *lfs, const struct lfs_config *config);
 // Returns a negative error code on failure.
 int lfs_unmount(lfs_t *lfs);
 
+#ifndef LFS_READONLY
+// Take a mount hint of a mounted littlefs
+//
+// Traverses the filesystem once to snapshot the used blocks. Only valid
+// while nothing is written, so this is meant to be called right before
+// lfs_unmount. Fails with LFS_ERR_INVAL if files are open or global state
+// is pending.
+//
+// Returns a negative error code on failure.
+int lfs_mount_hint_get(lfs_t *lfs, struct lfs_mount_hint *hint);
+
+// Mounts a littlefs from a mount hint
+//
+// Fetches every metadata pair like lfs_mount, and checks that the pairs and
+// the seed collected from their commits match the hint, so any commit since
+// the hint was taken is caught. Saves the filesystem traversal of the first
+// block allocation, which then gets the same blocks as after lfs_mount.
+//
+// Returns LFS_ERR_INVAL if the hint does not match, fall back to lfs_mount
+// then, or another negative error code on failure.
+int lfs_mount_hinted(lfs_t *lfs, const struct lfs_config *config,
+        const struct lfs_mount_hint *hint);
+#endif
+
 /// General operations ///
 
 #ifndef LFS_READONLY
@@ -656,6 +780,14 @@ int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file);
 // Returns the size of the file, or a negative error code on failure.
 lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file);
 
+// Get the physically contiguous blocks of the file
+//
+// Files written with lfs_file_config.extent_size which got contiguous blocks
+// occupy extent->count blocks from extent->start on, each block still starts
+// with its CTZ pointers. Returns LFS_ERR_NOENT if the file has no extent, or
+// a negative error code on failure.
+int lfs_file_extent(lfs_t *lfs, lfs_file_t *file, struct lfs_extent *extent);
+
 
 /// Directory operations ///
 
@@ -26,6 +26,10 @@
 #include <string.h>
 #include <inttypes.h>
 
+// The bootloader gives littlefs static buffers and file caches from a fixed
+// arena, see littlefs_port.c. Comment out to let littlefs use malloc again.
+#define LFS_NO_MALLOC
+
 #ifndef LFS_NO_MALLOC
 #include <stdlib.h>
 #endif
@@ -11,16 +11,6 @@
 #ifndef INC_LITTLEFS_PORT_H_
 #define INC_LITTLEFS_PORT_H_
 
-// 定义一个结构体来跟踪内存块
-typedef struct MemBlock
-{
-    void *ptr;
-    size_t size;
-    struct MemBlock *next;
-} MemBlock;
-
-
-
 int lfs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size);
 int lfs_write(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size);
 int lfs_SectorErase(const struct lfs_config *c, lfs_block_t block);
@@ -28,4 +18,13 @@ void lfs_test();
 void verify_flash_erased();
 int lfs_sync(const struct lfs_config *c);
 void initialize_filesystem(void);
+int lfs_preerase_scan(lfs_t *lfs);
+void lfs_preerase_poll(void);
+int lfs_port_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags);
+int lfs_port_file_open_size(lfs_t *lfs, lfs_file_t *file, const char *path, int flags, lfs_size_t size);
+int lfs_port_file_close(lfs_t *lfs, lfs_file_t *file);
+void lfs_port_ram_report(void);
+void lfs_port_rcache_report(lfs_t *lfs);
+int lfs_port_mount(lfs_t *lfs);
+int lfs_port_unmount(lfs_t *lfs);
 #endif /* INC_LITTLEFS_PORT_H_ */
@@ -0,0 +1,118 @@
+/*
+ * sfdp.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Runtime NOR flash descriptor, filled from the JESD216 SFDP tables or
+ *  from the JEDEC ID table. No HAL dependency, so it builds on the host.
+ */
+
+#ifndef INC_SFDP_H_
+#define INC_SFDP_H_
+
+#include <stdint.h>
+
+#define FLASH_ERASE_TYPES	4
+
+/* Address mode reported by SFDP BFPT DWORD1[18:17] */
+#define FLASH_ADDR_3BYTE	0
+#define FLASH_ADDR_3OR4BYTE	1
+#define FLASH_ADDR_4BYTE	2
+
+/* Highest address a 3-byte address reaches */
+#define FLASH_3BYTE_LIMIT	(16UL << 20)
+
+/* One erase command the part supports, size is 0 for an unused slot */
+struct flash_erase_type
+{
+	uint32_t			size;
+	uint8_t				cmd;
+	uint32_t			typ_ms;
+	uint32_t			max_ms;
+};
+
+/* How a 3OR4BYTE part enters and leaves 4-byte address mode (BFPT DWORD16) and
+ * which register bit reports it, which SFDP does not describe */
+struct flash_addr4
+{
+	uint8_t				enter;			/* 0 if the part has no enter command */
+	uint8_t				exit;			/* 0 if the part has no exit command */
+	uint8_t				wren;			/* write enable before enter/exit */
+	uint8_t				status_cmd;		/* register read reporting the mode, 0 if unknown */
+	uint8_t				status_mask;
+};
+
+/* Program/erase suspend (BFPT DWORD12/13) and the register bit which reports a
+ * suspended operation, which SFDP does not describe */
+struct flash_suspend
+{
+	uint8_t				suspend;		/* 0 if the part cannot suspend */
+	uint8_t				resume;
+	uint8_t				status_cmd;		/* register read reporting the suspension, 0 if unknown */
+	uint8_t				status_mask;
+	uint32_t			max_us;			/* suspend latency of an erase */
+};
+
+struct spi_flash_info
+{
+	const char			   *name;
+	uint32_t				jedec_id;
+	uint32_t				size;
+	uint32_t				page_size;
+	uint32_t				pp_max_ms;
+	uint32_t				ce_max_ms;
+	struct flash_erase_type	erase[FLASH_ERASE_TYPES];	/* sorted, biggest first */
+	uint8_t					read_cmd;
+	uint8_t					fast_read_cmd;
+	uint8_t					fast_read_dummy;	/* dummy clocks */
+	uint8_t					dual_read_cmd;		/* 1-1-2, 0 if not supported */
+	uint8_t					dual_read_dummy;
+	uint8_t					addr_mode;
+	struct flash_addr4		addr4;
+	struct flash_suspend	suspend;
+};
+
+/* One part on one bus, for the code shared by the SPI1 and SPI3 drivers */
+struct flash_bus
+{
+	void				  (*cmd)(uint8_t opcode);		/* opcode alone, CS low to CS high */
+	uint8_t				  (*read_reg)(uint8_t opcode);	/* opcode, then one register byte */
+};
+
+/* Parse the SFDP space dump in buf (starting at SFDP address 0) into info.
+ * Return: 0 on success, -1 if there is no valid SFDP/BFPT in the dump.
+ */
+int sfdp_parse(const uint8_t *buf, uint32_t len, struct spi_flash_info *info);
+
+/* Find the known part with this 0x9F manufacturer/device ID, NULL if unknown */
+const struct spi_flash_info *flash_info_lookup(uint32_t jedec_id);
+
+/* Complete an SFDP descriptor with the vendor details of the known part: the
+ * 4-byte mode and suspend status registers, and the enter/exit and suspend/resume
+ * opcodes SFDP gave none for */
+void flash_info_merge(struct spi_flash_info *info, const struct spi_flash_info *known);
+
+/* Return 1 if erase/program suspend can be used: opcodes and status bit known */
+int flash_info_can_suspend(const struct spi_flash_info *info);
+
+/* Select the address mode of a part bigger than 16MB with the method of info.
+ * A part which does not confirm 4-byte mode is sent back to 3-byte mode.
+ * addr_bytes and usable get the address bytes and the size they reach.
+ * Return: 0 on success, -1 if 4-byte mode failed (addr_bytes is 4 if the part
+ *         is stuck in it, 3 if only the first 16MB are usable).
+ */
+int flash_addr4_select(const struct spi_flash_info *info, const struct flash_bus *bus,
+		uint8_t *addr_bytes, uint32_t *usable);
+
+/* Sort info->erase biggest first, unused slots last */
+void flash_info_sort_erase(struct spi_flash_info *info);
+
+/* Smallest supported erase size, 0 if none */
+uint32_t flash_info_min_erase(const struct spi_flash_info *info);
+
+/* Biggest erase type which starts at addr and fits in [addr, end), the smallest one
+ * if none fits. addr and end must be aligned to the smallest erase size. */
+const struct flash_erase_type *flash_info_erase_type(const struct spi_flash_info *info, uint32_t addr, uint32_t end);
+
+#endif /* INC_SFDP_H_ */
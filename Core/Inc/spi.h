@@ -36,6 +36,10 @@ extern SPI_HandleTypeDef hspi1;
 
 extern SPI_HandleTypeDef hspi3;
 
+extern DMA_HandleTypeDef hdma_spi1_rx;
+
+extern DMA_HandleTypeDef hdma_spi1_tx;
+
 /* USER CODE BEGIN Private defines */
 
 /* USER CODE END Private defines */
@@ -8,8 +8,18 @@
 #ifndef INC_SPI3_FLASH_H_
 #define INC_SPI3_FLASH_H_
 
+#include <stdint.h>
+#include "sfdp.h"
+
 uint8_t SPI3_FLASH_SendByte(uint8_t byte);
 uint8_t SPI3_FLASH_ReadByte(void);
+int SPI3_FLASH_Init(void);
+uint32_t SPI3_FLASH_ReadJedecId(void);
+const struct spi_flash_info *SPI3_FLASH_GetInfo(void);
+uint32_t SPI3_FLASH_GetSize(void);
+int SPI3_FLASH_Read(uint32_t addr, uint8_t *buffer, uint32_t size);
+int SPI3_FLASH_Program(uint32_t addr, const uint8_t *data, uint32_t size);
+int SPI3_FLASH_EraseRange(uint32_t addr, uint32_t size);
 int _write(int file, char *ptr, int len);
 
 #endif /* INC_SPI3_FLASH_H_ */
@@ -11,27 +11,158 @@
 
 #include <stdint.h>
 #include "stm32l4xx_hal.h"
+#include "sfdp.h"
 
+/* Longest opcode + address + dummy bytes header */
+#define SPI_FLASH_CMD_MAX	9
+
+/* One erase command of an erase plan */
+struct flash_erase_op
+{
+	uint32_t			addr;
+	uint32_t			size;
+	uint8_t				cmd;
+	uint32_t			timeout;	/* ms */
+};
+
+/* 64KB blocks with an erase counter, 32MB */
+#define SPI_FLASH_STAT_BLOCKS		512
+/* log2 buckets of the BUSY wait histogram, in CPU cycles */
+#define SPI_FLASH_BUSY_BUCKETS		32
+
+/* Page cache geometry, FLASH_CACHE_SETS * FLASH_CACHE_WAYS pages of Page_Size bytes */
+#ifndef FLASH_CACHE_SETS
+#define FLASH_CACHE_SETS			8
+#endif
+#ifndef FLASH_CACHE_WAYS
+#define FLASH_CACHE_WAYS			2
+#endif
+
+/* SPI_FLASH_DumpStats() modes and binary dump header */
+#define SPI_FLASH_DUMP_TEXT			0
+#define SPI_FLASH_DUMP_BINARY		1
+#define SPI_FLASH_STATS_MAGIC		0x54534C46	/* "FLST" */
+#define SPI_FLASH_STATS_VERSION		2
+
+/* Driver counters. Erase/program commands sent, and the ones elided because the
+ * sector already reads blank or the page data is all 0xFF */
+struct spi_flash_stats
+{
+	uint32_t			erase_issued;
+	uint32_t			erase_skipped;
+	uint32_t			prog_issued;	/* page program commands */
+	uint32_t			prog_skipped;
+	uint32_t			prog_combined;	/* writes appended to a buffered page */
+	uint32_t			cache_hits;		/* pages read from the SRAM page cache */
+	uint32_t			cache_misses;	/* pages read from the flash into the cache */
+	uint32_t			cache_bypass;	/* long reads which skipped the cache */
+	uint32_t			bytes_read;		/* read from the flash, cache hits excluded */
+	uint32_t			bytes_prog;
+	uint32_t			chip_erases;
+	uint32_t			erase_by_type[FLASH_ERASE_TYPES];	/* per SPI_FLASH_GetInfo()->erase[] */
+	uint16_t			block_erases[SPI_FLASH_STAT_BLOCKS];
+	uint32_t			busy_hist[SPI_FLASH_BUSY_BUCKETS];
+	uint64_t			busy_cycles;
+	uint32_t			blank_bytes;	/* read by the blank check before an erase */
+	uint64_t			blank_cycles;
+};
+
+/* Record every flash command in a RAM ring for profiling, see SPI_FLASH_DumpTrace().
+ * Without it the trace hooks compile to nothing. */
+//#define CONFIG_SPI_FLASH_TRACE
+
+#ifndef SPI_FLASH_TRACE_DEPTH
+#define SPI_FLASH_TRACE_DEPTH		256		/* entries, power of 2 */
+#endif
+#define SPI_FLASH_TRACE_MAGIC		0x52544C46	/* "FLTR" */
+#define SPI_FLASH_TRACE_VERSION		1
+
+/* One traced command, start and end are DWT->CYCCNT at CS low and when the command
+ * is complete, BUSY included for program and erase */
+struct spi_flash_trace
+{
+	uint8_t				opcode;
+	uint8_t				reserved[3];
+	uint32_t			addr;
+	uint32_t			len;
+	uint32_t			start;
+	uint32_t			end;
+};
+
+#ifdef CONFIG_SPI_FLASH_TRACE
+#define SPI_FLASH_TRACE_BEGIN()					(DWT->CYCCNT)
+#define SPI_FLASH_TRACE(op, addr, len, start)	SPI_FLASH_TraceRecord(op, addr, len, start)
+#else
+#define SPI_FLASH_TRACE_BEGIN()					0
+#define SPI_FLASH_TRACE(op, addr, len, start)	((void)(start))
+#endif
+
+/* Operation types and read-back verification modes of SPI_FLASH_SetVerify() */
+#define SPI_FLASH_OP_ERASE			0
+#define SPI_FLASH_OP_PROGRAM		1
+#define SPI_FLASH_OP_MAX			2
+
+#define SPI_FLASH_VERIFY_OFF		0	/* trust the status register */
+#define SPI_FLASH_VERIFY_COMPARE	1	/* compare words, stop at the first mismatch */
+#define SPI_FLASH_VERIFY_HASH		2	/* compare the CRC32 of the whole range */
+
+int SPI_FLASH_Init(void);
+uint32_t SPI_FLASH_GetSize(void);
+const struct spi_flash_info *SPI_FLASH_GetInfo(void);
+uint32_t SPI_FLASH_ReadJedecId(void);
+uint32_t SPI_FLASH_Calibrate(void);
 uint8_t SPI_FLASH_SendByte(uint8_t byte);
 uint8_t SPI1_FLASH_ReadByte(void);
-static void SPI1_FLASH_WriteEnable(void);
 void SPI_FLASH_WriteDisable(void);
-static void SPI1_FLASH_WaitEnd(void);
 uint32_t SPI_FLASH_ReadId(void);
 uint32_t SPI_FLASH_ReadId(void);
 int SPI_FLASH_SectorErase(uint32_t addr);
 int New_SPI_FLASH_SectorErase(uint32_t addr, uint32_t size);
 int SPI_FLASH_PageWrite(uint32_t addr, uint8_t *pBuffer, uint8_t size);
 int New_SPI_FLASH_PageWrite( uint8_t *data, uint32_t addr, uint32_t size);
+int SPI_FLASH_WriteFlush(void);
+void SPI_FLASH_WritePoll(void);
 void SPI_FLASH_BufferRead(uint8_t *buffer, uint32_t addr, uint32_t size);
 void New_SPI_FLASH_BufferRead(uint32_t addr, uint8_t *buffer, uint32_t size);
 int SPI_FLASH_VerifyErase(uint32_t addr, uint32_t length);
+int SPI_FLASH_VerifyProgram(uint32_t addr, const uint8_t *data, uint32_t length);
+int SPI_FLASH_AutoVerify(int op, uint32_t addr, const uint8_t *data, uint32_t length);
+void SPI_FLASH_SetVerify(int op, int mode);
 
 int SPI_FLASH_NoCheck(uint8_t *pBuffer, uint32_t WriteAddr, uint16_t NumByteToWrite);
 int SPI_FLASH_Differ_PageWrite(uint8_t *pBuffer, uint32_t WriteAddr, uint16_t NumByteToWrite);
-void SPI_FLASH_Xfer(uint8_t *snd_buf, uint8_t *recv_buf, int bytes);
+int SPI_FLASH_Xfer(uint8_t *snd_buf, uint8_t *recv_buf, int bytes);
 uint8_t SPI_FLASH_ReadStatusRegister(void);
-void SPI_FLASH_WaitUntilNotBusy(void);
+uint8_t SPI_FLASH_ReadStatusRegister2(void);
+uint8_t SPI_FLASH_ReadRegister(uint8_t cmd);
+int SPI_FLASH_WaitUntilNotBusy(uint32_t timeout);
+int SPI_Flash_ChipErase(void);
 int SPI_Flash_BlockErase(uint32_t addr, uint32_t size);
+int SPI_FLASH_PlanErase(uint32_t addr, uint32_t size, struct flash_erase_op *ops, int max_ops);
+int SPI_FLASH_EraseRange(uint32_t addr, uint32_t size);
+const struct spi_flash_stats *SPI_FLASH_GetStats(void);
+void SPI_FLASH_ResetStats(void);
+void SPI_FLASH_DumpStats(int mode);
+void SPI_FLASH_TraceEnable(int on);
+void SPI_FLASH_TraceReset(void);
+void SPI_FLASH_DumpTrace(void);
 void test(void);
+
+/* Low level primitives for the asynchronous job engine in flash_job.c, they do not take
+ * the bus lock and must only be used by its owner */
+void SPI_FLASH_Select(void);
+void SPI_FLASH_Deselect(void);
+int SPI_FLASH_CmdAddr(uint8_t *buf, uint8_t cmd, uint32_t addr);
+int SPI_FLASH_ReadCmd(uint8_t *buf, uint32_t addr);
+int SPI_FLASH_XferStart(uint8_t *snd_buf, uint8_t *recv_buf, uint16_t bytes, void (*done)(int status));
+void SPI_FLASH_EraseStep(uint32_t addr, uint32_t end, struct flash_erase_op *op);
+void SPI_FLASH_CacheInvalidate(uint32_t addr, uint32_t size);
+void SPI_FLASH_WcDiscard(uint32_t addr, uint32_t size);
+void SPI_FLASH_StatErase(uint32_t addr, uint32_t size);
+int SPI_FLASH_ProgSkip(const uint8_t *data, uint32_t len);
+int SPI_FLASH_ProgVerify(uint32_t addr, const uint8_t *data, uint32_t len);
+void SPI_FLASH_StatProg(uint32_t bytes);
+void SPI_FLASH_StatRead(uint32_t bytes);
+void SPI_FLASH_StatBusy(uint32_t cycles);
+void SPI_FLASH_TraceRecord(uint8_t opcode, uint32_t addr, uint32_t len, uint32_t start);
 #endif /* INC_SPI_FLASH_H_ */
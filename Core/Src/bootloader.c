@@ -7,14 +7,11 @@
  ********************************************************************************/
 #include <stdio.h>
 #include "spi_flash.h"
+#include "flash_job.h"
 #include "elf.h"
 #include "dump.h"
 #include "littlefs_port.h"
 #include "lfs.h"
-/* LittleFS partition start address and size */
-#define LFS_PART_OFSET		0x500000
-#define LFS_PART_SIZE		0x500000
-
 #define DEF_APPS_DIR		"/"
 
 #define PAGE_SIZE			256
@@ -43,28 +40,14 @@ int get_user_choice();
 
 int parser_bootfile(char *elf, int size);
 
-int boot_elf(char *elf);
+int boot_elf(char *elf, uint32_t *entry);
 
 int do_load_elf()
 {
 	int				rv;
 	char            elf_fname[32];
 	int				choice = -1;
-
-	const struct lfs_config cfg = {
-		.read 				= lfs_read,
-		.prog 				= lfs_write,
-		.erase 				= lfs_SectorErase,
-		.sync				= lfs_sync,
-
-		.read_size 			= 256,
-		.prog_size 			= 256,
-		.block_size 		= 65536,
-		.block_count 		= 64,
-		.block_cycles 		= 100,
-		.cache_size 		= 256,
-
-	};
+	uint32_t		entry = 0;
 
 	printf ("\r\nAU15P Board SPI Flash Bootloader v1.0 Build on %s\r\n", __DATE__);
 
@@ -99,13 +82,22 @@ int do_load_elf()
 */
 BOOT_ELF:
 	printf("Boot application %s\r\n", elf_fname);
-	boot_elf(elf_fname);
+	rv = boot_elf(elf_fname, &entry);
 
 cleanup:
-	lfs_unmount(&lfs);
+	/* Leave the file system cleanly, the next boot can mount it from the hint */
+	lfs_port_unmount(&lfs);
+	if( rv < 0 )
+		return rv;
 
+	/* A background pre-erase must not be left running when the application takes the bus */
+	flash_job_flush();
 
+	/* Jump to run ELF application */
+	printf("the program address 0x%02X\r\n", entry);
+	((void (*)(void))entry)();
 
+	/* should never come here */
 	return 0;
 }
 
@@ -142,7 +134,7 @@ int parser_bootfile( char *elf, int size)
 	}
 
 cleanup:
-	lfs_file_close(&lfs, &file);
+	lfs_port_file_close(&lfs, &file);
 	return rv;
 }
 
@@ -150,7 +142,11 @@ int valid_elf_image(void *addr);
 
 void load_elf_image(Elf32_Ehdr *ehdr);
 
-int boot_elf(char *elf)
+/* Description:  Load the ELF image elf from the file system to its load addresses.
+ * Return:       0 with the entry point in entry, <0 on failure. The file system stays
+ *               mounted, do_load_elf() unmounts it.
+ */
+int boot_elf(char *elf, uint32_t *entry)
 {
 
 	Elf32_Ehdr	    ehdr; /* Elf header structure pointer */
@@ -163,10 +159,9 @@ int boot_elf(char *elf)
 	printf("Attempting to open file: %s\n", fpath);
 
 	/* open and read boot configure file */
-	if( lfs_file_open(&lfs, &file, fpath, LFS_O_RDONLY) < 0)
+	if( lfs_port_file_open(&lfs, &file, fpath, LFS_O_RDONLY) < 0)
 	{
 		printf("ERROR: Open ELF image %s failure\r\n", elf);
-		lfs_unmount(&lfs);
 		return -2;
 	}
 
@@ -181,20 +176,16 @@ int boot_elf(char *elf)
     if ( !valid_elf_image(&ehdr) )
     {
 		printf("## %s is not a 32-bit ELF image\r\n", elf);
+		rv = -4;
 		goto cleanup;
     }
 
     /* Load ELF application from SPI Flash to DDR */
     load_elf_image(&ehdr);
+    *entry = ehdr.e_entry;
 
-    /* Jump to run ELF application */
-    printf("the program address 0x%02X\r\n", ehdr.e_entry);
-	((void (*)(void))(ehdr.e_entry))();
-    return 0;
-
-    /* should never come here */
 cleanup:
-	lfs_file_close(&lfs, &file);
+	lfs_port_file_close(&lfs, &file);
 	return rv;
 }
 
@@ -0,0 +1,381 @@
+/*
+ * flash_dev.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "spi_flash.h"
+#include "spi3_flash.h"
+#include "flash_dev.h"
+
+/* Background jobs in flight per pair operation, a job per stripe */
+#define PAIR_JOBS			8
+
+/*+--------------------------------+
+ *| SPI1 and SPI3 parts            |
+ *+--------------------------------+*/
+
+static int spi1_read(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	if( addr + size > dev->size )
+		return -2;
+
+	New_SPI_FLASH_BufferRead(addr, buf, size);
+	return 0;
+}
+
+static int spi1_prog(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+	return New_SPI_FLASH_PageWrite((uint8_t *)buf, addr, size);
+}
+
+static int spi1_erase(struct flash_dev *dev, uint32_t addr, uint32_t size)
+{
+	return SPI_FLASH_EraseRange(addr, size);
+}
+
+static int spi1_sync(struct flash_dev *dev)
+{
+	return SPI_FLASH_WriteFlush();
+}
+
+static int spi1_submit(struct flash_dev *dev, struct flash_job *job)
+{
+	int					rv;
+
+	/* Jobs do not go through the write-combining buffer */
+	if( (rv = SPI_FLASH_WriteFlush()) < 0 )
+		return rv;
+
+	return flash_job_submit(job);
+}
+
+static int spi3_read(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	return SPI3_FLASH_Read(addr, buf, size);
+}
+
+static int spi3_prog(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+	return SPI3_FLASH_Program(addr, buf, size);
+}
+
+static int spi3_erase(struct flash_dev *dev, uint32_t addr, uint32_t size)
+{
+	return SPI3_FLASH_EraseRange(addr, size);
+}
+
+static const struct flash_dev_ops	spi1_ops = {
+	.read		= spi1_read,
+	.prog		= spi1_prog,
+	.erase		= spi1_erase,
+	.sync		= spi1_sync,
+	.submit		= spi1_submit,
+};
+
+static const struct flash_dev_ops	spi3_ops = {
+	.read		= spi3_read,
+	.prog		= spi3_prog,
+	.erase		= spi3_erase,
+};
+
+struct flash_dev					flash_dev_spi1 = {
+	.name		= "spi1",
+	.ops		= &spi1_ops,
+};
+
+struct flash_dev					flash_dev_spi3 = {
+	.name		= "spi3",
+	.ops		= &spi3_ops,
+};
+
+int flash_dev_init(void)
+{
+	int					rv;
+
+	flash_dev_spi1.size = SPI_FLASH_GetSize();
+	flash_dev_spi1.page_size = SPI_FLASH_GetInfo()->page_size;
+	flash_dev_spi1.erase_size = flash_info_min_erase(SPI_FLASH_GetInfo());
+
+	rv = SPI3_FLASH_Init();
+	flash_dev_spi3.size = SPI3_FLASH_GetSize();
+	flash_dev_spi3.page_size = SPI3_FLASH_GetInfo()->page_size;
+	flash_dev_spi3.erase_size = flash_info_min_erase(SPI3_FLASH_GetInfo());
+
+	return rv;
+}
+
+/*+--------------------------------+
+ *| Striped and mirrored pairs     |
+ *+--------------------------------+*/
+
+/* The jobs of one pair operation, they live on the caller's stack until pair_wait() */
+struct pair_ctx
+{
+	struct flash_job	jobs[PAIR_JOBS];
+	int					njobs;
+	int					rv;
+};
+
+static void pair_wait(struct pair_ctx *ctx)
+{
+	int					i, rv;
+
+	for(i=0; i<ctx->njobs; i++)
+	{
+		rv = flash_job_wait(&ctx->jobs[i]);
+		if( rv < 0 && ctx->rv == 0 )
+			ctx->rv = rv;
+	}
+
+	ctx->njobs = 0;
+}
+
+/* Description:  Run one operation on a part of the pair, in the background if the part
+ *               can, so the next operation on the other part overlaps with it.
+ */
+static void pair_op(struct pair_ctx *ctx, struct flash_dev *dev, enum flash_job_type type,
+		uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	struct flash_job   *job;
+	int					rv;
+
+	if( ctx->rv < 0 )
+		return;
+
+	if( dev->ops->submit )
+	{
+		if( ctx->njobs == PAIR_JOBS )
+			pair_wait(ctx);
+
+		job = &ctx->jobs[ctx->njobs];
+		memset(job, 0, sizeof(*job));
+		job->type = type;
+		job->addr = addr;
+		job->buf = buf;
+		job->len = len;
+
+		if( (rv = dev->ops->submit(dev, job)) == 0 )
+			ctx->njobs++;
+	}
+	else if( type == FLASH_JOB_READ )
+	{
+		rv = dev->ops->read(dev, addr, buf, len);
+	}
+	else if( type == FLASH_JOB_PROGRAM )
+	{
+		rv = dev->ops->prog(dev, addr, buf, len);
+	}
+	else
+	{
+		rv = dev->ops->erase(dev, addr, len);
+	}
+
+	if( rv < 0 && ctx->rv == 0 )
+		ctx->rv = rv;
+}
+
+/* Index of the part which runs in the background, it is started first */
+static int pair_first(struct flash_dev *dev)
+{
+	return dev->sub[0]->ops->submit ? 0 : 1;
+}
+
+static int stripe_xfer(struct flash_dev *dev, enum flash_job_type type, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	struct pair_ctx		ctx = { .njobs = 0, .rv = 0 };
+	uint32_t			unit, ofset, len;
+
+	if( addr + size > dev->size )
+		return -2;
+
+	while( size > 0 )
+	{
+		unit = addr / dev->stripe;
+		ofset = addr % dev->stripe;
+		len = dev->stripe - ofset;
+		len = len > size ? size : len;
+
+		pair_op(&ctx, dev->sub[unit & 1], type, (unit >> 1) * dev->stripe + ofset, buf, len);
+
+		addr += len;
+		buf += len;
+		size -= len;
+	}
+
+	pair_wait(&ctx);
+	return ctx.rv;
+}
+
+static int stripe_read(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	return stripe_xfer(dev, FLASH_JOB_READ, addr, buf, size);
+}
+
+static int stripe_prog(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+	return stripe_xfer(dev, FLASH_JOB_PROGRAM, addr, (uint8_t *)buf, size);
+}
+
+/* An aligned range of the pair is the same half-size range on both parts */
+static int stripe_erase(struct flash_dev *dev, uint32_t addr, uint32_t size)
+{
+	struct pair_ctx		ctx = { .njobs = 0, .rv = 0 };
+	int					first = pair_first(dev);
+
+	if( addr % dev->erase_size || size % dev->erase_size )
+		return -2;
+
+	if( addr + size > dev->size )
+		return -2;
+
+	pair_op(&ctx, dev->sub[first], FLASH_JOB_ERASE, addr / 2, NULL, size / 2);
+	pair_op(&ctx, dev->sub[!first], FLASH_JOB_ERASE, addr / 2, NULL, size / 2);
+	pair_wait(&ctx);
+
+	return ctx.rv;
+}
+
+static int pair_sync(struct flash_dev *dev)
+{
+	int					rv0 = flash_dev_sync(dev->sub[0]);
+	int					rv1 = flash_dev_sync(dev->sub[1]);
+
+	return rv0 < 0 ? rv0 : rv1;
+}
+
+static int mirror_read(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	struct pair_ctx		ctx = { .njobs = 0, .rv = 0 };
+	struct flash_dev   *sub;
+	int					first = pair_first(dev);
+	uint32_t			half;
+
+	if( addr + size > dev->size )
+		return -2;
+
+	/* Short reads are not worth a job, spread them over both parts */
+	if( size <= 2 * dev->page_size )
+	{
+		sub = dev->sub[dev->next];
+		dev->next ^= 1;
+		return sub->ops->read(sub, addr, buf, size);
+	}
+
+	half = size / 2 / dev->page_size * dev->page_size;
+	pair_op(&ctx, dev->sub[first], FLASH_JOB_READ, addr, buf, half);
+	pair_op(&ctx, dev->sub[!first], FLASH_JOB_READ, addr + half, buf + half, size - half);
+	pair_wait(&ctx);
+
+	return ctx.rv;
+}
+
+static int mirror_write(struct flash_dev *dev, enum flash_job_type type, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	struct pair_ctx		ctx = { .njobs = 0, .rv = 0 };
+	int					first = pair_first(dev);
+
+	if( addr + size > dev->size )
+		return -2;
+
+	pair_op(&ctx, dev->sub[first], type, addr, buf, size);
+	pair_op(&ctx, dev->sub[!first], type, addr, buf, size);
+	pair_wait(&ctx);
+
+	return ctx.rv;
+}
+
+static int mirror_prog(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+	return mirror_write(dev, FLASH_JOB_PROGRAM, addr, (uint8_t *)buf, size);
+}
+
+static int mirror_erase(struct flash_dev *dev, uint32_t addr, uint32_t size)
+{
+	return mirror_write(dev, FLASH_JOB_ERASE, addr, NULL, size);
+}
+
+static const struct flash_dev_ops	stripe_ops = {
+	.read		= stripe_read,
+	.prog		= stripe_prog,
+	.erase		= stripe_erase,
+	.sync		= pair_sync,
+};
+
+static const struct flash_dev_ops	mirror_ops = {
+	.read		= mirror_read,
+	.prog		= mirror_prog,
+	.erase		= mirror_erase,
+	.sync		= pair_sync,
+};
+
+int flash_dev_stripe_init(struct flash_dev *dev, struct flash_dev *a, struct flash_dev *b, uint32_t stripe)
+{
+	uint32_t			erase_size = a->erase_size > b->erase_size ? a->erase_size : b->erase_size;
+
+	if( !a->size || !b->size || !stripe || erase_size % stripe )
+	{
+		printf("Norflash stripe over %s and %s not possible\r\n", a->name, b->name);
+		return -1;
+	}
+
+	memset(dev, 0, sizeof(*dev));
+	dev->name = "stripe";
+	dev->ops = &stripe_ops;
+	dev->sub[0] = a;
+	dev->sub[1] = b;
+	dev->stripe = stripe;
+	dev->size = 2 * ((a->size < b->size ? a->size : b->size) / erase_size * erase_size);
+	dev->page_size = a->page_size < b->page_size ? a->page_size : b->page_size;
+	dev->page_size = dev->page_size < stripe ? dev->page_size : stripe;
+	dev->erase_size = 2 * erase_size;
+
+	return 0;
+}
+
+int flash_dev_mirror_init(struct flash_dev *dev, struct flash_dev *a, struct flash_dev *b)
+{
+	if( !a->size || !b->size )
+	{
+		printf("Norflash mirror over %s and %s not possible\r\n", a->name, b->name);
+		return -1;
+	}
+
+	memset(dev, 0, sizeof(*dev));
+	dev->name = "mirror";
+	dev->ops = &mirror_ops;
+	dev->sub[0] = a;
+	dev->sub[1] = b;
+	dev->size = a->size < b->size ? a->size : b->size;
+	dev->page_size = a->page_size < b->page_size ? a->page_size : b->page_size;
+	dev->erase_size = a->erase_size > b->erase_size ? a->erase_size : b->erase_size;
+
+	return 0;
+}
+
+/*+--------------------------------+
+ *| Device API                     |
+ *+--------------------------------+*/
+
+int flash_dev_read(struct flash_dev *dev, uint32_t addr, uint8_t *buf, uint32_t size)
+{
+	return dev->ops->read(dev, addr, buf, size);
+}
+
+int flash_dev_prog(struct flash_dev *dev, uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+	return dev->ops->prog(dev, addr, buf, size);
+}
+
+int flash_dev_erase(struct flash_dev *dev, uint32_t addr, uint32_t size)
+{
+	return dev->ops->erase(dev, addr, size);
+}
+
+int flash_dev_sync(struct flash_dev *dev)
+{
+	return dev->ops->sync ? dev->ops->sync(dev) : 0;
+}
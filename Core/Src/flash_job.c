@@ -0,0 +1,566 @@
+/*
+ * flash_job.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Scheduling policy:
+ *  - Jobs run in submit order, except reads which do not overlap the running job
+ *    or any queued program/erase: they go to a read queue served first.
+ *  - While an erase/program is busy and a read is waiting (a queued read job or a
+ *    blocking New_SPI_FLASH_BufferRead() outside the range being erased), the
+ *    operation is suspended, the reads are served, then it resumes. Only on parts
+ *    whose suspend/resume opcodes and status bit the descriptor knows, from SFDP
+ *    and the known part table; other parts make the reads wait.
+ *  - A suspension serves reads for at most SUSPEND_HOLD_MS, even if more keep
+ *    coming. After a resume the operation runs at least SUSPEND_MIN_RUN_MS
+ *    before it can be suspended again, and at most SUSPEND_MAX times per
+ *    erase/program, so it always makes progress.
+ *
+ *  Every step runs from flash_job_poll() in thread context: the status polls and
+ *  short commands go through the polled HAL calls, whose HAL_GetTick() timeouts
+ *  never expire inside the SysTick or DMA interrupts. The DMA interrupt only
+ *  releases CS and hands the end of the transfer over to the next poll.
+ */
+
+#include <stdio.h>
+#include "main.h"
+#include "spi_flash.h"
+#include "flash_job.h"
+
+/* DMA CNDTR is 16 bits wide */
+#define JOB_DMA_MAX_CHUNK	0xFFFF
+
+/* Suspend latency of the part in ticks, plus one for the tick boundary */
+#define SUSPEND_TIMEOUT(us)	(((us) + 999) / 1000 + 1)
+#define SUSPEND_MIN_RUN_MS	1
+#define SUSPEND_HOLD_MS		2
+#define SUSPEND_MAX			64
+
+enum job_state
+{
+	JOB_ST_IDLE,		/* no job running, the bus is free */
+	JOB_ST_XFER,		/* DMA in progress, CS asserted */
+	JOB_ST_XFER_DONE,	/* DMA finished, s_xfer_status is its result */
+	JOB_ST_BUSY,		/* program/erase in progress, polled for BUSY */
+	JOB_ST_SUSPENDING,	/* suspend sent, waiting for BUSY to clear */
+	JOB_ST_SUSPENDED,	/* program/erase suspended, the bus is free for reads */
+};
+
+static struct flash_job		   *s_head;		/* running or parked job, then the queue */
+static struct flash_job		   *s_tail;
+static struct flash_job		   *s_rhead;	/* reads allowed to bypass s_head */
+static struct flash_job		   *s_rtail;
+static struct flash_job		   *s_cur;		/* job which owns the current step */
+static volatile uint8_t			s_state = JOB_ST_IDLE;
+static volatile int				s_pause;
+static volatile uint8_t			s_read_wanted;
+static uint8_t					s_suspended;	/* s_head's erase/program is suspended */
+static volatile int				s_xfer_status;
+static uint8_t					s_polling;
+
+static struct flash_erase_op	s_op;		/* current program/erase step of s_head */
+static uint32_t					s_rsize;	/* current read chunk of s_cur */
+static uint32_t					s_tickstart;
+static uint32_t					s_cycstart;		/* DWT->CYCCNT when BUSY started */
+static uint32_t					s_resume_tick;
+static uint32_t					s_busy_elapsed;
+static uint32_t					s_suspends;
+static uint32_t					s_trace_op;		/* trace start of s_op and of s_rsize */
+static uint32_t					s_trace_read;
+static uint8_t					s_cmd[SPI_FLASH_CMD_MAX];
+
+static void job_step(void);
+
+static int job_overlap(struct flash_job *job, uint32_t addr, uint32_t len)
+{
+	return addr < job->addr + job->len && job->addr < addr + len;
+}
+
+static void job_dequeue(struct flash_job *job)
+{
+	if( job == s_rhead )
+	{
+		s_rhead = job->next;
+		if( !s_rhead )
+			s_rtail = NULL;
+	}
+	else
+	{
+		s_head = job->next;
+		if( !s_head )
+			s_tail = NULL;
+	}
+}
+
+/* Step boundary: go back to the suspended operation, or start the next step */
+static void job_next(void)
+{
+	if( s_suspended )
+	{
+		s_state = JOB_ST_SUSPENDED;
+	}
+	else
+	{
+		s_state = JOB_ST_IDLE;
+		job_step();
+	}
+}
+
+static void job_finish(struct flash_job *job, int status)
+{
+	/* Reads bypass a suspended s_head, only s_head itself ends the suspension */
+	if( job == s_head )
+		s_suspended = 0;
+	job_dequeue(job);
+	s_cur = NULL;
+
+	job->status = status;
+	if( job->cb )
+		job->cb(job, status);
+
+	job_next();
+}
+
+static void job_wait_busy(uint32_t timeout)
+{
+	s_op.timeout = timeout;
+	s_tickstart = HAL_GetTick();
+	s_cycstart = DWT->CYCCNT;
+	s_resume_tick = s_tickstart;
+	s_busy_elapsed = 0;
+	s_suspends = 0;
+	s_state = JOB_ST_BUSY;
+}
+
+/* DMA/SPI interrupt: the data phase of the current step is done */
+static void job_xfer_irq(int status)
+{
+	SPI_FLASH_Deselect();
+	s_xfer_status = status;
+	s_state = JOB_ST_XFER_DONE;
+}
+
+/* Finish the step whose data phase job_xfer_irq() reported */
+static void job_xfer_done(int status)
+{
+	struct flash_job		   *job = s_cur;
+
+	if( status < 0 )
+	{
+		job_finish(job, status);
+		return;
+	}
+
+	if( job->type == FLASH_JOB_READ )
+	{
+		SPI_FLASH_TRACE(s_cmd[0], job->addr + job->pos, s_rsize, s_trace_read);
+		job->pos += s_rsize;
+		if( job->pos < job->len )
+			job_next();
+		else
+			job_finish(job, 0);
+	}
+	else
+	{
+		job_wait_busy(SPI_FLASH_GetInfo()->pp_max_ms);
+	}
+}
+
+static int job_write_enable(void)
+{
+	SPI_FLASH_Select();
+	SPI_FLASH_SendByte(0x06);
+	SPI_FLASH_Deselect();
+
+	return (SPI_FLASH_ReadStatusRegister() & 0x02) ? 0 : -3;
+}
+
+static void job_start_read(struct flash_job *job)
+{
+	uint32_t					addr = job->addr + job->pos;
+	int							bytes;
+
+	s_cur = job;
+	s_rsize = job->len - job->pos;
+	if( s_rsize > JOB_DMA_MAX_CHUNK )
+		s_rsize = JOB_DMA_MAX_CHUNK;
+
+	SPI_FLASH_StatRead(s_rsize);
+	s_trace_read = SPI_FLASH_TRACE_BEGIN();
+	bytes = SPI_FLASH_ReadCmd(s_cmd, addr);
+	SPI_FLASH_Select();
+	SPI_FLASH_Xfer(s_cmd, NULL, bytes);
+
+	s_state = JOB_ST_XFER;
+	if( SPI_FLASH_XferStart(NULL, job->buf + job->pos, s_rsize, job_xfer_irq) < 0 )
+	{
+		SPI_FLASH_Deselect();
+		job_finish(job, -1);
+	}
+}
+
+/* Bytes of the program step at the job position, up to the end of its page */
+static uint32_t job_prog_size(struct flash_job *job)
+{
+	uint32_t					page_size = SPI_FLASH_GetInfo()->page_size;
+	uint32_t					size;
+
+	size = page_size - ((job->addr + job->pos) % page_size);
+	return size > job->len - job->pos ? job->len - job->pos : size;
+}
+
+/* Start the next step, bypassing reads first, or park the queue if the bus is wanted */
+static void job_step(void)
+{
+	struct flash_job		   *job;
+	uint32_t					addr;
+	int							bytes;
+
+	if( s_pause )
+	{
+		s_state = JOB_ST_IDLE;
+		return;
+	}
+
+	if( s_rhead )
+	{
+		job_start_read(s_rhead);
+		return;
+	}
+
+	if( !(job = s_head) )
+		return;
+
+	if( job->type == FLASH_JOB_PROGRAM )
+	{
+		/* Like SPI_FLASH_DoProgram(): pages of 0xFF leave the erased cells as they are,
+		 * the whole job is read back with the program verification mode at the end */
+		while( job->pos < job->len && SPI_FLASH_ProgSkip(job->buf + job->pos, job_prog_size(job)) )
+			job->pos += job_prog_size(job);
+		if( job->pos >= job->len )
+		{
+			job_finish(job, SPI_FLASH_ProgVerify(job->addr, job->buf, job->len));
+			return;
+		}
+	}
+
+	if( job->pos >= job->len )
+	{
+		job_finish(job, 0);
+		return;
+	}
+
+	s_cur = job;
+	addr = job->addr + job->pos;
+	switch( job->type )
+	{
+		case FLASH_JOB_READ:
+			job_start_read(job);
+			break;
+
+		case FLASH_JOB_PROGRAM:
+			s_op.addr = addr;
+			s_op.cmd = 0x02;
+			s_op.size = job_prog_size(job);
+			SPI_FLASH_CacheInvalidate(s_op.addr, s_op.size);
+
+			if( job_write_enable() < 0 )
+			{
+				job_finish(job, -3);
+				break;
+			}
+
+			SPI_FLASH_StatProg(s_op.size);
+			s_trace_op = SPI_FLASH_TRACE_BEGIN();
+			bytes = SPI_FLASH_CmdAddr(s_cmd, s_op.cmd, addr);
+			SPI_FLASH_Select();
+			SPI_FLASH_Xfer(s_cmd, NULL, bytes);
+
+			s_state = JOB_ST_XFER;
+			if( SPI_FLASH_XferStart(job->buf + job->pos, NULL, s_op.size, job_xfer_irq) < 0 )
+			{
+				SPI_FLASH_Deselect();
+				job_finish(job, -1);
+			}
+			break;
+
+		case FLASH_JOB_ERASE:
+			SPI_FLASH_EraseStep(addr, job->addr + job->len, &s_op);
+			SPI_FLASH_WcDiscard(s_op.addr, s_op.size);
+			SPI_FLASH_CacheInvalidate(s_op.addr, s_op.size);
+
+			if( job_write_enable() < 0 )
+			{
+				job_finish(job, -3);
+				break;
+			}
+
+			s_trace_op = SPI_FLASH_TRACE_BEGIN();
+			bytes = SPI_FLASH_CmdAddr(s_cmd, s_op.cmd, s_op.addr);
+			SPI_FLASH_Select();
+			SPI_FLASH_Xfer(s_cmd, NULL, bytes);
+			SPI_FLASH_Deselect();
+			SPI_FLASH_StatErase(s_op.addr, s_op.size);
+
+			job_wait_busy(s_op.timeout);
+			break;
+	}
+}
+
+/* The running program/erase step is done, move to the next one */
+static void job_step_done(void)
+{
+	SPI_FLASH_StatBusy(DWT->CYCCNT - s_cycstart);
+	SPI_FLASH_TRACE(s_op.cmd, s_op.addr, s_op.size, s_trace_op);
+	s_head->pos += s_op.size;
+	s_state = JOB_ST_IDLE;
+	job_step();
+}
+
+static int job_may_suspend(uint32_t now)
+{
+	if( !s_rhead && !s_read_wanted )
+		return 0;
+
+	if( !flash_info_can_suspend(SPI_FLASH_GetInfo()) )
+		return 0;
+
+	return s_suspends < SUSPEND_MAX && now - s_resume_tick >= SUSPEND_MIN_RUN_MS;
+}
+
+void flash_job_poll(void)
+{
+	const struct flash_suspend *sus = &SPI_FLASH_GetInfo()->suspend;
+	uint32_t					now = HAL_GetTick();
+
+	/* A job callback may submit the next job, which polls again */
+	if( s_polling )
+		return;
+	s_polling = 1;
+
+	switch( s_state )
+	{
+		case JOB_ST_XFER_DONE:
+			job_xfer_done(s_xfer_status);
+			break;
+
+		case JOB_ST_BUSY:
+			if( !(SPI_FLASH_ReadStatusRegister() & 0x01) )
+			{
+				job_step_done();
+			}
+			else if( job_may_suspend(now) )
+			{
+				SPI_FLASH_Select();
+				SPI_FLASH_SendByte(sus->suspend);
+				SPI_FLASH_Deselect();
+				SPI_FLASH_TRACE(sus->suspend, s_op.addr, 0, SPI_FLASH_TRACE_BEGIN());
+
+				s_busy_elapsed += now - s_tickstart;
+				s_tickstart = now;
+				s_state = JOB_ST_SUSPENDING;
+			}
+			else if( s_busy_elapsed + now - s_tickstart > s_op.timeout )
+			{
+				job_finish(s_head, -3);
+			}
+			break;
+
+		case JOB_ST_SUSPENDING:
+			if( SPI_FLASH_ReadStatusRegister() & 0x01 )
+			{
+				if( now - s_tickstart > SUSPEND_TIMEOUT(sus->max_us) )
+					job_finish(s_head, -3);
+				break;
+			}
+
+			/* The operation may have completed before the suspend took effect */
+			if( !(SPI_FLASH_ReadRegister(sus->status_cmd) & sus->status_mask) )
+			{
+				job_step_done();
+				break;
+			}
+
+			s_suspends++;
+			s_suspended = 1;
+			s_state = JOB_ST_SUSPENDED;
+			/* Fall through */
+
+		case JOB_ST_SUSPENDED:
+			/* s_tickstart is when the suspend was sent */
+			if( s_rhead && !s_pause && now - s_tickstart < SUSPEND_HOLD_MS )
+			{
+				job_start_read(s_rhead);
+			}
+			else if( !s_read_wanted )
+			{
+				SPI_FLASH_Select();
+				SPI_FLASH_SendByte(sus->resume);
+				SPI_FLASH_Deselect();
+				SPI_FLASH_TRACE(sus->resume, s_op.addr, 0, SPI_FLASH_TRACE_BEGIN());
+
+				s_tickstart = now;
+				s_resume_tick = now;
+				s_suspended = 0;
+				s_state = JOB_ST_BUSY;
+			}
+			break;
+
+		case JOB_ST_IDLE:
+			if( (s_head || s_rhead) && !s_pause )
+				job_step();
+			break;
+
+		default:
+			break;
+	}
+
+	s_polling = 0;
+}
+
+int flash_job_submit(struct flash_job *job)
+{
+	struct flash_job		   *it;
+	uint32_t					sector;
+	uint32_t					end;
+	uint32_t					primask;
+	int							bypass;
+
+	if( job->addr + job->len > SPI_FLASH_GetSize() )
+		return -2;
+
+	/* Erase whole sectors, like SPI_FLASH_EraseRange() */
+	if( job->type == FLASH_JOB_ERASE )
+	{
+		sector = flash_info_min_erase(SPI_FLASH_GetInfo());
+		end = (job->addr + job->len + sector - 1) / sector * sector;
+		job->addr = job->addr / sector * sector;
+		job->len = end - job->addr;
+	}
+
+	job->status = FLASH_JOB_PENDING;
+	job->pos = 0;
+	job->next = NULL;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	/* A read may only bypass program/erase jobs it does not depend on */
+	bypass = (job->type == FLASH_JOB_READ);
+	for(it=s_head; it && bypass; it=it->next)
+	{
+		if( it->type != FLASH_JOB_READ && job_overlap(it, job->addr, job->len) )
+			bypass = 0;
+	}
+
+	if( bypass )
+	{
+		if( s_rtail )
+			s_rtail->next = job;
+		else
+			s_rhead = job;
+		s_rtail = job;
+	}
+	else
+	{
+		if( s_tail )
+			s_tail->next = job;
+		else
+			s_head = job;
+		s_tail = job;
+	}
+
+	__set_PRIMASK(primask);
+
+	/* Start it right away if the bus is free */
+	flash_job_poll();
+
+	return 0;
+}
+
+int flash_job_wait(struct flash_job *job)
+{
+	while( job->status == FLASH_JOB_PENDING )
+	{
+		flash_job_poll();
+	}
+
+	return job->status;
+}
+
+void flash_job_flush(void)
+{
+	while( s_head || s_rhead )
+	{
+		flash_job_poll();
+	}
+}
+
+int flash_job_idle(void)
+{
+	return s_head == NULL && s_rhead == NULL;
+}
+
+void flash_job_pause(void)
+{
+	s_pause++;
+	while( s_state != JOB_ST_IDLE )
+	{
+		flash_job_poll();
+	}
+}
+
+/* A queued or running program/erase writes [addr, addr+len) */
+static int job_write_pending(uint32_t addr, uint32_t len)
+{
+	struct flash_job		   *it;
+	uint32_t					primask;
+	int							found = 0;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	for(it=s_head; it && !found; it=it->next)
+	{
+		if( it->type != FLASH_JOB_READ && job_overlap(it, addr, len) )
+			found = 1;
+	}
+	__set_PRIMASK(primask);
+
+	return found;
+}
+
+void flash_job_pause_read(uint32_t addr, uint32_t len)
+{
+	uint32_t					primask;
+
+	/* The read must see the queued programs/erases of its range, run the queue up to
+	 * them first. A paused engine cannot, its owner has waited for them already. */
+	while( !s_pause && job_write_pending(addr, len) )
+	{
+		flash_job_poll();
+	}
+
+	s_pause++;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	/* Reading the range under erase/program returns garbage, wait for it instead */
+	if( !(s_head && s_head->type != FLASH_JOB_READ && job_overlap(s_head, addr, len)) )
+		s_read_wanted = 1;
+	__set_PRIMASK(primask);
+
+	while( s_state != JOB_ST_IDLE && !(s_read_wanted && s_state == JOB_ST_SUSPENDED) )
+	{
+		flash_job_poll();
+	}
+}
+
+void flash_job_resume(void)
+{
+	if( s_pause > 0 )
+		s_pause--;
+
+	if( s_pause == 0 )
+		s_read_wanted = 0;
+}
@@ -0,0 +1,251 @@
+/*
+ * flash_part.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "crc16.h"
+
+/* Mount hint partition of version 2, LFS_HINT_PART_NAME in littlefs_port.c */
+#define HINT_PART_NAME		"lfshint"
+#define HINT_PART_SIZE		0x010000
+
+/* Built-in layout, written to a blank part and used when the table is unreadable */
+static const struct flash_part_table	s_default = {
+	.magic		= FLASH_PART_MAGIC,
+	.version	= FLASH_PART_VERSION,
+	.count		= 6,
+	.part		= {
+		{ "ptable",   0x000000, 0x010000,             FLASH_PART_TABLE },
+		{ "image0",   0x010000, 0x270000,             FLASH_PART_RAW },
+		{ "image1",   0x280000, 0x280000,             FLASH_PART_RAW },
+		{ "littlefs", 0x500000, 0x500000,             FLASH_PART_LFS },
+		{ "lfshint",  0xA00000, HINT_PART_SIZE,       FLASH_PART_SCRATCH },
+		{ "scratch",  0xA10000, FLASH_PART_SIZE_REST, FLASH_PART_SCRATCH },
+	},
+};
+
+static struct flash_part_table		s_table;
+
+/* s_table with the sizes resolved and clamped to the part */
+static struct flash_part			s_part[FLASH_PART_MAX];
+static int							s_count;
+
+static uint16_t flash_part_crc(const struct flash_part_table *table)
+{
+	return crc16_checksum((unsigned char *)table, offsetof(struct flash_part_table, crc));
+}
+
+static int flash_part_valid(const struct flash_part_table *table)
+{
+	if( table->magic != FLASH_PART_MAGIC || table->version == 0 || table->version > FLASH_PART_VERSION )
+		return 0;
+
+	if( table->count == 0 || table->count > FLASH_PART_MAX )
+		return 0;
+
+	return table->crc == flash_part_crc(table);
+}
+
+static int flash_part_blank(const struct flash_part_table *table)
+{
+	const uint8_t	   *p = (const uint8_t *)table;
+	uint32_t			i;
+
+	for(i=0; i<sizeof(*table); i++)
+	{
+		if( p[i] != 0xFF )
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Description:  Copy s_table to s_part, running FLASH_PART_SIZE_REST partitions to the
+ *               end of the part and cutting the ones which do not fit in it.
+ */
+static void flash_part_resolve(void)
+{
+	uint32_t			flash_size = SPI_FLASH_GetSize();
+	struct flash_part  *part;
+	int					i;
+
+	s_count = s_table.count;
+	for(i=0; i<s_count; i++)
+	{
+		part = &s_part[i];
+		*part = s_table.part[i];
+		part->name[FLASH_PART_NAME_LEN-1] = '\0';
+
+		if( part->offset >= flash_size )
+		{
+			printf("Partition %s @0x%06lX is past the end of the flash\r\n", part->name, (unsigned long)part->offset);
+			part->size = 0;
+		}
+		else if( part->size == FLASH_PART_SIZE_REST || part->size > flash_size - part->offset )
+		{
+			part->size = flash_size - part->offset;
+		}
+	}
+}
+
+/* Description:  Bring a version 1 table to version 2: the lfshint partition is taken from
+ *               the start of the scratch partition, which only holds temporary data, and
+ *               erased. A table without room for it goes without mount hints.
+ * Return:       0 on success, <0 if the table could not be written
+ */
+static int flash_part_migrate(void)
+{
+	struct flash_part  *scratch = NULL;
+	struct flash_part  *part;
+	int					i, rv;
+
+	for(i=0; i<s_table.count; i++)
+	{
+		part = &s_table.part[i];
+		if( !strncmp(part->name, HINT_PART_NAME, FLASH_PART_NAME_LEN) )
+			break;
+		if( !scratch && part->type == FLASH_PART_SCRATCH && !strncmp(part->name, "scratch", FLASH_PART_NAME_LEN) )
+			scratch = part;
+	}
+
+	if( i == s_table.count &&
+		(!scratch || s_table.count == FLASH_PART_MAX ||
+		 scratch->offset + HINT_PART_SIZE > SPI_FLASH_GetSize() ||
+		 (scratch->size != FLASH_PART_SIZE_REST && scratch->size <= HINT_PART_SIZE)) )
+	{
+		printf("Norflash partition table v%u has no room for %s\r\n", s_table.version, HINT_PART_NAME);
+	}
+	else if( i == s_table.count )
+	{
+		/* Insert it in front of the scratch partition it comes from */
+		if( (rv = SPI_FLASH_EraseRange(scratch->offset, HINT_PART_SIZE)) < 0 )
+			return rv;
+
+		memmove(scratch + 1, scratch, (s_table.part + s_table.count - scratch) * sizeof(*scratch));
+		s_table.count++;
+		memset(scratch, 0, sizeof(*scratch));
+		strcpy(scratch->name, HINT_PART_NAME);
+		scratch->offset = scratch[1].offset;
+		scratch->size = HINT_PART_SIZE;
+		scratch->type = FLASH_PART_SCRATCH;
+
+		scratch[1].offset += HINT_PART_SIZE;
+		if( scratch[1].size != FLASH_PART_SIZE_REST )
+			scratch[1].size -= HINT_PART_SIZE;
+	}
+
+	printf("Norflash partition table v%u migrated to v%u\r\n", s_table.version, FLASH_PART_VERSION);
+	s_table.version = FLASH_PART_VERSION;
+	return flash_part_save();
+}
+
+int flash_part_init(void)
+{
+	int					rv = 0;
+
+	New_SPI_FLASH_BufferRead(FLASH_PART_TABLE_ADDR, (uint8_t *)&s_table, sizeof(s_table));
+
+	if( flash_part_valid(&s_table) && s_table.version < FLASH_PART_VERSION )
+	{
+		rv = flash_part_migrate();
+	}
+	else if( !flash_part_valid(&s_table) )
+	{
+		if( flash_part_blank(&s_table) )
+		{
+			printf("Norflash has no partition table, writing the default one\r\n");
+			s_table = s_default;
+			rv = flash_part_save();
+		}
+		else
+		{
+			printf("Norflash partition table is corrupted, using the default one\r\n");
+			s_table = s_default;
+		}
+	}
+
+	flash_part_resolve();
+	return rv;
+}
+
+int flash_part_save(void)
+{
+	int					rv;
+
+	s_table.crc = flash_part_crc(&s_table);
+	s_table.reserved = 0xFFFF;
+
+	if( (rv = SPI_FLASH_EraseRange(FLASH_PART_TABLE_ADDR, sizeof(s_table))) < 0 )
+		return rv;
+
+	if( (rv = New_SPI_FLASH_PageWrite((uint8_t *)&s_table, FLASH_PART_TABLE_ADDR, sizeof(s_table))) < 0 )
+		return rv;
+
+	return SPI_FLASH_WriteFlush();
+}
+
+const struct flash_part *flash_part_find(const char *name)
+{
+	int					i;
+
+	for(i=0; i<s_count; i++)
+	{
+		if( s_part[i].size && !strncmp(s_part[i].name, name, FLASH_PART_NAME_LEN) )
+			return &s_part[i];
+	}
+
+	return NULL;
+}
+
+void flash_part_dump(void)
+{
+	int					i;
+
+	printf("Norflash partitions:\r\n");
+	for(i=0; i<s_count; i++)
+	{
+		printf("  %-12s 0x%06lX - 0x%06lX %5lu KB\r\n", s_part[i].name, (unsigned long)s_part[i].offset,
+				(unsigned long)(s_part[i].offset + s_part[i].size), (unsigned long)(s_part[i].size >> 10));
+	}
+}
+
+static int flash_part_check(const struct flash_part *part, uint32_t off, uint32_t size)
+{
+	if( !part || off > part->size || size > part->size - off )
+		return -2;
+
+	return 0;
+}
+
+int flash_part_read(const struct flash_part *part, uint32_t off, uint8_t *buf, uint32_t size)
+{
+	if( flash_part_check(part, off, size) < 0 )
+		return -2;
+
+	New_SPI_FLASH_BufferRead(part->offset + off, buf, size);
+	return 0;
+}
+
+int flash_part_prog(const struct flash_part *part, uint32_t off, const uint8_t *buf, uint32_t size)
+{
+	if( flash_part_check(part, off, size) < 0 )
+		return -2;
+
+	return New_SPI_FLASH_PageWrite((uint8_t *)buf, part->offset + off, size);
+}
+
+/* The range is rounded out to whole sectors, keep it aligned to stay inside the partition */
+int flash_part_erase(const struct flash_part *part, uint32_t off, uint32_t size)
+{
+	if( flash_part_check(part, off, size) < 0 )
+		return -2;
+
+	return SPI_FLASH_EraseRange(part->offset + off, size);
+}
@@ -41,6 +41,80 @@ static inline void lfs_cache_zero(lfs_t *lfs, lfs_cache_t *pcache) {
     pcache->block = LFS_BLOCK_NULL;
 }
 
+// read through the lines of the block device read cache, a miss loads the
+// whole line
+static int lfs_bd_rawread(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off,
+        void *buffer, lfs_size_t size) {
+    if (!lfs->cfg->rcache_lines) {
+        return lfs->cfg->read(lfs->cfg, block, off, buffer, size);
+    }
+
+    uint8_t *data = buffer;
+    while (size > 0) {
+        lfs_off_t loff = lfs_aligndown(off, lfs->rline_size);
+        lfs_size_t diff = lfs_min(size, loff + lfs->rline_size - off);
+
+        struct lfs_rline *line = NULL;
+        struct lfs_rline *victim = &lfs->rlines[0];
+        for (lfs_size_t i = 0; i < lfs->cfg->rcache_lines; i++) {
+            if (lfs->rlines[i].block == block && lfs->rlines[i].off == loff) {
+                line = &lfs->rlines[i];
+                break;
+            }
+
+            if (lfs->rlines[i].stamp < victim->stamp) {
+                victim = &lfs->rlines[i];
+            }
+        }
+
+        uint8_t *ldata;
+        if (line) {
+            ldata = &lfs->rline_buffer[(line - lfs->rlines)*lfs->rline_size];
+            line->hits += 1;
+        } else {
+            line = victim;
+            ldata = &lfs->rline_buffer[(line - lfs->rlines)*lfs->rline_size];
+            line->block = LFS_BLOCK_NULL;
+            line->stamp = 0;
+            int err = lfs->cfg->read(lfs->cfg, block, loff,
+                    ldata, lfs->rline_size);
+            LFS_ASSERT(err <= 0);
+            if (err) {
+                return err;
+            }
+
+            line->block = block;
+            line->off = loff;
+            line->fills += 1;
+        }
+
+        line->stamp = ++lfs->rline_clock;
+        memcpy(data, &ldata[off-loff], diff);
+
+        data += diff;
+        off += diff;
+        size -= diff;
+    }
+
+    return 0;
+}
+
+#ifndef LFS_READONLY
+// drop the lines which overlap a range about to change on the device
+static void lfs_bd_rawdrop(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+    for (lfs_size_t i = 0; i < lfs->cfg->rcache_lines; i++) {
+        if (lfs->rlines[i].block == block
+                && lfs->rlines[i].off < off+size
+                && off < lfs->rlines[i].off + lfs->rline_size) {
+            lfs->rlines[i].block = LFS_BLOCK_NULL;
+            lfs->rlines[i].stamp = 0;
+        }
+    }
+}
+#endif
+
 static int lfs_bd_read(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
@@ -113,7 +187,7 @@ static int lfs_bd_read(lfs_t *lfs,
                     lfs->cfg->block_size)
                 - rcache->off,
                 lfs->cfg->cache_size);
-        int err = lfs->cfg->read(lfs->cfg, rcache->block,
+        int err = lfs_bd_rawread(lfs, rcache->block,
                 rcache->off, rcache->buffer, rcache->size);
         LFS_ASSERT(err <= 0);
         if (err) {
@@ -178,6 +252,7 @@ static int lfs_bd_flush(lfs_t *lfs,
     if (pcache->block != LFS_BLOCK_NULL && pcache->block != LFS_BLOCK_INLINE) {
         LFS_ASSERT(pcache->block < lfs->block_count);
         lfs_size_t diff = lfs_alignup(pcache->size, lfs->cfg->prog_size);
+        lfs_bd_rawdrop(lfs, pcache->block, pcache->off, diff);
         int err = lfs->cfg->prog(lfs->cfg, pcache->block,
                 pcache->off, pcache->buffer, diff);
         LFS_ASSERT(err <= 0);
@@ -274,6 +349,7 @@ static int lfs_bd_prog(lfs_t *lfs,
 #ifndef LFS_READONLY
 static int lfs_bd_erase(lfs_t *lfs, lfs_block_t block) {
     LFS_ASSERT(block < lfs->block_count);
+    lfs_bd_rawdrop(lfs, block, 0, lfs->cfg->block_size);
     int err = lfs->cfg->erase(lfs->cfg, block);
     LFS_ASSERT(err <= 0);
     return err;
@@ -702,6 +778,50 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
 }
 #endif
 
+#ifndef LFS_READONLY
+// move the allocator to the first run of count free blocks in the lookahead
+// window, or to its longest run, so the next allocations are contiguous
+//
+// the skipped blocks are only picked up again by the next scan
+static int lfs_alloc_reserve(lfs_t *lfs, lfs_block_t count) {
+    if (lfs->lookahead.next >= lfs->lookahead.size) {
+        if (lfs->lookahead.ckpoint <= 0) {
+            // leave reporting this to lfs_alloc
+            return 0;
+        }
+
+        int err = lfs_alloc_scan(lfs);
+        if (err) {
+            return err;
+        }
+    }
+
+    lfs_block_t best = lfs->lookahead.next;
+    lfs_block_t bestlen = 0;
+    lfs_block_t run = 0;
+    for (lfs_block_t i = lfs->lookahead.next; i < lfs->lookahead.size; i++) {
+        if (lfs->lookahead.buffer[i / 8] & (1U << (i % 8))) {
+            run = 0;
+            continue;
+        }
+
+        run += 1;
+        if (run > bestlen) {
+            best = i+1 - run;
+            bestlen = run;
+            if (bestlen >= count) {
+                break;
+            }
+        }
+    }
+
+    // no need to check ckpoint, it always covers the rest of the window
+    lfs->lookahead.ckpoint -= best - lfs->lookahead.next;
+    lfs->lookahead.next = best;
+    return 0;
+}
+#endif
+
 /// Metadata pair and directory operations ///
 static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         lfs_tag_t gmask, lfs_tag_t gtag,
@@ -2887,6 +3007,29 @@ static int lfs_ctz_find(lfs_t *lfs,
     return 0;
 }
 
+// number of pointer reads lfs_ctz_find needs from index current to target
+static lfs_size_t lfs_ctz_hops(lfs_off_t current, lfs_off_t target) {
+    lfs_size_t hops = 0;
+    while (current > target) {
+        current -= 1 << lfs_min(
+                lfs_npw2(current-target+1) - 1,
+                lfs_ctz(current));
+        hops += 1;
+    }
+
+    return hops;
+}
+
+// number of blocks in a CTZ list of size bytes
+static lfs_block_t lfs_ctz_count(lfs_t *lfs, lfs_size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+
+    lfs_off_t off = size - 1;
+    return lfs_ctz_index(lfs, &off) + 1;
+}
+
 #ifndef LFS_READONLY
 static int lfs_ctz_extend(lfs_t *lfs,
         lfs_cache_t *pcache, lfs_cache_t *rcache,
@@ -3031,6 +3174,165 @@ static int lfs_ctz_traverse(lfs_t *lfs,
 }
 
 
+/// Contiguous file extents ///
+
+// on-disk extent record, stored as the LFS_EXTENT_ATTR custom attribute with
+// the CTZ reference it was written with
+struct lfs_extent_rec {
+    lfs_block_t start;
+    lfs_block_t count;
+    lfs_block_t head;
+    lfs_size_t size;
+};
+
+// load the extent record of the file, it is only used if it still describes
+// the CTZ list on disk
+static int lfs_file_extent_load(lfs_t *lfs, lfs_file_t *file,
+        lfs_tag_t tag) {
+    struct lfs_extent_rec rec;
+    file->extent.count = 0;
+
+    lfs_stag_t res = lfs_dir_get(lfs, &file->m, LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_USERATTR + LFS_EXTENT_ATTR,
+                file->id, sizeof(rec)), &rec);
+    if (res == LFS_ERR_NOENT) {
+        return 0;
+    } else if (res < 0) {
+        return res;
+    }
+
+    // remember to update or remove it on the next commit
+    file->flags |= LFS_F_EXTENT;
+
+    rec.start = lfs_fromle32(rec.start);
+    rec.count = lfs_fromle32(rec.count);
+    rec.head = lfs_fromle32(rec.head);
+    rec.size = lfs_fromle32(rec.size);
+    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT
+            && lfs_tag_size(res) == sizeof(rec)
+            && rec.head == file->ctz.head
+            && rec.size == file->ctz.size
+            && rec.count == lfs_ctz_count(lfs, file->ctz.size)
+            && rec.count <= lfs->block_count
+            && rec.start <= lfs->block_count - rec.count
+            && rec.head == rec.start + rec.count-1) {
+        file->extent.start = rec.start;
+        file->extent.count = rec.count;
+    }
+
+    return 0;
+}
+
+// find the block holding pos, directly if it is in the extent, else from the
+// nearest block in the index cache
+static int lfs_file_ctzfind(lfs_t *lfs, lfs_file_t *file,
+        lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
+#ifndef LFS_READONLY
+    if (file->extent.count && !(file->flags & LFS_F_ERRED)) {
+#else
+    if (file->extent.count) {
+#endif
+        lfs_off_t noff = pos;
+        lfs_off_t index = lfs_ctz_index(lfs, &noff);
+        if (index < file->extent.count) {
+            *block = file->extent.start + index;
+            *off = noff;
+            return 0;
+        }
+    }
+
+    if (!file->index.size || file->ctz.size == 0) {
+        return lfs_ctz_find(lfs, NULL, &file->cache,
+                file->ctz.head, file->ctz.size,
+                pos, block, off);
+    }
+
+    lfs_off_t last = lfs_ctz_index(lfs, &(lfs_off_t){file->ctz.size-1});
+    lfs_off_t target = lfs_ctz_index(lfs, &pos);
+    if (!file->index.stride) {
+        // first seek into this list, spread the slots over it
+        file->index.stride = last / file->index.size + 1;
+        for (lfs_size_t i = 0; i < file->index.size; i++) {
+            file->index.blocks[i] = LFS_BLOCK_NULL;
+        }
+    }
+
+    // the skip-list can be entered at any block after the target
+    lfs_off_t stride = file->index.stride;
+    lfs_off_t current = last;
+    lfs_block_t head = file->ctz.head;
+    for (lfs_off_t i = (target + stride-1) / stride;
+            i < file->index.size && i*stride < last; i++) {
+        if (file->index.blocks[i] != LFS_BLOCK_NULL) {
+            current = i*stride;
+            head = file->index.blocks[i];
+            break;
+        }
+    }
+    file->index.saved += lfs_ctz_hops(last, target)
+            - lfs_ctz_hops(current, target);
+
+    while (current > target) {
+        lfs_size_t skip = lfs_min(
+                lfs_npw2(current-target+1) - 1,
+                lfs_ctz(current));
+
+        int err = lfs_bd_read(lfs,
+                NULL, &file->cache, sizeof(head),
+                head, 4*skip, &head, sizeof(head));
+        head = lfs_fromle32(head);
+        if (err) {
+            return err;
+        }
+
+        current -= 1 << skip;
+        file->index.reads += 1;
+        if (current % stride == 0 && current / stride < file->index.size) {
+            file->index.blocks[current / stride] = head;
+        }
+    }
+
+    *block = head;
+    *off = pos;
+    return 0;
+}
+
+#ifndef LFS_READONLY
+// move the allocator to enough contiguous blocks for the expected size
+// before the file starts a new CTZ list
+static int lfs_file_extent_reserve(lfs_t *lfs, lfs_file_t *file) {
+    if (!file->cfg->extent_size) {
+        return 0;
+    }
+
+    return lfs_alloc_reserve(lfs,
+            lfs_ctz_count(lfs, file->cfg->extent_size));
+}
+
+// update the extent after file->block was allocated for the current position
+static void lfs_file_extent_track(lfs_t *lfs, lfs_file_t *file) {
+    // a full block is followed by pos, not holding it
+    lfs_off_t off = file->pos;
+    if (file->off == lfs->cfg->block_size && off > 0) {
+        off -= 1;
+    }
+    lfs_off_t index = lfs_ctz_index(lfs, &off);
+
+    if (!file->cfg->extent_size) {
+        file->extent.count = 0;
+    } else if (index == 0) {
+        file->extent.start = file->block;
+        file->extent.count = 1;
+    } else if (index <= file->extent.count
+            && file->block == file->extent.start + index) {
+        file->extent.count = index + 1;
+    } else {
+        file->extent.count = 0;
+    }
+}
+#endif
+
+
 /// Top level file operations ///
 static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
         const char *path, int flags,
@@ -3054,6 +3356,12 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+    file->extent.count = 0;
+    file->index.blocks = cfg->index_buffer;
+    file->index.size = cfg->index_buffer ? cfg->index_size : 0;
+    file->index.stride = 0;
+    file->index.reads = 0;
+    file->index.saved = 0;
 
     // allocate entry for file if it doesn't exist
     lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
@@ -3150,6 +3458,11 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
 #endif
     }
 
+    err = lfs_file_extent_load(lfs, file, tag);
+    if (err) {
+        goto cleanup;
+    }
+
     // allocate buffer if needed
     if (file->cfg->buffer) {
         file->cache.buffer = file->cfg->buffer;
@@ -3286,6 +3599,7 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
 
         file->block = nblock;
         file->flags |= LFS_F_WRITING;
+        lfs_file_extent_track(lfs, file);
         return 0;
 
 relocate:
@@ -3301,7 +3615,12 @@ relocate:
 static int lfs_file_outline(lfs_t *lfs, lfs_file_t *file) {
     file->off = file->pos;
     lfs_alloc_ckpoint(lfs);
-    int err = lfs_file_relocate(lfs, file);
+    int err = lfs_file_extent_reserve(lfs, file);
+    if (err) {
+        return err;
+    }
+
+    err = lfs_file_relocate(lfs, file);
     if (err) {
         return err;
     }
@@ -3381,6 +3700,7 @@ relocate:
         // actual file updates
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+        file->index.stride = 0;
         file->flags &= ~LFS_F_WRITING;
         file->flags |= LFS_F_DIRTY;
 
@@ -3436,17 +3756,49 @@ static int lfs_file_sync_(lfs_t *lfs, lfs_file_t *file) {
             size = sizeof(ctz);
         }
 
+        // keep the extent record in step with the CTZ list, it is only
+        // written if every block is still in the extent
+        struct lfs_mattr attrs[3] = {
+            {LFS_MKTAG(type, file->id, size), buffer},
+            {LFS_MKTAG(LFS_FROM_USERATTRS, file->id,
+                file->cfg->attr_count), file->cfg->attrs},
+        };
+        lfs_size_t attr_count = 2;
+        struct lfs_extent_rec rec;
+        lfs_block_t count = lfs_ctz_count(lfs, file->ctz.size);
+        if (!(file->flags & LFS_F_INLINE)
+                && count > 0 && count <= file->extent.count
+                && file->ctz.head == file->extent.start + count-1) {
+            file->extent.count = count;
+            rec.start = lfs_tole32(file->extent.start);
+            rec.count = lfs_tole32(count);
+            rec.head = lfs_tole32(file->ctz.head);
+            rec.size = lfs_tole32(file->ctz.size);
+            attrs[attr_count++] = (struct lfs_mattr){
+                    LFS_MKTAG(LFS_TYPE_USERATTR + LFS_EXTENT_ATTR,
+                        file->id, sizeof(rec)), &rec};
+        } else {
+            file->extent.count = 0;
+            if (file->flags & LFS_F_EXTENT) {
+                attrs[attr_count++] = (struct lfs_mattr){
+                        LFS_MKTAG(LFS_TYPE_USERATTR + LFS_EXTENT_ATTR,
+                            file->id, 0x3ff), NULL};
+            }
+        }
+
         // commit file data and attributes
-        err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
-                {LFS_MKTAG(type, file->id, size), buffer},
-                {LFS_MKTAG(LFS_FROM_USERATTRS, file->id,
-                    file->cfg->attr_count), file->cfg->attrs}));
+        err = lfs_dir_commit(lfs, &file->m, attrs, attr_count);
         if (err) {
             file->flags |= LFS_F_ERRED;
             return err;
         }
 
         file->flags &= ~LFS_F_DIRTY;
+        if (file->extent.count) {
+            file->flags |= LFS_F_EXTENT;
+        } else {
+            file->flags &= ~LFS_F_EXTENT;
+        }
     }
 
     return 0;
@@ -3471,8 +3823,7 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         if (!(file->flags & LFS_F_READING) ||
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
+                int err = lfs_file_ctzfind(lfs, file,
                         file->pos, &file->block, &file->off);
                 if (err) {
                     return err;
@@ -3555,8 +3906,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
             if (!(file->flags & LFS_F_INLINE)) {
                 if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
-                    int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                            file->ctz.head, file->ctz.size,
+                    int err = lfs_file_ctzfind(lfs, file,
                             file->pos-1, &file->block, &(lfs_off_t){0});
                     if (err) {
                         file->flags |= LFS_F_ERRED;
@@ -3569,6 +3919,14 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
 
                 // extend file with new blocks
                 lfs_alloc_ckpoint(lfs);
+                if (file->pos == 0) {
+                    int err = lfs_file_extent_reserve(lfs, file);
+                    if (err) {
+                        file->flags |= LFS_F_ERRED;
+                        return err;
+                    }
+                }
+
                 int err = lfs_ctz_extend(lfs, &file->cache, &lfs->rcache,
                         file->block, file->pos,
                         &file->block, &file->off);
@@ -3576,6 +3934,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
                     file->flags |= LFS_F_ERRED;
                     return err;
                 }
+                lfs_file_extent_track(lfs, file);
             } else {
                 file->block = LFS_BLOCK_INLINE;
                 file->off = file->pos;
@@ -3753,6 +4112,7 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 
             file->ctz.head = LFS_BLOCK_INLINE;
             file->ctz.size = size;
+            file->index.stride = 0;
             file->flags |= LFS_F_DIRTY | LFS_F_READING | LFS_F_INLINE;
             file->cache.block = file->ctz.head;
             file->cache.off = 0;
@@ -3767,8 +4127,7 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             }
 
             // lookup new head in ctz skip list
-            err = lfs_ctz_find(lfs, NULL, &file->cache,
-                    file->ctz.head, file->ctz.size,
+            err = lfs_file_ctzfind(lfs, file,
                     size-1, &file->block, &(lfs_off_t){0});
             if (err) {
                 return err;
@@ -3779,6 +4138,7 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             file->pos = size;
             file->ctz.head = file->block;
             file->ctz.size = size;
+            file->index.stride = 0;
             file->flags |= LFS_F_DIRTY | LFS_F_READING;
         }
     } else if (size > oldsize) {
@@ -3833,6 +4193,25 @@ static lfs_soff_t lfs_file_size_(lfs_t *lfs, lfs_file_t *file) {
     return file->ctz.size;
 }
 
+static int lfs_file_extent_(lfs_t *lfs, lfs_file_t *file,
+        struct lfs_extent *extent) {
+    // the extent describes the CTZ list on disk
+    int err = lfs_file_flush(lfs, file);
+    if (err) {
+        return err;
+    }
+
+    lfs_block_t count = lfs_ctz_count(lfs, file->ctz.size);
+    if ((file->flags & LFS_F_INLINE) || count == 0
+            || count > file->extent.count) {
+        return LFS_ERR_NOENT;
+    }
+
+    extent->start = file->extent.start;
+    extent->count = count;
+    return 0;
+}
+
 
 /// General fs operations ///
 static int lfs_stat_(lfs_t *lfs, const char *path, struct lfs_info *info) {
@@ -4156,6 +4535,7 @@ static int lfs_removeattr_(lfs_t *lfs, const char *path, uint8_t type) {
 static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->cfg = cfg;
     lfs->block_count = cfg->block_count;  // May be 0
+    lfs->rline_buffer = NULL;
     int err = 0;
 
 #ifdef LFS_MULTIVERSION
@@ -4235,6 +4615,31 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs_cache_zero(lfs, &lfs->rcache);
     lfs_cache_zero(lfs, &lfs->pcache);
 
+    // setup block device read cache
+    LFS_ASSERT(lfs->cfg->rcache_lines <= LFS_RCACHE_LINES_MAX);
+    lfs->rline_size = lfs->cfg->rcache_line_size;
+    if (!lfs->rline_size) {
+        lfs->rline_size = lfs->cfg->cache_size;
+    }
+    LFS_ASSERT(lfs->rline_size % lfs->cfg->read_size == 0);
+    LFS_ASSERT(lfs->cfg->block_size % lfs->rline_size == 0);
+    if (lfs->cfg->rcache_lines) {
+        if (lfs->cfg->rcache_buffer) {
+            lfs->rline_buffer = lfs->cfg->rcache_buffer;
+        } else {
+            lfs->rline_buffer = lfs_malloc(
+                    lfs->cfg->rcache_lines*lfs->rline_size);
+            if (!lfs->rline_buffer) {
+                err = LFS_ERR_NOMEM;
+                goto cleanup;
+            }
+        }
+    }
+    for (lfs_size_t i = 0; i < LFS_RCACHE_LINES_MAX; i++) {
+        lfs->rlines[i] = (struct lfs_rline){.block = LFS_BLOCK_NULL};
+    }
+    lfs->rline_clock = 0;
+
     // setup lookahead buffer, note mount finishes initializing this after
     // we establish a decent pseudo-random seed
     LFS_ASSERT(lfs->cfg->lookahead_size > 0);
@@ -4323,6 +4728,10 @@ static int lfs_deinit(lfs_t *lfs) {
         lfs_free(lfs->lookahead.buffer);
     }
 
+    if (!lfs->cfg->rcache_buffer) {
+        lfs_free(lfs->rline_buffer);
+    }
+
     return 0;
 }
 
@@ -4572,6 +4981,158 @@ static int lfs_unmount_(lfs_t *lfs) {
     return lfs_deinit(lfs);
 }
 
+#ifndef LFS_READONLY
+static int lfs_mount_hint_mark(void *p, lfs_block_t block) {
+    struct lfs_mount_hint *hint = p;
+    lfs_block_t off = ((block - hint->lookahead_start)
+            + hint->block_count) % hint->block_count;
+
+    if (off < hint->lookahead_size) {
+        hint->bitmap[off / 8] |= 1U << (off % 8);
+    }
+
+    return 0;
+}
+
+// walk the tail list like lfs_mount does, fetching every metadata pair
+//
+// lfs_dir_fetch tosses the crc of every commit into lfs->seed, so starting
+// from a zero seed this leaves the seed of a fresh mount, which changes with
+// any commit to any pair
+static int lfs_mount_hint_walk(lfs_t *lfs, lfs_size_t *count,
+        lfs_gstate_t *gstate) {
+    lfs_mdir_t dir = {.tail = {0, 1}};
+    lfs_block_t tortoise[2] = {LFS_BLOCK_NULL, LFS_BLOCK_NULL};
+    lfs_size_t tortoise_i = 1;
+    lfs_size_t tortoise_period = 1;
+    *count = 0;
+    while (!lfs_pair_isnull(dir.tail)) {
+        // detect cycles with Brent's algorithm
+        if (lfs_pair_issync(dir.tail, tortoise)) {
+            LFS_WARN("Cycle detected in tail list");
+            return LFS_ERR_CORRUPT;
+        }
+        if (tortoise_i == tortoise_period) {
+            tortoise[0] = dir.tail[0];
+            tortoise[1] = dir.tail[1];
+            tortoise_i = 0;
+            tortoise_period *= 2;
+        }
+        tortoise_i += 1;
+
+        int err = lfs_dir_fetch(lfs, &dir, dir.tail);
+        if (err) {
+            return err;
+        }
+        *count += 1;
+
+        if (gstate) {
+            err = lfs_dir_getgstate(lfs, &dir, gstate);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int lfs_mount_hint_get_(lfs_t *lfs, struct lfs_mount_hint *hint) {
+    // open files and pending global state are not on disk yet, nor is the
+    // in-device request to rewrite the superblock
+    if (lfs->mlist
+            || !lfs_gstate_iszero(&lfs->gdelta)
+            || memcmp(&lfs->gstate, &lfs->gdisk, sizeof(lfs_gstate_t)) != 0
+            || lfs_gstate_needssuperblock(&lfs->gstate)) {
+        return LFS_ERR_INVAL;
+    }
+
+    memset(hint, 0, sizeof(*hint));
+
+    // the seed a mount of the filesystem as it is now collects
+    uint32_t seed = lfs->seed;
+    lfs->seed = 0;
+    int err = lfs_mount_hint_walk(lfs, &hint->mdir_count, NULL);
+    hint->seed = lfs->seed;
+    lfs->seed = seed;
+    if (err) {
+        return err;
+    }
+
+    hint->root[0] = lfs->root[0];
+    hint->root[1] = lfs->root[1];
+    hint->block_size = lfs->cfg->block_size;
+    hint->block_count = lfs->block_count;
+    hint->name_max = lfs->name_max;
+    hint->file_max = lfs->file_max;
+    hint->attr_max = lfs->attr_max;
+    hint->inline_max = lfs->inline_max;
+
+    // the window the first allocation of that mount scans
+    hint->lookahead_start = hint->seed % lfs->block_count;
+    hint->lookahead_size = lfs_min(8*LFS_MOUNT_HINT_BITMAP, lfs->block_count);
+    return lfs_fs_traverse_(lfs, lfs_mount_hint_mark, hint, true);
+}
+
+static int lfs_mount_hinted_(lfs_t *lfs, const struct lfs_config *cfg,
+        const struct lfs_mount_hint *hint) {
+    int err = lfs_init(lfs, cfg);
+    if (err) {
+        return err;
+    }
+
+    if (hint->block_size != lfs->cfg->block_size
+            || hint->block_count != lfs->block_count
+            || hint->name_max > lfs->name_max
+            || hint->file_max > lfs->file_max
+            || hint->attr_max > lfs->attr_max
+            || hint->lookahead_start >= hint->block_count
+            || hint->lookahead_size > 8*LFS_MOUNT_HINT_BITMAP) {
+        err = LFS_ERR_INVAL;
+        goto cleanup;
+    }
+
+    // every metadata pair must still be at the commit the hint was taken at
+    lfs_size_t count;
+    err = lfs_mount_hint_walk(lfs, &count, &lfs->gstate);
+    if (err) {
+        goto cleanup;
+    }
+
+    if (count != hint->mdir_count
+            || lfs->seed != hint->seed
+            || hint->lookahead_start != lfs->seed % lfs->block_count) {
+        err = LFS_ERR_INVAL;
+        goto cleanup;
+    }
+
+    lfs->root[0] = hint->root[0];
+    lfs->root[1] = hint->root[1];
+    lfs->gstate.tag += !lfs_tag_isvalid(lfs->gstate.tag);
+    lfs->gdisk = lfs->gstate;
+    lfs->name_max = hint->name_max;
+    lfs->file_max = hint->file_max;
+    lfs->attr_max = hint->attr_max;
+    lfs->inline_max = hint->inline_max;
+
+    // the lookahead window is the snapshot, up to what our buffer holds
+    lfs->lookahead.start = hint->lookahead_start;
+    lfs->lookahead.size = lfs_min(8*lfs->cfg->lookahead_size,
+            hint->lookahead_size);
+    lfs->lookahead.next = 0;
+    memset(lfs->lookahead.buffer, 0, lfs->cfg->lookahead_size);
+    memcpy(lfs->lookahead.buffer, hint->bitmap,
+            (lfs->lookahead.size + 7) / 8);
+    lfs_alloc_ckpoint(lfs);
+
+    return 0;
+
+cleanup:
+    lfs_unmount_(lfs);
+    return err;
+}
+#endif
+
 
 /// Filesystem filesystem operations ///
 static int lfs_fs_stat_(lfs_t *lfs, struct lfs_fsinfo *fsinfo) {
@@ -5954,6 +6515,38 @@ int lfs_unmount(lfs_t *lfs) {
     return err;
 }
 
+#ifndef LFS_READONLY
+int lfs_mount_hint_get(lfs_t *lfs, struct lfs_mount_hint *hint) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_mount_hint_get(%p, %p)", (void*)lfs, (void*)hint);
+
+    err = lfs_mount_hint_get_(lfs, hint);
+
+    LFS_TRACE("lfs_mount_hint_get -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
+int lfs_mount_hinted(lfs_t *lfs, const struct lfs_config *cfg,
+        const struct lfs_mount_hint *hint) {
+    int err = LFS_LOCK(cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_mount_hinted(%p, %p, %p)",
+            (void*)lfs, (void*)cfg, (void*)hint);
+
+    err = lfs_mount_hinted_(lfs, cfg, hint);
+
+    LFS_TRACE("lfs_mount_hinted -> %d", err);
+    LFS_UNLOCK(cfg);
+    return err;
+}
+#endif
+
 #ifndef LFS_READONLY
 int lfs_remove(lfs_t *lfs, const char *path) {
     int err = LFS_LOCK(lfs->cfg);
@@ -6235,6 +6828,22 @@ lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file) {
     return res;
 }
 
+int lfs_file_extent(lfs_t *lfs, lfs_file_t *file, struct lfs_extent *extent) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_extent(%p, %p, %p)",
+            (void*)lfs, (void*)file, (void*)extent);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    err = lfs_file_extent_(lfs, file, extent);
+
+    LFS_TRACE("lfs_file_extent -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+
 #ifndef LFS_READONLY
 int lfs_mkdir(lfs_t *lfs, const char *path) {
     int err = LFS_LOCK(lfs->cfg);
@@ -10,11 +10,86 @@
 #include"lfs.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "littlefs_port.h"
 #include "usart.h"
+#include "flash_job.h"
+#include "flash_dev.h"
+#include "flash_part.h"
+#include "crc16.h"
+#include <stddef.h>
 
 //#define CONFIG_LITTLEFS_DEBUG
 
+/* Put the file system on both flashes, striped for bandwidth or mirrored, instead of
+ * the SPI1 flash alone. The idle pre-erase only runs on the SPI1 flash alone. */
+//#define CONFIG_LFS_STRIPED
+//#define CONFIG_LFS_MIRRORED
+
+/* Bytes per flash before switching to the other one in the striped layout */
+#define LFS_STRIPE_SIZE		4096
+
+/* Partition the file system lives in, see flash_part.c */
+#define LFS_PART_NAME		"littlefs"
+
+/* Save a mount hint on lfs_port_unmount() and mount from it on the next boot, which
+ * skips the scan of the whole file system by the first allocation.
+ *
+ * The mount still fetches every metadata pair, a commit to any of them since the hint
+ * was saved, by the port or by any other writer, changes the pair count or the seed
+ * littlefs collects from the commit CRCs and the full lfs_mount() is used instead. */
+//#define CONFIG_LFS_MOUNT_HINT
+
+#define LFS_HINT_PART_NAME	"lfshint"
+#define LFS_HINT_MAGIC		0x48534C46	/* "FLSH" */
+#define LFS_HINT_SLOT		512			/* records are appended, one per slot */
+
+/* Geometry tuning: the block is the smallest erase the part supports, the caches hold
+ * LFS_CACHE_PAGES pages, the lookahead covers the whole partition up to
+ * LFS_LOOKAHEAD_MAX bytes and a metadata pair compacts at most LFS_METADATA_MAX bytes. */
+#define LFS_BLOCK_SIZE_MIN	4096
+#define LFS_CACHE_PAGES		4
+#define LFS_LOOKAHEAD_MAX	256
+#define LFS_METADATA_MAX	4096
+
+/* Biggest cache_size, pages of up to 256 bytes */
+#define LFS_CACHE_MAX		(256 * LFS_CACHE_PAGES)
+
+/* Programs in flight, lfs_write() copies the data and returns once it is queued */
+#define LFS_PROG_SLOTS		2
+
+/* Give littlefs LFS_RCACHE_LINES lines of one page below its read cache
+ * (lfs_config.rcache_lines), so the metadata fetched on every lookup is not read again
+ * after each file data read. Page lines still fill through the driver page cache, lines
+ * of cache_size bypass it and thrash on 4KB metadata blocks (Tests/host/test_rcache.c).
+ * Costs LFS_RCACHE_LINES * LFS_RCACHE_LINE_MAX bytes of RAM. */
+//#define CONFIG_LFS_RCACHE
+#define LFS_RCACHE_LINES	4
+#define LFS_RCACHE_LINE_MAX	256
+
+#ifdef CONFIG_LFS_RCACHE
+#define LFS_RCACHE_RAM		(LFS_RCACHE_LINES * LFS_RCACHE_LINE_MAX)
+#else
+#define LFS_RCACHE_RAM		0
+#endif
+
+#ifdef LFS_NO_MALLOC
+/* Files open at once, each takes a cache and a CTZ index from the arena */
+#define LFS_FILE_SLOTS		4
+
+/* Blocks remembered per open file for seeks, 64 covers a 256KB file at 4KB blocks
+ * and every n-th block of a larger one */
+#define LFS_CTZ_INDEX_SIZE	64
+
+/* Everything littlefs gets from the port: read, program and lookahead buffers and
+ * the file arena, checked against LFS_RAM_BUDGET at build time. The optional read
+ * cache lines come on top of the budget. */
+#define LFS_RAM_BUDGET		(10 * 1024 + LFS_RCACHE_RAM)
+#define LFS_STATIC_RAM		(2 * LFS_CACHE_MAX + LFS_LOOKAHEAD_MAX + (LFS_FILE_SLOTS + LFS_PROG_SLOTS) * LFS_CACHE_MAX \
+							 + LFS_FILE_SLOTS * LFS_CTZ_INDEX_SIZE * sizeof(lfs_block_t) + LFS_RCACHE_RAM)
+_Static_assert(LFS_STATIC_RAM <= LFS_RAM_BUDGET, "littlefs buffers exceed LFS_RAM_BUDGET");
+#endif
+
 #ifdef CONFIG_LITTLEFS_DEBUG
 
 #define littlefs_print(format,args...) printf(format, ##args)
@@ -29,66 +104,780 @@ extern  lfs_dir_t 					dir;
 
 struct lfs_config cfg;
 
+/* Striped or mirrored pair the file system is on, NULL for the SPI1 flash alone */
+#if defined(CONFIG_LFS_STRIPED) || defined(CONFIG_LFS_MIRRORED)
+static struct flash_dev				s_lfs_pair;
+#endif
+static struct flash_dev			   *s_lfs_dev;
+/* Flash address of block 0 */
+static uint32_t						s_lfs_base;
+
+/* Queued programs of the SPI1 flash, their errors are returned by the next lfs_sync() */
+static struct flash_job				s_prog_job[LFS_PROG_SLOTS];
+static uint32_t						s_prog_buf[LFS_PROG_SLOTS][LFS_CACHE_MAX / 4];
+static uint8_t						s_prog_next;
+static volatile int					s_prog_err;
+
+#ifdef CONFIG_LFS_MOUNT_HINT
+/* On-flash mount hint, valid while state is still erased */
+struct lfs_hint_rec
+{
+	uint32_t					magic;
+	uint32_t					generation;
+	struct lfs_mount_hint		hint;
+	uint16_t					crc;
+	uint16_t					reserved;
+	uint32_t					state;
+};
+
+static struct lfs_hint_rec			s_hint;
+static uint32_t						s_hint_addr;	/* of s_hint on the flash */
+static int							s_hint_slot = -1;
+static uint8_t						s_hint_live;	/* mounted from s_hint, nothing written since */
+#endif
+
+#ifdef LFS_NO_MALLOC
+static uint32_t						s_lfs_read_buf[LFS_CACHE_MAX / 4];
+static uint32_t						s_lfs_prog_buf[LFS_CACHE_MAX / 4];
+static uint32_t						s_lfs_lookahead_buf[LFS_LOOKAHEAD_MAX / 4];
+#ifdef CONFIG_LFS_RCACHE
+static uint32_t						s_lfs_rcache_buf[LFS_RCACHE_LINES][LFS_RCACHE_LINE_MAX / 4];
+#endif
+
+/* File caches, a slot per open file */
+static uint32_t						s_lfs_arena[LFS_FILE_SLOTS][LFS_CACHE_MAX / 4];
+static lfs_block_t					s_lfs_index[LFS_FILE_SLOTS][LFS_CTZ_INDEX_SIZE];
+static struct lfs_file_config		s_lfs_file_cfg[LFS_FILE_SLOTS];
+static uint8_t						s_lfs_arena_used;
+static uint8_t						s_lfs_arena_peak;
+
+/* CTZ pointer reads done and avoided by the index of the files closed so far */
+static uint32_t						s_ctz_reads;
+static uint32_t						s_ctz_saved;
+#endif
+
+/* Idle pre-erase: the blocks free at the last scan are read back and erased in the
+ * background through flash_job, then lfs_SectorErase() skips the ones still blank.
+ *  s_pe_used    - in use by the file system at the last lfs_preerase_scan()
+ *  s_pe_touched - erased or programmed by the file system since, never pre-erased
+ *  s_pe_blank   - known blank, its next lfs_SectorErase() is skipped
+ */
+#define PE_MAX_BLOCKS		2048
+#define PE_CHUNK_SIZE		1024
+
+#define PE_BIT_SET(map, b)	((map)[(b) >> 3] |= (1 << ((b) & 7)))
+#define PE_BIT_CLR(map, b)	((map)[(b) >> 3] &= ~(1 << ((b) & 7)))
+#define PE_BIT_TST(map, b)	((map)[(b) >> 3] & (1 << ((b) & 7)))
+
+enum
+{
+	PE_IDLE,		/* no job in flight */
+	PE_CHECK,		/* reading s_pe_block back chunk by chunk */
+	PE_ERASE,		/* erasing s_pe_block */
+};
+
+static uint8_t						s_pe_used[PE_MAX_BLOCKS / 8];
+static uint8_t						s_pe_touched[PE_MAX_BLOCKS / 8];
+static uint8_t						s_pe_blank[PE_MAX_BLOCKS / 8];
+static uint8_t						s_pe_valid;
+static uint8_t						s_pe_done;
+static uint8_t						s_pe_state = PE_IDLE;
+static lfs_block_t					s_pe_block;
+static lfs_block_t					s_pe_next;
+static uint32_t						s_pe_pos;
+static uint32_t						s_pe_buf[PE_CHUNK_SIZE / sizeof(uint32_t)];
+static struct flash_job				s_pe_job;
+
+/* The file system is about to erase or program the block, it is not free any more */
+static void lfs_preerase_touch(lfs_block_t block)
+{
+	if( !s_pe_valid || block >= PE_MAX_BLOCKS )
+		return;
+
+	PE_BIT_SET(s_pe_touched, block);
+
+	/* The read-back or erase in flight would race with the caller */
+	if( s_pe_state != PE_IDLE && s_pe_block == block )
+	{
+		flash_job_wait(&s_pe_job);
+		s_pe_state = PE_IDLE;
+	}
+}
+
+static void lfs_prog_done(struct flash_job *job, int status)
+{
+	if( status < 0 )
+		s_prog_err = status;
+}
+
+/* Description:  Wait for the queued programs which touch [addr, addr+size), or for all of
+ *               them if size is 0. The queue runs in order, so a program is never
+ *               overtaken by one submitted after it.
+ */
+static void lfs_prog_wait(uint32_t addr, uint32_t size)
+{
+	struct flash_job		   *job;
+	int							i;
+
+	for(i=0; i<LFS_PROG_SLOTS; i++)
+	{
+		job = &s_prog_job[i];
+		if( job->status != FLASH_JOB_PENDING )
+			continue;
+
+		if( size == 0 || (addr < job->addr + job->len && job->addr < addr + size) )
+			flash_job_wait(job);
+	}
+}
+
+#ifdef CONFIG_LFS_MOUNT_HINT
+/* Description:  Load the last record of the hint partition, records are written from
+ *               slot 0 on and the first blank slot ends the list.
+ * Return:       0 if it is a valid hint for this geometry, -1 otherwise
+ */
+static int lfs_hint_load(void)
+{
+	const struct flash_part		*part = flash_part_find(LFS_HINT_PART_NAME);
+	uint32_t					magic;
+	int							slot;
+
+	s_hint_slot = -1;
+	if( !part )
+		return -1;
+
+	for(slot=0; (slot + 1) * LFS_HINT_SLOT <= part->size; slot++)
+	{
+		flash_part_read(part, slot * LFS_HINT_SLOT, (uint8_t *)&magic, sizeof(magic));
+		if( magic == 0xFFFFFFFF )
+			break;
+		s_hint_slot = slot;
+	}
+	if( s_hint_slot < 0 )
+		return -1;
+
+	s_hint_addr = part->offset + s_hint_slot * LFS_HINT_SLOT;
+	flash_part_read(part, s_hint_slot * LFS_HINT_SLOT, (uint8_t *)&s_hint, sizeof(s_hint));
+
+	if( s_hint.magic != LFS_HINT_MAGIC || s_hint.state != 0xFFFFFFFF )
+		return -1;
+
+	if( s_hint.crc != crc16_checksum((unsigned char *)&s_hint, offsetof(struct lfs_hint_rec, crc)) )
+		return -1;
+
+	return 0;
+}
+
+/* Description:  Mark the loaded record stale before the file system changes, it only
+ *               takes programming its state word.
+ */
+static void lfs_hint_discard(void)
+{
+	uint32_t					state = 0;
+
+	if( !s_hint_live )
+		return;
+
+	s_hint_live = 0;
+	New_SPI_FLASH_PageWrite((uint8_t *)&state, s_hint_addr + offsetof(struct lfs_hint_rec, state), sizeof(state));
+	SPI_FLASH_WriteFlush();
+}
+
+/* Description:  Append a hint of the mounted file system, the partition is erased once
+ *               its slots are used up.
+ */
+static int lfs_hint_save(lfs_t *lfs)
+{
+	const struct flash_part		*part = flash_part_find(LFS_HINT_PART_NAME);
+	uint32_t					generation = s_hint_slot < 0 ? 0 : s_hint.generation + 1;
+	int							slot = s_hint_slot + 1;
+	int							err;
+
+	/* Still on the flash, nothing was written since it was loaded */
+	if( s_hint_live )
+		return 0;
+
+	if( !part )
+		return -1;
+
+	if( (err = lfs_mount_hint_get(lfs, &s_hint.hint)) < 0 )
+		return err;
+
+	if( (slot + 1) * LFS_HINT_SLOT > part->size )
+	{
+		if( (err = flash_part_erase(part, 0, part->size)) < 0 )
+			return err;
+		slot = 0;
+	}
+
+	s_hint.magic = LFS_HINT_MAGIC;
+	s_hint.generation = generation;
+	s_hint.crc = crc16_checksum((unsigned char *)&s_hint, offsetof(struct lfs_hint_rec, crc));
+	s_hint.reserved = 0xFFFF;
+	s_hint.state = 0xFFFFFFFF;
+
+	if( (err = flash_part_prog(part, slot * LFS_HINT_SLOT, (uint8_t *)&s_hint, sizeof(s_hint))) < 0 )
+		return err;
+	if( (err = SPI_FLASH_WriteFlush()) < 0 )
+		return err;
+
+	s_hint_slot = slot;
+	s_hint_addr = part->offset + slot * LFS_HINT_SLOT;
+	s_hint_live = 1;
+	return 0;
+}
+#else
+#define lfs_hint_discard()	do{} while(0)
+#endif
+
  int lfs_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
 {
-	uint32_t addr = block * c->block_size + off;
+	uint32_t addr = s_lfs_base + block * c->block_size + off;
 #ifdef CONFIG_LITTLEFS_DEBUG
 	littlefs_print("Reading from address: 0x%08X, size: %d\n", addr, size);
 #endif
+	if( s_lfs_dev )
+		return flash_dev_read(s_lfs_dev, addr, buffer, size) < 0 ? LFS_ERR_IO : LFS_ERR_OK;
+
+	/* littlefs reads its commits back, they must have reached the flash */
+	lfs_prog_wait(addr, size);
+
 	New_SPI_FLASH_BufferRead( addr, buffer, size);
 	return LFS_ERR_OK;
 }
 
 int lfs_write(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
 {
-	uint32_t addr = block * c->block_size + off;
+	uint32_t addr = s_lfs_base + block * c->block_size + off;
+	struct flash_job		   *job;
 #ifdef CONFIG_LITTLEFS_DEBUG
 	littlefs_print("Writing to address: 0x%06X, size: %d\n", addr, size);
 #endif
-	New_SPI_FLASH_PageWrite((uint8_t *)buffer, addr, size);
-	HAL_Delay(100);
+	lfs_hint_discard();
+	if( s_lfs_dev )
+		return flash_dev_prog(s_lfs_dev, addr, buffer, size) < 0 ? LFS_ERR_IO : LFS_ERR_OK;
+
+	lfs_preerase_touch(block);
+	if( block < PE_MAX_BLOCKS )
+		PE_BIT_CLR(s_pe_blank, block);
+
+	if( size > LFS_CACHE_MAX )
+	{
+		lfs_prog_wait(0, 0);
+		if( New_SPI_FLASH_PageWrite((uint8_t *)buffer, addr, size) < 0 )
+			return LFS_ERR_IO;
+		return LFS_ERR_OK;
+	}
+
+	/* Program in the background from a copy, littlefs reuses its buffer right away */
+	job = &s_prog_job[s_prog_next];
+	flash_job_wait(job);
+	memcpy(s_prog_buf[s_prog_next], buffer, size);
+
+	job->type = FLASH_JOB_PROGRAM;
+	job->addr = addr;
+	job->buf = (uint8_t *)s_prog_buf[s_prog_next];
+	job->len = size;
+	job->cb = lfs_prog_done;
+	if( flash_job_submit(job) < 0 )
+		return LFS_ERR_IO;
+
+	s_prog_next = (s_prog_next + 1) % LFS_PROG_SLOTS;
 	return LFS_ERR_OK;
 
 }
 
 int lfs_SectorErase(const struct lfs_config *c, lfs_block_t block)
 {
-	uint32_t address = block * c->block_size;
+	uint32_t address = s_lfs_base + block * c->block_size;
 #ifdef CONFIG_LITTLEFS_DEBUG
 	littlefs_print("Erasing block at address: 0x%06X\n", address);
 #endif
-	 SPI_Flash_BlockErase(address, c->block_size);
-	 return LFS_ERR_OK;
+	lfs_hint_discard();
+	if( s_lfs_dev )
+		return flash_dev_erase(s_lfs_dev, address, c->block_size) < 0 ? LFS_ERR_IO : LFS_ERR_OK;
+
+	/* Programs queued before the erase must not land after it */
+	lfs_prog_wait(address, c->block_size);
+
+	lfs_preerase_touch(block);
+	if( block < PE_MAX_BLOCKS && PE_BIT_TST(s_pe_blank, block) )
+	{
+		/* Erased in the background and not written since */
+		PE_BIT_CLR(s_pe_blank, block);
+		return LFS_ERR_OK;
+	}
+
+	/* SPI_Flash_BlockErase() rounds out to 64KB, which would take the neighbouring
+	 * blocks with it now that the block size follows the smallest erase */
+	if( SPI_FLASH_EraseRange(address, c->block_size) < 0 )
+		return LFS_ERR_IO;
+	if( SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, address, NULL, c->block_size) < 0 )
+		return LFS_ERR_IO;
+	return LFS_ERR_OK;
 }
 
+/* Description:  Barrier for littlefs commits: wait for the queued programs and the partial
+ *               page still in the driver's write-combining buffer, reads and pre-erase
+ *               jobs are not waited for.
+ */
 int lfs_sync(const struct lfs_config *c)
 {
-	 return LFS_ERR_OK;
+	int							err;
+
+	if( s_lfs_dev )
+		return flash_dev_sync(s_lfs_dev) < 0 ? LFS_ERR_IO : LFS_ERR_OK;
+
+	lfs_prog_wait(0, 0);
+	err = s_prog_err;
+	s_prog_err = 0;
+
+	if( SPI_FLASH_WriteFlush() < 0 || err < 0 )
+		return LFS_ERR_IO;
+	return LFS_ERR_OK;
+}
+
+static int lfs_preerase_mark_used(void *data, lfs_block_t block)
+{
+	if( block < PE_MAX_BLOCKS )
+		PE_BIT_SET(s_pe_used, block);
+	return 0;
+}
+
+/* Description:  Record the blocks in use, the others are pre-erased by lfs_preerase_poll() */
+int lfs_preerase_scan(lfs_t *lfs)
+{
+	int							err;
+
+	if( s_pe_state != PE_IDLE )
+	{
+		flash_job_wait(&s_pe_job);
+		s_pe_state = PE_IDLE;
+	}
+
+	s_pe_valid = 0;
+	if( s_lfs_dev )
+		return 0;
+
+	memset(s_pe_used, 0, sizeof(s_pe_used));
+	memset(s_pe_touched, 0, sizeof(s_pe_touched));
+	memset(s_pe_blank, 0, sizeof(s_pe_blank));
+
+#ifdef CONFIG_LFS_MOUNT_HINT
+	/* Mounted from a hint which covers every block, it already lists the used ones */
+	if( s_hint_live && s_hint.hint.lookahead_size >= cfg.block_count )
+	{
+		lfs_block_t				i;
+
+		for(i=0; i<s_hint.hint.lookahead_size; i++)
+		{
+			if( s_hint.hint.bitmap[i / 8] & (1 << (i % 8)) )
+				lfs_preerase_mark_used(NULL, (s_hint.hint.lookahead_start + i) % cfg.block_count);
+		}
+	}
+	else
+#endif
+	if( (err = lfs_fs_traverse(lfs, lfs_preerase_mark_used, NULL)) < 0 )
+		return err;
+
+	s_pe_next = 0;
+	s_pe_done = 0;
+	s_pe_valid = 1;
+	return 0;
+}
+
+static int lfs_preerase_chunk_blank(uint32_t len)
+{
+	uint32_t					i;
+
+	for(i=0; i<len/sizeof(uint32_t); i++)
+	{
+		if( s_pe_buf[i] != 0xFFFFFFFF )
+			return 0;
+	}
+
+	return 1;
+}
+
+static void lfs_preerase_submit(enum flash_job_type type, uint32_t len)
+{
+	s_pe_job.type = type;
+	s_pe_job.addr = s_lfs_base + s_pe_block * cfg.block_size + (type == FLASH_JOB_READ ? s_pe_pos : 0);
+	s_pe_job.buf = (uint8_t *)s_pe_buf;
+	s_pe_job.len = len;
+	s_pe_job.cb = NULL;
+
+	if( flash_job_submit(&s_pe_job) < 0 )
+		s_pe_state = PE_IDLE;
+	else
+		s_pe_state = type == FLASH_JOB_READ ? PE_CHECK : PE_ERASE;
+}
+
+/* Description:  Advance the pre-erase by at most one job, called from the idle loops.
+ *               A free block is read back first and only erased if it is not blank.
+ */
+void lfs_preerase_poll(void)
+{
+	lfs_block_t					count = cfg.block_count < PE_MAX_BLOCKS ? cfg.block_count : PE_MAX_BLOCKS;
+	lfs_block_t					i;
+	uint32_t					len;
+
+	if( !s_pe_valid )
+		return;
+
+	if( s_pe_state != PE_IDLE && s_pe_job.status == FLASH_JOB_PENDING )
+		return;
+
+	switch( s_pe_state )
+	{
+		case PE_CHECK:
+			len = s_pe_job.len;
+			if( s_pe_job.status < 0 )
+			{
+				s_pe_state = PE_IDLE;
+			}
+			else if( !lfs_preerase_chunk_blank(len) )
+			{
+				lfs_preerase_submit(FLASH_JOB_ERASE, cfg.block_size);
+			}
+			else if( (s_pe_pos += len) >= cfg.block_size )
+			{
+				PE_BIT_SET(s_pe_blank, s_pe_block);
+				s_pe_state = PE_IDLE;
+			}
+			else
+			{
+				len = cfg.block_size - s_pe_pos;
+				lfs_preerase_submit(FLASH_JOB_READ, len > PE_CHUNK_SIZE ? PE_CHUNK_SIZE : len);
+			}
+			break;
+
+		case PE_ERASE:
+			if( s_pe_job.status == 0 )
+				PE_BIT_SET(s_pe_blank, s_pe_block);
+			s_pe_state = PE_IDLE;
+			break;
+
+		default:
+			/* Leave the bus to the other jobs, there is no hurry */
+			if( s_pe_done || !flash_job_idle() )
+				return;
+
+			for(i=0; i<count; i++)
+			{
+				s_pe_block = s_pe_next;
+				s_pe_next = (s_pe_next + 1) % count;
+				if( !PE_BIT_TST(s_pe_used, s_pe_block) && !PE_BIT_TST(s_pe_touched, s_pe_block)
+					&& !PE_BIT_TST(s_pe_blank, s_pe_block) )
+					break;
+			}
+
+			if( i == count )
+			{
+				s_pe_done = 1;
+				return;
+			}
+
+			s_pe_pos = 0;
+			len = cfg.block_size > PE_CHUNK_SIZE ? PE_CHUNK_SIZE : cfg.block_size;
+			lfs_preerase_submit(FLASH_JOB_READ, len);
+			break;
+	}
+}
+
+/* Description:  Erase the whole file system partition before a format, the rest of the
+ *               flash holds the partition table and the raw image slots.
+ */
+static int lfs_erase_partition(void)
+{
+	uint32_t					size = cfg.block_count * cfg.block_size;
+
+	if( s_lfs_dev )
+		return flash_dev_erase(s_lfs_dev, s_lfs_base, size);
+
+	return SPI_FLASH_EraseRange(s_lfs_base, size);
 }
 
-void init_lfs_config ()
+/* Description:  Fill in cfg from the flash descriptor (or the striped/mirrored pair) and
+ *               the LFS_PART_NAME partition: block_size is the smallest erase size, at
+ *               least LFS_BLOCK_SIZE_MIN, so a metadata compaction erases a 4KB sector
+ *               and not a 64KB block.
+ * Return:       0 on success, -1 if there is no file system partition
+ */
+int init_lfs_config ()
 {
+	const struct spi_flash_info	*info = SPI_FLASH_GetInfo();
+	const struct flash_part		*part = flash_part_find(LFS_PART_NAME);
+	uint32_t					part_size;
+	uint32_t					dev_size;
+	uint32_t					erase_size;
 
+	if( !part )
+	{
+		printf("No %s partition on the flash\r\n", LFS_PART_NAME);
+		return -1;
+	}
 
 	cfg.context 			= NULL;
 	cfg.read 				= lfs_read;
 	cfg.prog 				= lfs_write;
 	cfg.erase 				= lfs_SectorErase;
 	cfg.sync				= lfs_sync;
-	cfg.read_size 			= 256;
-	cfg.prog_size 			= 256;
-	cfg.block_size 			= 65536;
-	cfg.block_count 		= 64;
+	/* Read and program a whole flash page per operation */
+	cfg.read_size 			= info->page_size;
+	cfg.prog_size 			= info->page_size;
 	cfg.block_cycles 		= 100;
-	cfg.cache_size 			= 256;
-	cfg.lookahead_size 		= 16;
+
+	s_lfs_dev = NULL;
+#if defined(CONFIG_LFS_STRIPED)
+	if( flash_dev_stripe_init(&s_lfs_pair, &flash_dev_spi1, &flash_dev_spi3, LFS_STRIPE_SIZE) == 0 )
+		s_lfs_dev = &s_lfs_pair;
+#elif defined(CONFIG_LFS_MIRRORED)
+	if( flash_dev_mirror_init(&s_lfs_pair, &flash_dev_spi1, &flash_dev_spi3) == 0 )
+		s_lfs_dev = &s_lfs_pair;
+#endif
+
+	/* A striped pair keeps half of each stripe on each part, the partition of the
+	 * SPI1 map is the same range on both parts, so twice the range of the pair */
+	s_lfs_base = part->offset;
+	part_size = part->size;
+	if( s_lfs_dev && s_lfs_dev->stripe )
+	{
+		s_lfs_base *= 2;
+		part_size *= 2;
+	}
+
+	/* Never let the file system run past the end of the part */
+	dev_size = s_lfs_dev ? s_lfs_dev->size : SPI_FLASH_GetSize();
+	if( s_lfs_base >= dev_size )
+		part_size = 0;
+	else if( part_size > dev_size - s_lfs_base )
+		part_size = dev_size - s_lfs_base;
+
+	erase_size = s_lfs_dev ? s_lfs_dev->erase_size : flash_info_min_erase(info);
+	if( erase_size < LFS_BLOCK_SIZE_MIN )
+		erase_size = LFS_BLOCK_SIZE_MIN;
+	cfg.block_size 			= erase_size;
+	cfg.block_count 		= part_size / cfg.block_size;
+
+	cfg.cache_size 			= info->page_size * LFS_CACHE_PAGES;
+	if( cfg.cache_size > LFS_CACHE_MAX )
+		cfg.cache_size = LFS_CACHE_MAX;
+	if( cfg.cache_size > cfg.block_size )
+		cfg.cache_size = cfg.block_size;
+
+	/* One bit per block, in multiples of 8 bytes */
+	cfg.lookahead_size 		= ((cfg.block_count + 63) / 64) * 8;
+	if( cfg.lookahead_size > LFS_LOOKAHEAD_MAX )
+		cfg.lookahead_size = LFS_LOOKAHEAD_MAX;
+
+	cfg.metadata_max 		= cfg.block_size > LFS_METADATA_MAX ? LFS_METADATA_MAX : 0;
+#ifdef LFS_NO_MALLOC
+	cfg.read_buffer 		= s_lfs_read_buf;
+	cfg.prog_buffer 		= s_lfs_prog_buf;
+	cfg.lookahead_buffer 	= s_lfs_lookahead_buf;
+#else
 	cfg.read_buffer 		= NULL;
 	cfg.prog_buffer 		= NULL;
 	cfg.lookahead_buffer 	= NULL;
+#endif
+
+	/* Lines of one page, which fit the LFS_RCACHE_LINE_MAX sized buffer lines */
+#ifdef CONFIG_LFS_RCACHE
+	cfg.rcache_lines		= cfg.read_size <= LFS_RCACHE_LINE_MAX ? LFS_RCACHE_LINES : 0;
+	cfg.rcache_line_size	= cfg.read_size;
+#ifdef LFS_NO_MALLOC
+	cfg.rcache_buffer		= s_lfs_rcache_buf;
+#else
+	cfg.rcache_buffer		= NULL;
+#endif
+#else
+	cfg.rcache_lines		= 0;
+	cfg.rcache_line_size	= 0;
+	cfg.rcache_buffer		= NULL;
+#endif
 	cfg.name_max 			= 255;
 	cfg.file_max 			= 0;
 	cfg.attr_max 			= 0;
 
+	return cfg.block_count ? 0 : -1;
+}
+
+/* Description:  lfs_file_open() with the file cache taken from the arena, littlefs built
+ *               with LFS_NO_MALLOC cannot allocate one. Files opened here must be
+ *               closed with lfs_port_file_close().
+ * Return:       0 or a negative LFS_ERR_* code, LFS_ERR_NOMEM if every slot is in use
+ */
+int lfs_port_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags)
+{
+	return lfs_port_file_open_size(lfs, file, path, flags, 0);
+}
+
+/* Description:  lfs_port_file_open() for a file about to be written with size bytes,
+ *               littlefs places it in contiguous blocks where it can (extent_size).
+ *               Only used with LFS_NO_MALLOC, which gives each file its own config.
+ */
+int lfs_port_file_open_size(lfs_t *lfs, lfs_file_t *file, const char *path, int flags, lfs_size_t size)
+{
+#ifdef LFS_NO_MALLOC
+	int							slot;
+	int							used = 0;
+	int							err;
+
+	for(slot=0; slot<LFS_FILE_SLOTS; slot++)
+	{
+		if( !(s_lfs_arena_used & (1 << slot)) )
+			break;
+	}
+	if( slot == LFS_FILE_SLOTS )
+	{
+		printf("lfs: no free file cache for %s\r\n", path);
+		return LFS_ERR_NOMEM;
+	}
+
+	s_lfs_file_cfg[slot].buffer = s_lfs_arena[slot];
+	s_lfs_file_cfg[slot].extent_size = size;
+	s_lfs_file_cfg[slot].index_buffer = s_lfs_index[slot];
+	s_lfs_file_cfg[slot].index_size = LFS_CTZ_INDEX_SIZE;
+	if( (err = lfs_file_opencfg(lfs, file, path, flags, &s_lfs_file_cfg[slot])) < 0 )
+		return err;
+
+	s_lfs_arena_used |= 1 << slot;
+	for(slot=0; slot<LFS_FILE_SLOTS; slot++)
+		used += (s_lfs_arena_used >> slot) & 1;
+	if( used > s_lfs_arena_peak )
+		s_lfs_arena_peak = used;
+	return 0;
+#else
+	(void)size;
+	return lfs_file_open(lfs, file, path, flags);
+#endif
+}
+
+/* Description:  Return 1 if file is on the open list of lfs */
+static int lfs_port_file_is_open(lfs_t *lfs, lfs_file_t *file)
+{
+	struct lfs_mlist		   *m;
+
+	for(m=lfs->mlist; m; m=m->next)
+	{
+		if( m == (struct lfs_mlist *)file )
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Description:  lfs_file_close() of a file opened by lfs_port_file_open(), then give its
+ *               cache slot back. A file which is not open is refused, so a second close
+ *               cannot free the slot of a file opened since. littlefs takes the file off
+ *               its open list even when the final sync fails, the slot is freed then too.
+ * Return:       0 or a negative LFS_ERR_* code, LFS_ERR_BADF if the file is not open
+ */
+int lfs_port_file_close(lfs_t *lfs, lfs_file_t *file)
+{
+#ifdef LFS_NO_MALLOC
+	int							slot;
+	int							err;
+
+	if( !lfs_port_file_is_open(lfs, file) )
+		return LFS_ERR_BADF;
+
+	err = lfs_file_close(lfs, file);
+	if( lfs_port_file_is_open(lfs, file) )
+		return err;
+
+	for(slot=0; slot<LFS_FILE_SLOTS; slot++)
+	{
+		if( file->cfg == &s_lfs_file_cfg[slot] )
+			s_lfs_arena_used &= ~(1 << slot);
+	}
+	if( err == 0 )
+	{
+		s_ctz_reads += file->index.reads;
+		s_ctz_saved += file->index.saved;
+	}
+	file->cfg = NULL;
+
+	return err;
+#else
+	return lfs_file_close(lfs, file);
+#endif
+}
+
+/* Description:  Mount the file system with cfg, from the saved mount hint when it still
+ *               matches the flash, with a full lfs_mount() otherwise.
+ */
+int lfs_port_mount(lfs_t *lfs)
+{
+#ifdef CONFIG_LFS_MOUNT_HINT
+	s_hint_live = 0;
+	if( lfs_hint_load() == 0 )
+	{
+		s_hint_live = 1;
+		if( lfs_mount_hinted(lfs, &cfg, &s_hint.hint) == 0 )
+		{
+			printf("lfs mounted from hint generation %lu\r\n", (unsigned long)s_hint.generation);
+			return 0;
+		}
+
+		/* Written by someone else since, do not try it again */
+		printf("lfs mount hint is stale\r\n");
+		lfs_hint_discard();
+	}
+#endif
+	return lfs_mount(lfs, &cfg);
+}
+
+/* Description:  Unmount after the queued programs are done, leaving a mount hint for the
+ *               next boot. Open files must be closed first.
+ */
+int lfs_port_unmount(lfs_t *lfs)
+{
+	int							err;
+
+	if( (err = lfs_sync(&cfg)) < 0 )
+		printf("lfs sync before unmount failed: %d\r\n", err);
+
+#ifdef CONFIG_LFS_MOUNT_HINT
+	if( err == 0 && (err = lfs_hint_save(lfs)) < 0 )
+		printf("lfs mount hint not saved: %d\r\n", err);
+#endif
+
+	return lfs_unmount(lfs);
+}
+
+/* Description:  Print the RAM littlefs gets from the port, the most files open at once and
+ *               what the CTZ index saved the seeks so far
+ */
+void lfs_port_ram_report(void)
+{
+#ifdef LFS_NO_MALLOC
+	printf("littlefs RAM: %lu bytes static of %lu, %u/%u file caches used at most\r\n",
+			(unsigned long)LFS_STATIC_RAM, (unsigned long)LFS_RAM_BUDGET, s_lfs_arena_peak, LFS_FILE_SLOTS);
+	printf("littlefs CTZ index: %lu pointer reads, %lu saved\r\n", (unsigned long)s_ctz_reads,
+			(unsigned long)s_ctz_saved);
+#else
+	printf("littlefs RAM: buffers from the heap\r\n");
+#endif
+}
+
+/* Description:  Print what each line of the littlefs read cache held and served */
+void lfs_port_rcache_report(lfs_t *lfs)
+{
+	lfs_size_t					i;
+
+	if( !cfg.rcache_lines )
+		return;
+
+	printf("littlefs read cache, %lu lines of %lu bytes:\r\n", (unsigned long)cfg.rcache_lines,
+			(unsigned long)lfs->rline_size);
+	for(i=0; i<cfg.rcache_lines; i++)
+	{
+		printf("  line %lu: block %5ld @0x%04lX %8lu hits %8lu fills\r\n", (unsigned long)i,
+				lfs->rlines[i].block == (lfs_block_t)-1 ? -1L : (long)lfs->rlines[i].block,
+				(unsigned long)lfs->rlines[i].off, (unsigned long)lfs->rlines[i].hits,
+				(unsigned long)lfs->rlines[i].fills);
+	}
 }
 
 void lfs_test()
@@ -96,13 +885,12 @@ void lfs_test()
 	lfs_t 						lfs;
 	lfs_file_t 					file;
 
-	const char					*message = "Hello, LittleFS!";
-	char 						buffer[100];
 	lfs_ssize_t 				read_size;
 	int							err;
 	uint32_t					boot_count = 0;
 	/* Configure the little fs file system */
-	init_lfs_config();
+	if( init_lfs_config() < 0 )
+		return;
 	HAL_Delay(10);
 	/* Mount the little fs file system */
 
@@ -114,7 +902,7 @@ void lfs_test()
 	err = lfs_mount(&lfs, &cfg);
 	if( err )
 	{
-		SPI_Flash_ChipErase();
+		lfs_erase_partition();
 		printf("start to fromat...\r\n");
 		err = lfs_format( &lfs, &cfg );
 		if( err )
@@ -137,7 +925,7 @@ void lfs_test()
 #ifdef CONFIG_LITTLEFS_DEBUG
 	littlefs_print("Opening file...\n");
 #endif
-	err = lfs_file_open( &lfs, &file, "boot_count", LFS_O_RDWR | LFS_O_CREAT);
+	err = lfs_port_file_open( &lfs, &file, "boot_count", LFS_O_RDWR | LFS_O_CREAT);
 	if ( err )
 	{
 	    printf("lfs_file_open error: %d\r\n", err);
@@ -155,7 +943,7 @@ void lfs_test()
 	if( read_size < 0 )
 	{
 		printf("lfs_file_read error :%d\r\n", read_size);
-		lfs_file_close(&lfs, &file);
+		lfs_port_file_close(&lfs, &file);
 		lfs_unmount(&lfs);
 		return;
 	}
@@ -174,7 +962,7 @@ void lfs_test()
 	if (err)
 	{
 		printf("lfs_file_rewind error: %d\r\n", err);
-		lfs_file_close(&lfs, &file);
+		lfs_port_file_close(&lfs, &file);
 		lfs_unmount(&lfs);
 		return;
 	}
@@ -186,14 +974,14 @@ void lfs_test()
 	if (err < 0 )
 	{
 		printf("lfs_file_write error: %d\r\n", err);
-		lfs_file_close(&lfs, &file);
+		lfs_port_file_close(&lfs, &file);
 		lfs_unmount(&lfs);
 		return;
 	}
 #ifdef CONFIG_LITTLEFS_DEBUG
 	littlefs_print("Closing file...\r\n");
 #endif
-	err = lfs_file_close(&lfs, &file);
+	err = lfs_port_file_close(&lfs, &file);
 	if (err < 0)
 	{
 		printf("lfs_file_write error: %d\r\n", err);
@@ -215,14 +1003,16 @@ void lfs_test()
 void initialize_filesystem(void)
 {
 	int							err;
-init_lfs_config();
+
+	if( init_lfs_config() < 0 )
+		return;
 #ifdef CONFIG_LITTLEFS_DEBUG
 	littlefs_print("Mounting file system...\n");
 #endif
-	err = lfs_mount(&lfs, &cfg);
+	err = lfs_port_mount(&lfs);
 	if( err )
 	{
-		SPI_Flash_ChipErase();
+		lfs_erase_partition();
 		printf("start to fromat...\r\n");
 		err = lfs_format( &lfs, &cfg );
 		if( err )
@@ -239,7 +1029,10 @@ init_lfs_config();
 		}
 	}
 
-
+	/* Start erasing the free blocks while waiting for the host */
+	if( lfs_preerase_scan(&lfs) < 0 )
+		printf("lfs pre-erase scan failed\r\n");
+	lfs_port_ram_report();
 }
 
 void print_all_files()
@@ -258,9 +1051,9 @@ void print_all_files()
 
         if (info.type == LFS_TYPE_REG)
         {
-        	lfs_file_open(&lfs, &file, info.name, LFS_O_RDONLY);
+        	lfs_port_file_open(&lfs, &file, info.name, LFS_O_RDONLY);
             int size = lfs_file_size(&lfs, &file);
-            lfs_file_close(&lfs, &file);
+            lfs_port_file_close(&lfs, &file);
             printf("File: %s, Size: %d bytes\n", info.name, size);
         }
     }
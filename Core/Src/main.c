@@ -18,6 +18,7 @@
 /* USER CODE END Header */
 /* Includes ------------------------------------------------------------------*/
 #include "main.h"
+#include "dma.h"
 #include "spi.h"
 #include "usart.h"
 #include "gpio.h"
@@ -25,9 +26,12 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "spi_flash.h"
+#include "flash_dev.h"
+#include "flash_part.h"
 #include "spi3_flash.h"
 #include "lfs.h"
 #include "lfs_util.h"
+#include "littlefs_port.h"
 #include "xymodem.h"
 #include "ringbuf.h"
 /* USER CODE END Includes */
@@ -101,17 +105,22 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_SPI1_Init();
   MX_USART1_UART_Init();
   MX_SPI3_Init();
   MX_USART3_UART_Init();
   /* USER CODE BEGIN 2 */
+  SPI_FLASH_Init();
+  flash_dev_init();
+  flash_part_init();
 
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
   print_bootloader_header();
+  flash_part_dump();
 
   /* Initializes the Littlefs system. */
   initialize_filesystem();
@@ -124,7 +133,11 @@ int main(void)
  /* start to transmit the files */
  do_load_ymodem();
 
- lfs_file_close(&lfs, &file);
+ /* Where the flash time went during the upload */
+ SPI_FLASH_DumpStats(SPI_FLASH_DUMP_TEXT);
+ lfs_port_rcache_report(&lfs);
+
+ lfs_port_file_close(&lfs, &file);
 /*  int res = lfs_dir_open(&lfs, &dir, "/");
   if (res < 0)
   {
@@ -134,8 +147,6 @@ int main(void)
   print_all_files();*/
  // lfs_dir_close(&lfs, &dir);
   do_load_elf();
-  lfs_file_close(&lfs, &file);
-  lfs_unmount(&lfs);
 
 
   while (1)
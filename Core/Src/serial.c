@@ -1,6 +1,9 @@
 #include <serial.h>
 #include "ringbuf.h"
 #include "keyled.h"
+#include "spi_flash.h"
+#include "littlefs_port.h"
+#include "flash_job.h"
 
 /*
  *+--------------------------------+
@@ -43,6 +46,11 @@ signed portBASE_TYPE xSerialGetChar( xComPortHandle pxPort, signed char *pcRxedC
             rv = pdTRUE;
             break;
         }
+        /* Idle time, program the partial page the last writes left behind,
+         * erase the free blocks ahead of the next writes and run the queued jobs */
+        SPI_FLASH_WritePoll();
+        lfs_preerase_poll();
+        flash_job_poll();
         HAL_Delay(1);
     }
 
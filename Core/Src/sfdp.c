@@ -0,0 +1,376 @@
+/*
+ * sfdp.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Reference: JESD216B Serial Flash Discoverable Parameters
+ */
+
+#include <string.h>
+#include "sfdp.h"
+
+#define SFDP_SIGNATURE		0x50444653	/* "SFDP" */
+#define SFDP_HDR_SIZE		8
+#define SFDP_PARAM_HDR_SIZE	8
+#define SFDP_BFPT_ID		0xFF00
+
+#define BFPT_DWORDS_V1		9			/* JESD216 */
+#define BFPT_DWORDS_V1A		16			/* JESD216A and later, adds erase/program times */
+
+/* BFPT DWORD12 suspend not supported bit, erase suspend latency units */
+#define BFPT_SUSPEND_UNSUPPORTED	0x80000000
+
+/* BFPT DWORD16 4-byte address mode enter [31:24] and exit [23:14] methods */
+#define BFPT_ADDR4_ENTER_B7			0x01
+#define BFPT_ADDR4_ENTER_WREN_B7	0x02
+#define BFPT_ADDR4_ALWAYS			0x40
+#define BFPT_ADDR4_EXIT_E9			0x01
+#define BFPT_ADDR4_EXIT_WREN_E9		0x02
+
+/* Known parts, used when the part has no (valid) SFDP table */
+#define ERASE_TYPES_STD(tse, tbe32, tbe64)	{ \
+		{ 65536, 0xD8, tbe64 / 10, tbe64 }, \
+		{ 32768, 0x52, tbe32 / 10, tbe32 }, \
+		{ 4096,  0x20, tse / 10,   tse }, \
+		{ 0, 0, 0, 0 } }
+
+/* 4-byte address mode method and status bit per vendor:
+ * Winbond ADS is Status Register-3 bit0, Macronix 4BYTE is configuration register
+ * bit5, ISSI EXTADD is bank address register bit7 with exit 0x29, GigaDevice has
+ * no documented status read so the enter command is trusted */
+#define ADDR4_NONE			{ 0, 0, 0, 0, 0 }
+#define ADDR4_WINBOND		{ 0xB7, 0xE9, 0, 0x15, 0x01 }
+#define ADDR4_MACRONIX		{ 0xB7, 0xE9, 0, 0x15, 0x20 }
+#define ADDR4_ISSI			{ 0xB7, 0x29, 0, 0x16, 0x80 }
+#define ADDR4_GIGADEVICE	{ 0xB7, 0xE9, 0, 0, 0 }
+
+/* Suspend/resume opcodes, status bit and latency per vendor: Winbond SUS is
+ * Status Register-2 bit7, GigaDevice SUS1/SUS2 are Status Register-2 bit7/bit2,
+ * Macronix PSB/ESB are security register bit2/bit3, ISSI PSUS/ESUS are function
+ * register bit2/bit3 */
+#define SUSPEND_WINBOND		{ 0x75, 0x7A, 0x35, 0x80, 20 }
+#define SUSPEND_GIGADEVICE	{ 0x75, 0x7A, 0x35, 0x84, 20 }
+#define SUSPEND_MACRONIX	{ 0xB0, 0x30, 0x2B, 0x0C, 20 }
+#define SUSPEND_ISSI		{ 0x75, 0x7A, 0x48, 0x0C, 100 }
+
+static const struct spi_flash_info flash_table[] = {
+	{ "W25Q32",    0xEF4016, 4<<20,  256, 3, 50000,  ERASE_TYPES_STD(400, 1600, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3BYTE, ADDR4_NONE, SUSPEND_WINBOND },
+	{ "W25Q64",    0xEF4017, 8<<20,  256, 3, 100000, ERASE_TYPES_STD(400, 1600, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3BYTE, ADDR4_NONE, SUSPEND_WINBOND },
+	{ "W25Q128",   0xEF4018, 16<<20, 256, 3, 200000, ERASE_TYPES_STD(400, 1600, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3BYTE, ADDR4_NONE, SUSPEND_WINBOND },
+	{ "W25Q256",   0xEF4019, 32<<20, 256, 3, 400000, ERASE_TYPES_STD(400, 1600, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3OR4BYTE, ADDR4_WINBOND, SUSPEND_WINBOND },
+	{ "GD25Q256",  0xC84019, 32<<20, 256, 3, 250000, ERASE_TYPES_STD(500, 1600, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3OR4BYTE, ADDR4_GIGADEVICE, SUSPEND_GIGADEVICE },
+	{ "MX25L256",  0xC22019, 32<<20, 256, 3, 300000, ERASE_TYPES_STD(400, 1000, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3OR4BYTE, ADDR4_MACRONIX, SUSPEND_MACRONIX },
+	{ "IS25LP256", 0x9D6019, 32<<20, 256, 3, 300000, ERASE_TYPES_STD(300, 1000, 2000), 0x03, 0x0B, 8, 0x3B, 8, FLASH_ADDR_3OR4BYTE, ADDR4_ISSI, SUSPEND_ISSI },
+};
+
+static uint32_t sfdp_dword(const uint8_t *p)
+{
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* BFPT DWORD10 erase time: count in [4:0], units in [6:5] of the 7-bit field */
+static uint32_t sfdp_erase_ms(uint32_t field)
+{
+	static const uint32_t	units[4] = { 1, 16, 128, 1000 };
+
+	return ((field & 0x1F) + 1) * units[(field >> 5) & 0x03];
+}
+
+int sfdp_parse(const uint8_t *buf, uint32_t len, struct spi_flash_info *info)
+{
+	const uint8_t		   *phdr;
+	const uint8_t		   *bfpt = NULL;
+	uint32_t				bfpt_dwords = 0;
+	uint32_t				ptp, dw, mult, v;
+	int						nph, i;
+
+	if( len < SFDP_HDR_SIZE + SFDP_PARAM_HDR_SIZE || sfdp_dword(buf) != SFDP_SIGNATURE )
+		return -1;
+
+	/* Look for the newest BFPT which is inside the dump */
+	nph = buf[6] + 1;
+	for(i=0; i<nph; i++)
+	{
+		phdr = buf + SFDP_HDR_SIZE + i * SFDP_PARAM_HDR_SIZE;
+		if( phdr + SFDP_PARAM_HDR_SIZE > buf + len )
+			break;
+
+		if( ((phdr[7] << 8) | phdr[0]) != SFDP_BFPT_ID )
+			continue;
+
+		ptp = phdr[4] | (phdr[5] << 8) | (phdr[6] << 16);
+		if( phdr[3] < BFPT_DWORDS_V1 || ptp + BFPT_DWORDS_V1 * 4 > len )
+			continue;
+
+		bfpt = buf + ptp;
+		bfpt_dwords = phdr[3];
+		if( ptp + bfpt_dwords * 4 > len )
+			bfpt_dwords = (len - ptp) / 4;
+	}
+
+	if( !bfpt )
+		return -1;
+
+	memset(info, 0, sizeof(*info));
+	info->name = "SFDP";
+	info->read_cmd = 0x03;
+	info->fast_read_cmd = 0x0B;
+	info->fast_read_dummy = 8;
+
+	/* DWORD1: address bytes and 1-1-2 fast read support */
+	dw = sfdp_dword(bfpt);
+	info->addr_mode = (dw >> 17) & 0x03;
+
+	/* DWORD2: density in bits */
+	v = sfdp_dword(bfpt + 4);
+	if( v & 0x80000000 )
+	{
+		v &= 0x7FFFFFFF;
+		if( v < 3 || v > 34 )
+			return -1;
+		info->size = 1UL << (v - 3);
+	}
+	else
+	{
+		info->size = (v >> 3) + 1;
+	}
+
+	/* DWORD4: 1-1-2 fast read opcode and wait states (dummy + mode clocks) */
+	if( dw & (1 << 16) )
+	{
+		v = sfdp_dword(bfpt + 12);
+		info->dual_read_cmd = (v >> 8) & 0xFF;
+		info->dual_read_dummy = (v & 0x1F) + ((v >> 5) & 0x07);
+	}
+
+	/* DWORD8/DWORD9: erase types 1..4 */
+	for(i=0; i<FLASH_ERASE_TYPES; i++)
+	{
+		v = sfdp_dword(bfpt + 28 + (i / 2) * 4) >> ((i % 2) * 16);
+		if( (v & 0xFF) == 0 || (v & 0xFF) > 31 )
+			continue;
+
+		info->erase[i].size = 1UL << (v & 0xFF);
+		info->erase[i].cmd = (v >> 8) & 0xFF;
+	}
+
+	/* Default worst case times, overwritten by JESD216A DWORD10/DWORD11 */
+	info->page_size = 256;
+	info->pp_max_ms = 5;
+	info->ce_max_ms = 400000;
+	for(i=0; i<FLASH_ERASE_TYPES; i++)
+	{
+		if( info->erase[i].size )
+		{
+			info->erase[i].max_ms = 2000;
+			info->erase[i].typ_ms = 200;
+		}
+	}
+
+	if( bfpt_dwords >= BFPT_DWORDS_V1A )
+	{
+		/* DWORD10: typical erase times, max = 2 * (mult + 1) * typical */
+		dw = sfdp_dword(bfpt + 36);
+		mult = 2 * ((dw & 0x0F) + 1);
+		for(i=0; i<FLASH_ERASE_TYPES; i++)
+		{
+			if( !info->erase[i].size )
+				continue;
+
+			info->erase[i].typ_ms = sfdp_erase_ms(dw >> (4 + i * 7));
+			info->erase[i].max_ms = info->erase[i].typ_ms * mult;
+		}
+
+		/* DWORD11: page size, page program and chip erase times */
+		dw = sfdp_dword(bfpt + 40);
+		mult = 2 * ((dw & 0x0F) + 1);
+		info->page_size = 1UL << ((dw >> 4) & 0x0F);
+		v = (((dw >> 8) & 0x1F) + 1) * ((dw & (1 << 13)) ? 64 : 8);	/* us */
+		info->pp_max_ms = (v * mult + 999) / 1000;
+		{
+			static const uint32_t	ce_units[4] = { 16, 256, 4000, 64000 };
+
+			info->ce_max_ms = (((dw >> 24) & 0x1F) + 1) * ce_units[(dw >> 29) & 0x03] * mult;
+		}
+	}
+
+	/* DWORD12/DWORD13: suspend latency of an erase in [30:24], suspend/resume opcodes */
+	if( bfpt_dwords >= BFPT_DWORDS_V1A && !(sfdp_dword(bfpt + 44) & BFPT_SUSPEND_UNSUPPORTED) )
+	{
+		static const uint32_t	sus_units_ns[4] = { 128, 1000, 8000, 64000 };
+
+		dw = sfdp_dword(bfpt + 44);
+		info->suspend.max_us = ((((dw >> 24) & 0x1F) + 1) * sus_units_ns[(dw >> 29) & 0x03] + 999) / 1000;
+		dw = sfdp_dword(bfpt + 48);
+		info->suspend.suspend = (dw >> 24) & 0xFF;
+		info->suspend.resume = (dw >> 16) & 0xFF;
+	}
+
+	/* Before JESD216A the de facto 0xB7/0xE9, an erased DWORD16 is not filled in */
+	if( info->addr_mode == FLASH_ADDR_3OR4BYTE )
+	{
+		info->addr4.enter = 0xB7;
+		info->addr4.exit = 0xE9;
+	}
+	if( bfpt_dwords >= BFPT_DWORDS_V1A && (dw = sfdp_dword(bfpt + 60)) != 0xFFFFFFFF )
+	{
+		/* DWORD16: only the command methods, the register methods are left unused */
+		v = dw >> 24;
+		if( v & BFPT_ADDR4_ALWAYS )
+			info->addr_mode = FLASH_ADDR_4BYTE;
+		info->addr4.enter = (v & (BFPT_ADDR4_ENTER_B7 | BFPT_ADDR4_ENTER_WREN_B7)) ? 0xB7 : 0;
+		info->addr4.wren = !(v & BFPT_ADDR4_ENTER_B7) && (v & BFPT_ADDR4_ENTER_WREN_B7);
+
+		v = (dw >> 14) & 0x3FF;
+		info->addr4.exit = (v & (BFPT_ADDR4_EXIT_E9 | BFPT_ADDR4_EXIT_WREN_E9)) ? 0xE9 : 0;
+		if( !(v & BFPT_ADDR4_EXIT_E9) && (v & BFPT_ADDR4_EXIT_WREN_E9) )
+			info->addr4.wren = 1;
+	}
+
+	flash_info_sort_erase(info);
+	if( !info->erase[0].size )
+		return -1;
+
+	return 0;
+}
+
+const struct spi_flash_info *flash_info_lookup(uint32_t jedec_id)
+{
+	uint32_t			i;
+
+	for(i=0; i<sizeof(flash_table)/sizeof(flash_table[0]); i++)
+	{
+		if( flash_table[i].jedec_id == jedec_id )
+			return &flash_table[i];
+	}
+
+	return NULL;
+}
+
+void flash_info_merge(struct spi_flash_info *info, const struct spi_flash_info *known)
+{
+	if( !known )
+		return;
+
+	info->name = known->name;
+	info->addr4.status_cmd = known->addr4.status_cmd;
+	info->addr4.status_mask = known->addr4.status_mask;
+
+	if( !info->addr4.enter )
+	{
+		info->addr4.enter = known->addr4.enter;
+		info->addr4.wren |= known->addr4.wren;
+	}
+	if( !info->addr4.exit )
+		info->addr4.exit = known->addr4.exit;
+
+	info->suspend.status_cmd = known->suspend.status_cmd;
+	info->suspend.status_mask = known->suspend.status_mask;
+	if( !info->suspend.suspend || !info->suspend.resume )
+		info->suspend = known->suspend;
+}
+
+int flash_info_can_suspend(const struct spi_flash_info *info)
+{
+	return info->suspend.suspend && info->suspend.resume && info->suspend.status_cmd;
+}
+
+static void flash_addr4_cmd(const struct spi_flash_info *info, const struct flash_bus *bus, uint8_t cmd)
+{
+	if( info->addr4.wren )
+		bus->cmd(0x06);
+	bus->cmd(cmd);
+}
+
+/* Without a status register the command is trusted */
+static int flash_addr4_status(const struct spi_flash_info *info, const struct flash_bus *bus)
+{
+	if( !info->addr4.status_cmd )
+		return -1;
+
+	return (bus->read_reg(info->addr4.status_cmd) & info->addr4.status_mask) ? 1 : 0;
+}
+
+int flash_addr4_select(const struct spi_flash_info *info, const struct flash_bus *bus,
+		uint8_t *addr_bytes, uint32_t *usable)
+{
+	*addr_bytes = 3;
+	*usable = info->size;
+
+	if( info->size <= FLASH_3BYTE_LIMIT )
+		return 0;
+
+	if( info->addr_mode == FLASH_ADDR_4BYTE )
+	{
+		*addr_bytes = 4;
+		return 0;
+	}
+
+	/* 0xB7 means something else or nothing on a 3-byte only part */
+	if( info->addr_mode == FLASH_ADDR_3OR4BYTE && info->addr4.enter )
+	{
+		flash_addr4_cmd(info, bus, info->addr4.enter);
+		if( flash_addr4_status(info, bus) != 0 )
+		{
+			*addr_bytes = 4;
+			return 0;
+		}
+
+		/* Make sure the part decodes the 3-byte addresses the driver falls back to */
+		if( info->addr4.exit )
+			flash_addr4_cmd(info, bus, info->addr4.exit);
+		if( flash_addr4_status(info, bus) > 0 )
+		{
+			*addr_bytes = 4;
+			return -1;
+		}
+	}
+
+	*usable = FLASH_3BYTE_LIMIT;
+	return -1;
+}
+
+void flash_info_sort_erase(struct spi_flash_info *info)
+{
+	struct flash_erase_type		tmp;
+	int							i, j;
+
+	for(i=1; i<FLASH_ERASE_TYPES; i++)
+	{
+		for(j=i; j>0 && info->erase[j].size > info->erase[j-1].size; j--)
+		{
+			tmp = info->erase[j];
+			info->erase[j] = info->erase[j-1];
+			info->erase[j-1] = tmp;
+		}
+	}
+}
+
+uint32_t flash_info_min_erase(const struct spi_flash_info *info)
+{
+	int					i;
+
+	for(i=FLASH_ERASE_TYPES-1; i>=0; i--)
+	{
+		if( info->erase[i].size )
+			return info->erase[i].size;
+	}
+
+	return 0;
+}
+
+const struct flash_erase_type *flash_info_erase_type(const struct spi_flash_info *info, uint32_t addr, uint32_t end)
+{
+	const struct flash_erase_type	*type = NULL;
+	int								 i;
+
+	for(i=0; i<FLASH_ERASE_TYPES && info->erase[i].size; i++)
+	{
+		type = &info->erase[i];
+		if( (addr % type->size) == 0 && end - addr >= type->size )
+			break;
+	}
+
+	return type;
+}
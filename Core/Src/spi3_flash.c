@@ -11,10 +11,49 @@
 #include "usart.h"
 #include "gpio.h"
 #include <stdio.h>
+#include <string.h>
 #include "spi3_flash.h"
+#include "flash_job.h"
 #define Dummy_Byte 0xff
 #define SPI_TIMEOUT 1000 // 设置超时为 1000 毫秒
 
+#define Page_Size			256
+#define Flash_3Byte_Limit	(16 * 1024 * 1024)
+
+/* Opcode, 4 address bytes and up to 4 dummy bytes */
+#define SPI3_FLASH_CMD_MAX	9
+
+/* SFDP space read at init, BFPT is in the first 256 bytes on all the parts we use */
+#define SFDP_DUMP_SIZE		256
+
+/* Chip select of the second part on PA15 */
+#define CS3_PIN GPIO_PIN_15
+#define CS3_PORT GPIOA
+
+#define cs3_low()  HAL_GPIO_WritePin(CS3_PORT, CS3_PIN, GPIO_PIN_RESET)
+#define cs3_high() HAL_GPIO_WritePin(CS3_PORT, CS3_PIN, GPIO_PIN_SET)
+
+/* Runtime descriptor of the SPI3 part, a 16MB W25Q128 until SPI3_FLASH_Init() */
+static struct spi_flash_info	s_flash3 = {
+	.name				= "default",
+	.size				= Flash_3Byte_Limit,
+	.page_size			= Page_Size,
+	.pp_max_ms			= 5,
+	.ce_max_ms			= 400000,
+	.erase				= {
+		{ 65536, 0xD8, 150, 2100 },
+		{ 32768, 0x52, 120, 1700 },
+		{ 4096,  0x20, 45,  500 },
+	},
+	.read_cmd			= 0x03,
+	.fast_read_cmd		= 0x0B,
+	.fast_read_dummy	= 8,
+	.addr_mode			= FLASH_ADDR_3BYTE,
+};
+
+static uint8_t				s_addr_bytes = 3;
+static uint32_t				s_flash3_size;
+
 
 
 
@@ -44,21 +83,287 @@ uint8_t SPI3_FLASH_SendByte(uint8_t byte)
 
 uint8_t SPI3_FLASH_ReadByte(void)
 {
-	/*uint8_t t_data,r_data;
-	r_data = Dummy_Byte;
+	return SPI3_FLASH_SendByte(Dummy_Byte);
+}
+
+/* Description:  Transfer a buffer on SPI3, polled, either buffer may be NULL */
+static int SPI3_FLASH_Xfer(const uint8_t *snd_buf, uint8_t *recv_buf, uint32_t bytes)
+{
+	HAL_StatusTypeDef			status;
+	uint16_t					chunk;
 
-	if( HAL_SPI_TransmitReceive(&hspi3, &t_data, &r_data, 1, 0xFFFFFF) != HAL_OK )
+	while( bytes > 0 )
 	{
-		r_data = 0xff;
+		chunk = bytes > 0xFFFF ? 0xFFFF : bytes;
+
+		if( snd_buf && recv_buf )
+			status = HAL_SPI_TransmitReceive(&hspi3, (uint8_t *)snd_buf, recv_buf, chunk, SPI_TIMEOUT);
+		else if( snd_buf )
+			status = HAL_SPI_Transmit(&hspi3, (uint8_t *)snd_buf, chunk, SPI_TIMEOUT);
+		else
+		{
+			/* Full-duplex master receive clocks out the receive buffer itself */
+			memset(recv_buf, Dummy_Byte, chunk);
+			status = HAL_SPI_Receive(&hspi3, recv_buf, chunk, SPI_TIMEOUT);
+		}
+
+		if( status != HAL_OK )
+		{
+			printf("SPI3 transfer failure: %d\n", status);
+			return -1;
+		}
+
+		bytes -= chunk;
+		if( snd_buf )
+			snd_buf += chunk;
+		if( recv_buf )
+			recv_buf += chunk;
 	}
-	return r_data;*/
 
-	uint8_t t_data = Dummy_Byte; // 发送一个 Dummy_Byte
-	uint8_t r_data = 0;
-	HAL_StatusTypeDef status = HAL_SPI_TransmitReceive(&hspi3, &t_data, &r_data, 1, SPI_TIMEOUT);
-	printf("Sent: 0x%02X, Received: 0x%02X, Status: %d\n", t_data, r_data, status);
-	return r_data;
+	return 0;
+}
+
+static int SPI3_FLASH_CmdAddr(uint8_t *buf, uint8_t cmd, uint32_t addr)
+{
+	int					n = 0;
+
+	buf[n++] = cmd;
+	if( s_addr_bytes == 4 )
+		buf[n++] = (addr >> 24) & 0xFF;
+	buf[n++] = (addr >> 16) & 0xFF;
+	buf[n++] = (addr >> 8) & 0xFF;
+	buf[n++] = addr & 0xFF;
+
+	return n;
+}
+
+static uint8_t SPI3_FLASH_ReadStatus(uint8_t cmd)
+{
+	uint8_t				status;
+
+	cs3_low();
+	SPI3_FLASH_SendByte(cmd);
+	status = SPI3_FLASH_SendByte(Dummy_Byte);
+	cs3_high();
+
+	return status;
+}
+
+static void SPI3_FLASH_BusCmd(uint8_t cmd)
+{
+	cs3_low();
+	SPI3_FLASH_SendByte(cmd);
+	cs3_high();
+}
+
+static const struct flash_bus	s_flash3_bus = { SPI3_FLASH_BusCmd, SPI3_FLASH_ReadStatus };
+
+/* Description:  Wait for the program/erase of the part to end. The SPI1 job engine keeps
+ *               running meanwhile, the jobs of a striped or mirrored pair overlap with it.
+ */
+static int SPI3_FLASH_WaitEnd(uint32_t timeout)
+{
+	uint32_t			tickstart = HAL_GetTick();
+
+	while( SPI3_FLASH_ReadStatus(0x05) & 0x01 )
+	{
+		flash_job_poll();
+		if( HAL_GetTick() - tickstart > timeout )
+		{
+			printf("SPI3 Norflash wait busy timeout after %lu ms\r\n", (unsigned long)timeout);
+			return -3;
+		}
+	}
+
+	return 0;
+}
+
+static int SPI3_FLASH_WriteEnable(void)
+{
+	cs3_low();
+	SPI3_FLASH_SendByte(0x06);
+	cs3_high();
+
+	return (SPI3_FLASH_ReadStatus(0x05) & 0x02) ? 0 : -3;
+}
+
+uint32_t SPI3_FLASH_ReadJedecId(void)
+{
+	uint8_t				id[3];
+
+	cs3_low();
+	SPI3_FLASH_SendByte(0x9F);
+	SPI3_FLASH_Xfer(NULL, id, sizeof(id));
+	cs3_high();
+
+	return (id[0] << 16) | (id[1] << 8) | id[2];
+}
+
+/* Description:  Identify the part like SPI_FLASH_Init() does for SPI1, from SFDP or the
+ *               JEDEC ID table, and select the address mode.
+ * Return:       0 on success, -1 if no part answers on SPI3.
+ */
+int SPI3_FLASH_Init(void)
+{
+	const struct spi_flash_info	*known;
+	struct spi_flash_info		 info;
+	uint8_t						 sfdp[SFDP_DUMP_SIZE];
+	uint8_t						 cmd[5] = { 0x5A, 0, 0, 0, Dummy_Byte };
+	uint32_t					 jedec_id;
+
+	cs3_high();
+
+	/* A MCU reset leaves the part in whatever address mode it was */
+	cs3_low();
+	SPI3_FLASH_SendByte(0xE9);
+	cs3_high();
+	s_addr_bytes = 3;
 
+	jedec_id = SPI3_FLASH_ReadJedecId();
+	if( jedec_id == 0 || jedec_id == 0xFFFFFF )
+	{
+		printf("SPI3 Norflash not found\r\n");
+		s_flash3_size = 0;
+		return -1;
+	}
+	known = flash_info_lookup(jedec_id);
+
+	cs3_low();
+	SPI3_FLASH_Xfer(cmd, NULL, sizeof(cmd));
+	SPI3_FLASH_Xfer(NULL, sfdp, sizeof(sfdp));
+	cs3_high();
+
+	if( sfdp_parse(sfdp, sizeof(sfdp), &info) == 0 )
+	{
+		flash_info_merge(&info, known);
+		s_flash3 = info;
+	}
+	else if( known )
+	{
+		s_flash3 = *known;
+	}
+	s_flash3.jedec_id = jedec_id;
+
+	if( s_flash3.page_size > Page_Size || s_flash3.page_size == 0 )
+		s_flash3.page_size = Page_Size;
+
+	if( flash_addr4_select(&s_flash3, &s_flash3_bus, &s_addr_bytes, &s_flash3_size) < 0 )
+		printf("SPI3 Norflash 4-byte address mode failure\r\n");
+
+	printf("SPI3 Norflash %s ID 0x%06lX, %lu KB usable\r\n", s_flash3.name, (unsigned long)jedec_id,
+			(unsigned long)(s_flash3_size >> 10));
+
+	return 0;
+}
+
+const struct spi_flash_info *SPI3_FLASH_GetInfo(void)
+{
+	return &s_flash3;
 }
 
+/* Return the usable size, 0 if no part was found */
+uint32_t SPI3_FLASH_GetSize(void)
+{
+	return s_flash3_size;
+}
+
+int SPI3_FLASH_Read(uint32_t addr, uint8_t *buffer, uint32_t size)
+{
+	uint8_t				cmd[SPI3_FLASH_CMD_MAX];
+	int					bytes;
+	int					dummy;
+	int					rv;
+
+	if( addr + size > s_flash3_size )
+		return -2;
+
+	/* Fast read of the descriptor, its dummy clocks rounded to whole bytes */
+	bytes = SPI3_FLASH_CmdAddr(cmd, s_flash3.fast_read_cmd, addr);
+	for(dummy=0; dummy<s_flash3.fast_read_dummy/8 && bytes<SPI3_FLASH_CMD_MAX; dummy++)
+		cmd[bytes++] = Dummy_Byte;
+
+	cs3_low();
+	rv = SPI3_FLASH_Xfer(cmd, NULL, bytes);
+	if( rv == 0 )
+		rv = SPI3_FLASH_Xfer(NULL, buffer, size);
+	cs3_high();
+
+	return rv;
+}
+
+int SPI3_FLASH_Program(uint32_t addr, const uint8_t *data, uint32_t size)
+{
+	uint8_t				cmd[5];
+	uint32_t			len;
+	int					bytes;
+	int					rv;
 
+	if( addr + size > s_flash3_size )
+		return -2;
+
+	while( size > 0 )
+	{
+		len = s_flash3.page_size - (addr % s_flash3.page_size);
+		len = len > size ? size : len;
+
+		if( (rv = SPI3_FLASH_WriteEnable()) < 0 )
+			return rv;
+
+		bytes = SPI3_FLASH_CmdAddr(cmd, 0x02, addr);
+		cs3_low();
+		SPI3_FLASH_Xfer(cmd, NULL, bytes);
+		SPI3_FLASH_Xfer(data, NULL, len);
+		cs3_high();
+
+		if( (rv = SPI3_FLASH_WaitEnd(s_flash3.pp_max_ms)) < 0 )
+			return rv;
+
+		addr += len;
+		data += len;
+		size -= len;
+	}
+
+	return 0;
+}
+
+/* Description:  Erase all the sectors which cover [addr, addr+size) with the biggest
+ *               aligned erase commands.
+ */
+int SPI3_FLASH_EraseRange(uint32_t addr, uint32_t size)
+{
+	const struct flash_erase_type	*type;
+	uint32_t						 sector = flash_info_min_erase(&s_flash3);
+	uint32_t						 end;
+	uint8_t							 cmd[5];
+	int								 bytes;
+	int								 rv;
+
+	if( size == 0 )
+		return 0;
+
+	if( addr + size > s_flash3_size )
+		return -2;
+
+	end = (addr + size + sector - 1) / sector * sector;
+	addr = addr / sector * sector;
+
+	while( addr < end )
+	{
+		type = flash_info_erase_type(&s_flash3, addr, end);
+
+		if( (rv = SPI3_FLASH_WriteEnable()) < 0 )
+			return rv;
+
+		bytes = SPI3_FLASH_CmdAddr(cmd, type->cmd, addr);
+		cs3_low();
+		SPI3_FLASH_Xfer(cmd, NULL, bytes);
+		cs3_high();
+
+		if( (rv = SPI3_FLASH_WaitEnd(type->max_ms)) < 0 )
+			return rv;
+
+		addr += type->size;
+	}
+
+	return 0;
+}
@@ -7,15 +7,37 @@
 #include "spi_flash.h"
 #include "spi.h"
 #include <stdint.h>
+#include <string.h>
 #include "usart.h"
+#include "flash_job.h"
+#include "lfs_util.h"
+#include "crc16.h"
 #define Dummy_Byte 0xff
 #define SPI_TIMEOUT 1000
 
+/* Transfers shorter than this are polled, DMA setup costs more than it saves */
+#define SPI_DMA_THRESHOLD	16
+/* DMA CNDTR is 16 bits wide */
+#define SPI_DMA_MAX_CHUNK	0xFFFF
+
 #define Page_Size	256
 #define Sector_Size 4096
+#define Half_Block_Size	32768
 #define Block_Size	65536
 #define Flash_Size (32 * 1024 * 1024)
 
+/* Worst case completion time in ms, from the datasheet AC characteristics,
+ * only used until the part is identified */
+#define TIMEOUT_WEL			1
+#define TIMEOUT_PP			5
+#define TIMEOUT_SE			500
+#define TIMEOUT_BE32		1700
+#define TIMEOUT_BE64		2100
+#define TIMEOUT_CE			400000
+
+/* 3-byte addresses reach 16MB, bigger parts need 4-byte address mode */
+#define Flash_3Byte_Limit	(16 * 1024 * 1024)
+
 
 
 #define CS_PIN GPIO_PIN_4
@@ -26,51 +48,386 @@
 
 
 
-static void SPI1_FLASH_WriteEnable(void)
+/* Read-back calibration pattern size and the number of reads which must match */
+#define Calib_Size			256
+#define Calib_Rounds		8
+#define Calib_Margin		1		/* prescalers slower than the fastest that passes */
+
+/* SFDP space read at init, BFPT is in the first 256 bytes on all the parts we use */
+#define SFDP_DUMP_SIZE		256
+
+/* Runtime flash descriptor, the defaults are used until SPI_FLASH_Init() identifies the part */
+static struct spi_flash_info	s_flash = {
+	.name				= "default",
+	.size				= Flash_Size,
+	.page_size			= Page_Size,
+	.pp_max_ms			= TIMEOUT_PP,
+	.ce_max_ms			= TIMEOUT_CE,
+	.erase				= {
+		{ Block_Size,      0xD8, 150, TIMEOUT_BE64 },
+		{ Half_Block_Size, 0x52, 120, TIMEOUT_BE32 },
+		{ Sector_Size,     0x20, 45,  TIMEOUT_SE },
+	},
+	.read_cmd			= 0x03,
+	.fast_read_cmd		= 0x0B,
+	.fast_read_dummy	= 8,
+	.dual_read_cmd		= 0x3B,
+	.dual_read_dummy	= 8,
+	.addr_mode			= FLASH_ADDR_3OR4BYTE,
+	.addr4				= { 0xB7, 0xE9 },
+};
+
+/* Address bytes sent after every read/program/erase opcode, the usable flash size
+ * and the smallest erase unit */
+static uint8_t				s_addr_bytes = 3;
+static uint32_t				s_flash_size = Flash_3Byte_Limit;
+static uint32_t				s_sector_size = Sector_Size;
+
+static struct spi_flash_stats	s_stats;
+
+#ifdef CONFIG_SPI_FLASH_TRACE
+static struct spi_flash_trace	s_trace[SPI_FLASH_TRACE_DEPTH];
+static volatile uint32_t		s_trace_head;	/* entries recorded since the reset */
+static volatile uint8_t			s_trace_on = 1;
+#endif
+
+/* Word size reads of the blank check, also the chunk read per command. A step is
+ * sampled first, one chunk at the start of each sector, where the file systems
+ * start writing, and only read in full when all the samples are blank */
+#define Blank_Check_Size	256
+
+/* Read-back chunk of the verification, one sector per command */
+#define Verify_Chunk_Size	4096
+
+/* Verification mode per operation type, see SPI_FLASH_SetVerify() */
+static uint8_t				s_verify[SPI_FLASH_OP_MAX] = {
+	[SPI_FLASH_OP_ERASE]	= SPI_FLASH_VERIFY_COMPARE,
+	[SPI_FLASH_OP_PROGRAM]	= SPI_FLASH_VERIFY_OFF,
+};
+static uint32_t				s_verify_buf[Verify_Chunk_Size / sizeof(uint32_t)];
+
+/* Range the last erase already checked blank, step by step with the erase verify
+ * mode, SPI_FLASH_AutoVerify() of an erase inside it does not read it again. Empty
+ * when s_erased_addr == s_erased_end, cleared by any write to it */
+static uint32_t				s_erased_addr;
+static uint32_t				s_erased_end;
+
+/* A write-combining buffer older than this is programmed by SPI_FLASH_WritePoll() */
+#define WC_TIMEOUT_MS		20
+
+/* Write-combining buffer: bytes [s_wc_lo, s_wc_hi) of the page at s_wc_addr are
+ * not programmed yet, the buffer is empty when s_wc_lo == s_wc_hi */
+static uint8_t				s_wc_buf[Page_Size];
+static uint32_t				s_wc_addr;
+static uint32_t				s_wc_lo;
+static uint32_t				s_wc_hi;
+static uint32_t				s_wc_tick;
+
+/* Section of the cached pages, define it to __attribute__((section(".sram2"))) once
+ * the linker script places a .sram2 output section in SRAM2 */
+#ifndef FLASH_CACHE_SECTION
+#define FLASH_CACHE_SECTION
+#endif
+
+/* Longer reads are streaming (ELF loading), they go to the flash and keep the hot pages */
+#define FLASH_CACHE_BYPASS	(2 * Page_Size)
+
+struct flash_cache_line
+{
+	uint32_t			page;		/* page number, addr / page_size */
+	uint32_t			stamp;		/* last use, the smallest one is evicted */
+	uint8_t				valid;
+};
+
+static struct flash_cache_line	s_cache[FLASH_CACHE_SETS][FLASH_CACHE_WAYS];
+static uint32_t					s_cache_clock;
+static uint8_t					s_cache_data[FLASH_CACHE_SETS][FLASH_CACHE_WAYS][Page_Size]
+									FLASH_CACHE_SECTION __attribute__((aligned(4)));
+
+/* Description:  Drop the buffered bytes if they overlap [addr, addr+size), the range is
+ *               about to be erased */
+void SPI_FLASH_WcDiscard(uint32_t addr, uint32_t size)
+{
+	if( s_wc_lo != s_wc_hi && addr < s_wc_addr + s_wc_hi && s_wc_addr + s_wc_lo < addr + size )
+		s_wc_lo = s_wc_hi = 0;
+}
+
+/* Description:  Set the WEL latch and wait until Status Register reports it.
+ * Return     :  0 on success, -3 if WEL is not set within TIMEOUT_WEL.
+ */
+static int SPI1_FLASH_WriteEnable(void)
 {
+	uint32_t			tickstart;
+
 	cs_low();
 	SPI_FLASH_SendByte( 0x06 );
-	HAL_Delay(1);
+	cs_high();
+
+	tickstart = HAL_GetTick();
+	while( !(SPI_FLASH_ReadStatusRegister() & 0x02) )
+	{
+		if( HAL_GetTick() - tickstart > TIMEOUT_WEL )
+		{
+			printf("Norflash write enable timeout\r\n");
+			return -3;
+		}
+	}
+
+	return 0;
 }
 
 void SPI_FLASH_WriteDisable(void)
 {
+	cs_low();
 	SPI_FLASH_SendByte(0x04);
-	HAL_Delay(10);
+	cs_high();
+}
+
+/* Description:  Fill the opcode and the 3 or 4 bytes address into buf.
+ * Return     :  The number of bytes filled.
+ */
+int SPI_FLASH_CmdAddr(uint8_t *buf, uint8_t cmd, uint32_t addr)
+{
+	int					bytes = 0;
+
+	buf[bytes++] = cmd;
+	if( s_addr_bytes == 4 )
+	{
+		buf[bytes++] = (addr >> 24) & 0xFF;
+	}
+	buf[bytes++] = (addr >> 16) & 0xFF;
+	buf[bytes++] = (addr >> 8) & 0xFF;
+	buf[bytes++] = addr & 0xFF;
+
+	return bytes;
+}
+
+/* Description:  Fill the fast read opcode, address and dummy bytes into buf.
+ * Return     :  The number of bytes filled, at most SPI_FLASH_CMD_MAX.
+ */
+int SPI_FLASH_ReadCmd(uint8_t *buf, uint32_t addr)
+{
+	int					bytes;
+	int					dummy;
+
+	bytes = SPI_FLASH_CmdAddr(buf, s_flash.fast_read_cmd, addr);
+	for(dummy=0; dummy<s_flash.fast_read_dummy/8 && bytes<SPI_FLASH_CMD_MAX; dummy++)
+	{
+		buf[bytes++] = Dummy_Byte;
+	}
+
+	return bytes;
+}
+
+void SPI_FLASH_Select(void)
+{
+	cs_low();
+}
+
+void SPI_FLASH_Deselect(void)
+{
+	cs_high();
+}
+
+/* Description:  Read the 0x9F manufacturer and device ID */
+uint32_t SPI_FLASH_ReadJedecId(void)
+{
+	uint8_t				cmd[4] = { 0x9F, Dummy_Byte, Dummy_Byte, Dummy_Byte };
+	uint8_t				id[4];
+	uint32_t			t0 = SPI_FLASH_TRACE_BEGIN();
+
+	cs_low();
+	SPI_FLASH_Xfer(cmd, id, sizeof(cmd));
+	cs_high();
+	SPI_FLASH_TRACE(0x9F, 0, 3, t0);
+
+	return (id[1] << 16) | (id[2] << 8) | id[3];
+}
+
+/* Description:  Read the SFDP space, always with a 3-byte address and 8 dummy clocks */
+static void SPI_FLASH_ReadSfdp(uint32_t addr, uint8_t *buffer, uint32_t size)
+{
+	uint8_t				cmd[5];
+	uint32_t			t0 = SPI_FLASH_TRACE_BEGIN();
+
+	cmd[0] = 0x5A;
+	cmd[1] = (addr >> 16) & 0xFF;
+	cmd[2] = (addr >> 8) & 0xFF;
+	cmd[3] = addr & 0xFF;
+	cmd[4] = Dummy_Byte;
+
+	cs_low();
+	SPI_FLASH_Xfer(cmd, NULL, sizeof(cmd));
+	SPI_FLASH_Xfer(NULL, buffer, size);
+	cs_high();
+	SPI_FLASH_TRACE(0x5A, addr, size, t0);
+}
+
+/* Bus access for the code shared with the SPI3 driver */
+static void SPI_FLASH_BusCmd(uint8_t cmd)
+{
+	cs_low();
+	SPI_FLASH_SendByte(cmd);
+	cs_high();
+}
+
+/* Description:  Read a one byte register, e.g. a vendor status register */
+uint8_t SPI_FLASH_ReadRegister(uint8_t cmd)
+{
+	uint8_t				value;
+
+	cs_low();
+	SPI_FLASH_SendByte(cmd);
+	value = SPI_FLASH_SendByte(Dummy_Byte);
+	cs_high();
+
+	return value;
+}
+
+static const struct flash_bus	s_flash_bus = { SPI_FLASH_BusCmd, SPI_FLASH_ReadRegister };
+
+/* Description:  Select the address mode from the geometry: parts bigger than 16MB enter
+ *               4-byte address mode with the method of the descriptor, so every opcode
+ *               takes a 32-bit address. A part which does not confirm it in its vendor
+ *               status register is sent back to 3-byte mode and only its first 16MB are
+ *               used.
+ * Reference  :  JESD216B 6.4.18 BFPT DWORD16
+ */
+static int SPI_FLASH_SetAddrMode(void)
+{
+	int					rv;
+
+	rv = flash_addr4_select(&s_flash, &s_flash_bus, &s_addr_bytes, &s_flash_size);
+	if( rv < 0 && s_addr_bytes == 4 )
+		printf("Norflash is stuck in 4-byte address mode\r\n");
+	else if( rv < 0 )
+		printf("Norflash enter 4-byte address mode failure, only %d MB usable\r\n", Flash_3Byte_Limit >> 20);
+
+	return rv;
+}
+
+/* Description:  Identify the part from its SFDP tables, or from the JEDEC ID table when it
+ *               has none, fill the runtime descriptor and select the address mode and the
+ *               SPI clock from it.
+ */
+int SPI_FLASH_Init(void)
+{
+	const struct spi_flash_info	*known;
+	struct spi_flash_info		 info;
+	uint8_t						 sfdp[SFDP_DUMP_SIZE];
+	uint32_t					 jedec_id;
+	int							 rv;
+
+	/* The busy-time histogram counts CPU cycles */
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	/* A MCU reset leaves the part in whatever address mode it was */
+	cs_low();
+	SPI_FLASH_SendByte(0xE9);
+	cs_high();
+	s_addr_bytes = 3;
+
+	jedec_id = SPI_FLASH_ReadJedecId();
+	known = flash_info_lookup(jedec_id);
+
+	SPI_FLASH_ReadSfdp(0, sfdp, sizeof(sfdp));
+	if( sfdp_parse(sfdp, sizeof(sfdp), &info) == 0 )
+	{
+		flash_info_merge(&info, known);
+		s_flash = info;
+	}
+	else if( known )
+	{
+		s_flash = *known;
+	}
+	else
+	{
+		printf("Norflash unknown ID 0x%06lX without SFDP, use default geometry\r\n", (unsigned long)jedec_id);
+	}
+	s_flash.jedec_id = jedec_id;
+
+	/* Program buffers are sized for Page_Size, smaller programs are always legal */
+	if( s_flash.page_size > Page_Size || s_flash.page_size == 0 )
+		s_flash.page_size = Page_Size;
+	s_sector_size = flash_info_min_erase(&s_flash);
+
+	printf("Norflash %s ID 0x%06lX, %lu KB, page %lu, sector %lu\r\n", s_flash.name, (unsigned long)jedec_id,
+			(unsigned long)(s_flash.size >> 10), (unsigned long)s_flash.page_size, (unsigned long)s_sector_size);
+
+	rv = SPI_FLASH_SetAddrMode();
+
+	/* Identified at the power-on prescaler, now find the fastest clock */
+	SPI_FLASH_Calibrate();
+
+	return rv;
+}
+
+const struct spi_flash_info *SPI_FLASH_GetInfo(void)
+{
+	return &s_flash;
+}
+
+uint32_t SPI_FLASH_GetSize(void)
+{
+	return s_flash_size;
 }
 
 /* Description:  Wait flash program/erase finished by read Status Register for BUSY bit
  * Reference  :  P15, 7.1 Status Registers
+ * Return     :  0 on success, -3 if BUSY is still set after timeout ms.
  */
-static void SPI1_FLASH_WaitEnd(void)
+static int SPI1_FLASH_WaitEnd(uint32_t timeout)
 {
-	uint8_t	state = 0;
-	do
+	uint32_t			tickstart;
+	uint32_t			cycstart = DWT->CYCCNT;
+
+	tickstart = HAL_GetTick();
+	while( SPI_FLASH_ReadStatusRegister() & 0x01 )
 	{
-		cs_low();
-		SPI_FLASH_SendByte(0x05);
-		state = SPI_FLASH_SendByte(0x00);
-		cs_high();
+		if( HAL_GetTick() - tickstart > timeout )
+		{
+			printf("Norflash wait busy timeout after %lu ms\r\n", (unsigned long)timeout);
+			return -3;
+		}
 	}
-	while( (state & 0x01) == SET );
+
+	SPI_FLASH_StatBusy(DWT->CYCCNT - cycstart);
+	return 0;
 }
 
 int SPI_Flash_ChipErase(void) {
 
 	int			rv;
+	uint32_t	t0;
 	printf("Start to ChipErase\n");
+    flash_job_pause();
+    SPI_FLASH_WcDiscard(0, s_flash_size);
+    SPI_FLASH_CacheInvalidate(0, s_flash_size);
     // Enable write operations
-    SPI1_FLASH_WriteEnable();
+    if( (rv = SPI1_FLASH_WriteEnable()) < 0 )
+    {
+    	flash_job_resume();
+    	return rv;
+    }
     // Begin the chip erase sequence
+    t0 = SPI_FLASH_TRACE_BEGIN();
     cs_low();
     SPI_FLASH_SendByte(0xC7);// 0xC7 for Chip Erase
-    HAL_Delay(500);
     cs_high();
-    SPI1_FLASH_WaitEnd();
+    SPI_FLASH_StatErase(0, s_flash_size);
+    rv = SPI1_FLASH_WaitEnd(s_flash.ce_max_ms);
+    SPI_FLASH_TRACE(0xC7, 0, s_flash_size, t0);
+    flash_job_resume();
+    if( rv < 0 )
+    {
+    	printf("ChipErase timeout\n");
+    	return rv;
+    }
     printf("Chip erase done\n");
 
     // Verification of erase
-    rv = SPI_FLASH_VerifyErase( 0x00000, Page_Size );
+    rv = SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, 0, NULL, s_flash_size);
     if (rv == -1 )
     {
     	printf("ChipErase failed\n");
@@ -85,36 +442,217 @@ int SPI_Flash_ChipErase(void) {
     return 0;
 }
 
+/* Description:  Pick the biggest erase command which starts at addr and fits in [addr, end).
+ *               addr and end must be aligned to the smallest erase size.
+ */
+void SPI_FLASH_EraseStep(uint32_t addr, uint32_t end, struct flash_erase_op *op)
+{
+	const struct flash_erase_type	*type = flash_info_erase_type(&s_flash, addr, end);
+
+	op->addr = addr;
+	op->size = type->size;
+	op->cmd = type->cmd;
+	op->timeout = type->max_ms;
+}
+
+/* Description:  Split the sectors which cover [addr, addr+size) into the fewest
+ *               erase commands the part supports, e.g. 64KB/32KB/4KB.
+ * Return     :  The number of commands put in ops, or -1 if max_ops is too small.
+ */
+int SPI_FLASH_PlanErase(uint32_t addr, uint32_t size, struct flash_erase_op *ops, int max_ops)
+{
+	uint32_t			end;
+	int					n = 0;
+
+	if( size == 0 )
+		return 0;
+
+	end = addr + size;
+	addr = addr / s_sector_size * s_sector_size;
+	end = (end + s_sector_size - 1) / s_sector_size * s_sector_size;
+
+	/* Data written before an erase of the same range is lost anyway */
+	SPI_FLASH_WcDiscard(addr, end - addr);
+	SPI_FLASH_CacheInvalidate(addr, end - addr);
+
+	while( addr < end )
+	{
+		if( n >= max_ops )
+			return -1;
+
+		SPI_FLASH_EraseStep(addr, end, &ops[n]);
+		addr += ops[n].size;
+		n++;
+	}
+
+	return n;
+}
+
+/* Description:  Return 1 if the buffer is all 0xFF, comparing a word at a time */
+static int SPI_FLASH_BufBlank(const uint8_t *buf, uint32_t len)
+{
+	uint32_t				word;
+	uint32_t				i;
+
+	for(i=0; i+sizeof(word)<=len; i+=sizeof(word))
+	{
+		memcpy(&word, buf+i, sizeof(word));
+		if( word != 0xFFFFFFFF )
+			return 0;
+	}
+
+	for( ; i<len; i++)
+	{
+		if( buf[i] != 0xFF )
+			return 0;
+	}
+
+	return 1;
+}
+
+static void SPI_FLASH_DoRead(uint32_t addr, uint8_t *buffer, uint32_t size);
+static int SPI_FLASH_DoVerify(uint32_t addr, const uint8_t *data, uint32_t length, int mode);
+
+/* Description:  Return 1 if the erase step [addr, addr+size) reads all 0xFF. The
+ *               first chunk of each sector is read first, a used step stops there
+ *               at one chunk per sector, only a blank looking one is read in full.
+ *               The bytes and time of the check go to the stats.
+ */
+static int SPI_FLASH_IsBlank(uint32_t addr, uint32_t size)
+{
+	uint32_t				buf[Blank_Check_Size / sizeof(uint32_t)];
+	uint32_t				cycles = DWT->CYCCNT;
+	uint32_t				off, len;
+	int						blank = 1;
+
+	for(off=0; off<size && blank; off+=s_sector_size)
+	{
+		len = size - off > sizeof(buf) ? sizeof(buf) : size - off;
+		SPI_FLASH_DoRead(addr + off, (uint8_t *)buf, len);
+		s_stats.blank_bytes += len;
+		blank = SPI_FLASH_BufBlank((uint8_t *)buf, len);
+	}
+
+	/* The rest of every sector */
+	for(off=0; off<size && blank; off+=len)
+	{
+		len = size - off > sizeof(buf) ? sizeof(buf) : size - off;
+		if( off % s_sector_size == 0 )
+			continue;
+		SPI_FLASH_DoRead(addr + off, (uint8_t *)buf, len);
+		s_stats.blank_bytes += len;
+		blank = SPI_FLASH_BufBlank((uint8_t *)buf, len);
+	}
+
+	s_stats.blank_cycles += DWT->CYCCNT - cycles;
+	return blank;
+}
+
+/* Description:  Erase all the sectors which cover [addr, addr+size), issuing the
+ *               planned erase commands back to back and polling BUSY between them.
+ *               A step already blank is skipped, an erased one is verified right away
+ *               when erase verification is on, so the caller's SPI_FLASH_AutoVerify()
+ *               does not read the range a second time.
+ * Return:       0 on success, -1 if an erased step does not read blank, -2 illegal
+ *               address, -3 timeout.
+ */
+static int SPI_FLASH_DoEraseRange(uint32_t addr, uint32_t size)
+{
+	struct flash_erase_op	op;
+	uint8_t					buf[5];
+	uint32_t				start, end;
+	uint32_t				t0;
+	int						bytes;
+	int						rv;
+
+	if( size == 0 )
+		return 0;
+
+	if( addr + size > s_flash_size )
+		return -2;
+
+	end = addr + size;
+	addr = addr / s_sector_size * s_sector_size;
+	end = (end + s_sector_size - 1) / s_sector_size * s_sector_size;
+	start = addr;
+
+	/* Data written before an erase of the same range is lost anyway */
+	SPI_FLASH_WcDiscard(addr, end - addr);
+	SPI_FLASH_CacheInvalidate(addr, end - addr);
+
+	if( (rv = SPI1_FLASH_WaitEnd(s_flash.ce_max_ms)) < 0 )
+		return rv;
+
+	while( addr < end )
+	{
+		SPI_FLASH_EraseStep(addr, end, &op);
+
+		/* Reading is much faster than erasing, sparse images leave many blank sectors */
+		if( SPI_FLASH_IsBlank(op.addr, op.size) )
+		{
+			s_stats.erase_skipped++;
+			addr += op.size;
+			continue;
+		}
+		SPI_FLASH_StatErase(op.addr, op.size);
+
+		if( (rv = SPI1_FLASH_WriteEnable()) < 0 )
+			return rv;
+		t0 = SPI_FLASH_TRACE_BEGIN();
+		cs_low();
+		bytes = SPI_FLASH_CmdAddr(buf, op.cmd, op.addr);
+		SPI_FLASH_Xfer(buf, NULL, bytes);
+		cs_high();
+		rv = SPI1_FLASH_WaitEnd(op.timeout);
+		SPI_FLASH_TRACE(op.cmd, op.addr, op.size, t0);
+		if( rv < 0 )
+			return rv;
+
+		if( s_verify[SPI_FLASH_OP_ERASE] != SPI_FLASH_VERIFY_OFF &&
+			SPI_FLASH_DoVerify(op.addr, NULL, op.size, s_verify[SPI_FLASH_OP_ERASE]) < 0 )
+			return -1;
+
+		addr += op.size;
+	}
+
+	s_erased_addr = start;
+	s_erased_end = end;
+
+	return 0;
+}
+
+int SPI_FLASH_EraseRange(uint32_t addr, uint32_t size)
+{
+	int					rv;
+
+	flash_job_pause();
+	rv = SPI_FLASH_DoEraseRange(addr, size);
+	flash_job_resume();
+
+	return rv;
+}
+
 /* Description:  Erase the block which is between first and last. */
 int SPI_Flash_BlockErase(uint32_t addr, uint32_t size) {
-    uint32_t block, first, last;
-    uint32_t address;
-    uint8_t buf[4];
-    int bytes = 0;
+    uint32_t first, last;
+    int rv;
 
     /* Find the first and last block that need to be erased */
     first = addr / Block_Size;
     last = (addr + size - 1) / Block_Size;
-   printf("Norflash Erase %ld Bytes Block@0x%lx Begin...\r\n", size, addr);
-    for (block = first; block <= last; block++) {
-        address = block * Block_Size;
-       printf("Norflash Erase Block@%lx ...\r\n", address);
-
-        SPI1_FLASH_WriteEnable();
-        cs_low();
-        buf[bytes++] = 0x20;  // Block Erase Instruction
-        buf[bytes++] = (address & 0xFF0000) >> 16;
-        buf[bytes++] = (address & 0xFF00) >> 8;
-        buf[bytes++] = (address & 0xFF);
-        SPI_FLASH_Xfer(buf, NULL, bytes);
-        cs_high();
-        SPI1_FLASH_WaitEnd();
-        HAL_Delay(100);
-
+    rv = SPI_FLASH_EraseRange(first * Block_Size, (last - first + 1) * Block_Size);
+    if( rv == -2 )
+    {
+    	printf("The address is not legal.\n");
+    	return rv;
+    }
+    else if( rv < 0 )
+    {
+    	printf("BlockErase timeout\n");
+    	return rv;
     }
 
-    printf("Norflash EraseBlock@0x%lx done.\r\n", addr);
-   int rv = SPI_FLASH_VerifyErase( 0x00000, Page_Size );
+   rv = SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, first * Block_Size, NULL, (last - first + 1) * Block_Size);
         if (rv == -1 )
         {
         	printf("BlockErase failed\n");
@@ -125,40 +663,126 @@ int SPI_Flash_BlockErase(uint32_t addr, uint32_t size) {
         	printf("The address is not legal.\n");
         	return -2;
         }
-        printf("BlockErase okey\n");
         return 0;
+}
 
-    return 0;
+/* Description:  Return 1 if the buffers are equal, comparing a word at a time.
+ *               flash is the word aligned read-back buffer.
+ */
+static int SPI_FLASH_BufEqual(const uint32_t *flash, const uint8_t *data, uint32_t len)
+{
+	uint32_t				word;
+	uint32_t				i;
+
+	for(i=0; i+sizeof(word)<=len; i+=sizeof(word))
+	{
+		memcpy(&word, data+i, sizeof(word));
+		if( word != flash[i / sizeof(word)] )
+			return 0;
+	}
+
+	return memcmp((const uint8_t *)flash + i, data + i, len - i) == 0;
+}
+
+/* Description:  Stream [addr, addr+length) back in Verify_Chunk_Size reads and check it
+ *               holds data, or is blank if data is NULL. SPI_FLASH_VERIFY_COMPARE stops
+ *               at the first mismatching chunk, SPI_FLASH_VERIFY_HASH compares the CRC32
+ *               of the read-back with the one of the expected content at the end.
+ * Return:       0 on match, -1 on mismatch, -2 if the range is out of the flash.
+ */
+static int SPI_FLASH_DoVerify(uint32_t addr, const uint8_t *data, uint32_t length, int mode)
+{
+	uint32_t				crc_flash = 0xFFFFFFFF;
+	uint32_t				crc_data = 0xFFFFFFFF;
+	uint32_t				len;
+
+	if( addr + length > s_flash_size )
+		return -2;
+
+	while( length > 0 )
+	{
+		len = length > sizeof(s_verify_buf) ? sizeof(s_verify_buf) : length;
+		SPI_FLASH_DoRead(addr, (uint8_t *)s_verify_buf, len);
+
+		if( mode == SPI_FLASH_VERIFY_HASH )
+		{
+			crc_flash = lfs_crc(crc_flash, s_verify_buf, len);
+			if( data )
+			{
+				crc_data = lfs_crc(crc_data, data, len);
+			}
+			else
+			{
+				/* The chunk is no longer needed, hash the blank pattern from it */
+				memset(s_verify_buf, 0xFF, len);
+				crc_data = lfs_crc(crc_data, s_verify_buf, len);
+			}
+		}
+		else if( data ? !SPI_FLASH_BufEqual(s_verify_buf, data, len)
+					  : !SPI_FLASH_BufBlank((uint8_t *)s_verify_buf, len) )
+		{
+			return -1;
+		}
+
+		addr += len;
+		length -= len;
+		if( data )
+			data += len;
+	}
+
+	return crc_flash == crc_data ? 0 : -1;
 }
 
 int SPI_FLASH_VerifyErase(uint32_t addr, uint32_t length)
 {
-    uint8_t buffer[256];
-    uint32_t bytesRead;
-    uint32_t toRead;
+	int					rv;
 
-    if(addr + length > Flash_Size )
-    {
-    	return -2;
-    }
-    for (bytesRead = 0; bytesRead < length; bytesRead += sizeof(buffer))
-    {
-        toRead = sizeof(buffer);
-        if (bytesRead + toRead > length)
-        {
-            toRead = length - bytesRead;
-        }
-        New_SPI_FLASH_BufferRead(addr + bytesRead, buffer, toRead);
+	flash_job_pause();
+	rv = SPI_FLASH_DoVerify(addr, NULL, length, SPI_FLASH_VERIFY_COMPARE);
+	flash_job_resume();
 
-        for (uint32_t i = 0; i < toRead; i++)
-        {
-            if (buffer[i] != 0xFF)
-            {
-                return -1;
-            }
-        }
-    }
-    return 0;
+	return rv;
+}
+
+int SPI_FLASH_VerifyProgram(uint32_t addr, const uint8_t *data, uint32_t length)
+{
+	int					rv;
+
+	flash_job_pause();
+	rv = SPI_FLASH_DoVerify(addr, data, length, SPI_FLASH_VERIFY_COMPARE);
+	flash_job_resume();
+
+	return rv;
+}
+
+/* Description:  Verify what the last op wrote with the mode set for that op type,
+ *               data is NULL for an erase. Return 0 when verification is off.
+ */
+int SPI_FLASH_AutoVerify(int op, uint32_t addr, const uint8_t *data, uint32_t length)
+{
+	int					rv;
+
+	if( op < 0 || op >= SPI_FLASH_OP_MAX || s_verify[op] == SPI_FLASH_VERIFY_OFF )
+		return 0;
+
+	/* Checked by SPI_FLASH_DoEraseRange() while erasing */
+	if( op == SPI_FLASH_OP_ERASE && addr >= s_erased_addr && addr + length <= s_erased_end )
+	{
+		s_erased_addr = s_erased_end = 0;
+		return 0;
+	}
+
+	flash_job_pause();
+	rv = SPI_FLASH_DoVerify(addr, data, length, s_verify[op]);
+	flash_job_resume();
+
+	return rv;
+}
+
+void SPI_FLASH_SetVerify(int op, int mode)
+{
+	if( op >= 0 && op < SPI_FLASH_OP_MAX )
+		s_verify[op] = mode;
 }
 
 uint8_t SPI_FLASH_ReadStatusRegister(void)
@@ -173,55 +797,54 @@ uint8_t SPI_FLASH_ReadStatusRegister(void)
 	return status;
 }
 
-void SPI_FLASH_WaitUntilNotBusy(void)
+/* Description:  Read Status Register-2, SUS (S15) tells an erase/program is suspended */
+uint8_t SPI_FLASH_ReadStatusRegister2(void)
 {
 	uint8_t			status;
-	do
-	{
-		status = SPI_FLASH_ReadStatusRegister();
-	}while(status & 0x01);
+
+	cs_low();
+	SPI_FLASH_SendByte(0x35);
+	status = SPI_FLASH_SendByte(0xFF);
+	cs_high();
+	return status;
+}
+
+int SPI_FLASH_WaitUntilNotBusy(uint32_t timeout)
+{
+	int					rv;
+
+	flash_job_pause();
+	rv = SPI1_FLASH_WaitEnd(timeout);
+	flash_job_resume();
+
+	return rv;
 }
 
 /* Descriptions : Erase the Sectors which is between first and last */
 int New_SPI_FLASH_SectorErase(uint32_t addr, uint32_t size)
 {
-    uint32_t sector, first, last;
-    uint32_t address;
     int rv;
 
-    first = addr / Sector_Size;
-    last = (addr + size - 1) / Sector_Size;
-
-    /* Start to erase all sectors */
-    for (sector = first; sector <= last; sector++)
+    rv = SPI_FLASH_EraseRange(addr, size);
+    if (rv == -2)
     {
-        address = sector * Sector_Size;
-        //printf("Norflash Erase Sector@%lx ...\r\n", address);
-
-        SPI1_FLASH_WaitEnd();
-        SPI1_FLASH_WriteEnable();
-        cs_low();
-        SPI_FLASH_SendByte(0x20);
-
-        SPI_FLASH_SendByte((address & 0xFF0000) >> 16);
-        SPI_FLASH_SendByte((address & 0xFF00) >> 8);
-        SPI_FLASH_SendByte(address & 0xFF);
-        cs_high();
-
-        SPI1_FLASH_WaitEnd();
-        HAL_Delay(10);
+        printf("The address is not legal.\n");
+        return rv;
+    }
+    else if (rv < 0)
+    {
+        printf("Erase the sector timeout\n");
+        return rv;
     }
 
-    rv = SPI_FLASH_VerifyErase(addr, size);
+    /* Check the whole sectors erased, not only the requested bytes */
+    rv = SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, addr / s_sector_size * s_sector_size,
+    		NULL, (addr % s_sector_size + size + s_sector_size - 1) / s_sector_size * s_sector_size);
     if (rv != 0)
     {
         printf("Erase the sector error\n");
         return -1;
     }
-    else
-    {
-        printf("Erase ok\n");
-    }
 
     return 0;
 }
@@ -251,88 +874,374 @@ uint8_t SPI_FLASH_SendByte(uint8_t byte)
 	 return r_data;
 }
 
-void SPI_FLASH_Xfer(uint8_t *snd_buf, uint8_t *recv_buf, int bytes)
+/* Description:  SPI1 DMA completion, set by the HAL callbacks from DMA/SPI interrupt.
+ *               A transfer started with a done callback reports there instead.
+ */
+static volatile uint8_t		s_spi1_dma_done;
+static volatile uint8_t		s_spi1_dma_error;
+static void				  (*s_spi1_dma_cb)(int status);
+
+static void SPI_FLASH_DmaComplete(int status)
 {
-	int 		i;
-	uint8_t		send_data, recv_data;
-	for(i = 0; i < bytes; i ++)
+	void				  (*cb)(int status) = s_spi1_dma_cb;
+
+	if( cb != NULL )
 	{
-		send_data = (snd_buf != NULL) ? snd_buf[i] : 0xFF;
+		s_spi1_dma_cb = NULL;
+		cb(status);
+		return;
+	}
 
-		recv_data = SPI_FLASH_SendByte(send_data);
+	s_spi1_dma_error = status < 0;
+	s_spi1_dma_done = 1;
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if( hspi->Instance == SPI1 )
+		SPI_FLASH_DmaComplete(0);
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if( hspi->Instance == SPI1 )
+		SPI_FLASH_DmaComplete(0);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if( hspi->Instance == SPI1 )
+		SPI_FLASH_DmaComplete(0);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	if( hspi->Instance == SPI1 )
+		SPI_FLASH_DmaComplete(-1);
+}
+
+/* Description:  Start one DMA chunk on SPI1 without waiting for it. A NULL snd_buf sends
+ *               0xFF, a NULL recv_buf drops the received data. done is called from the
+ *               DMA/SPI interrupt when the chunk finishes, NULL to wait on s_spi1_dma_done.
+ */
+int SPI_FLASH_XferStart(uint8_t *snd_buf, uint8_t *recv_buf, uint16_t bytes, void (*done)(int status))
+{
+	HAL_StatusTypeDef			status;
 
-		if( recv_buf != NULL )
+	s_spi1_dma_done = 0;
+	s_spi1_dma_error = 0;
+	s_spi1_dma_cb = done;
+
+	if( snd_buf != NULL && recv_buf != NULL )
+	{
+		status = HAL_SPI_TransmitReceive_DMA(&hspi1, snd_buf, recv_buf, bytes);
+	}
+	else if( snd_buf != NULL )
+	{
+		status = HAL_SPI_Transmit_DMA(&hspi1, snd_buf, bytes);
+	}
+	else
+	{
+		/* Full-duplex master receive clocks out the receive buffer itself */
+		memset(recv_buf, Dummy_Byte, bytes);
+		status = HAL_SPI_Receive_DMA(&hspi1, recv_buf, bytes);
+	}
+
+	if( status != HAL_OK )
+	{
+		s_spi1_dma_cb = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Description:  Start one DMA chunk on SPI1 and wait for the completion interrupt. */
+static int SPI_FLASH_DmaXfer(uint8_t *snd_buf, uint8_t *recv_buf, uint16_t bytes)
+{
+	uint32_t					tickstart;
+
+	if( SPI_FLASH_XferStart(snd_buf, recv_buf, bytes, NULL) < 0 )
+	{
+		printf("SPI DMA start failure\n");
+		return -1;
+	}
+
+	tickstart = HAL_GetTick();
+	while( !s_spi1_dma_done )
+	{
+		if( HAL_GetTick() - tickstart > SPI_TIMEOUT )
 		{
-			recv_buf[i] = recv_data;
+			HAL_SPI_Abort(&hspi1);
+			printf("SPI DMA transmission timeout!\n");
+			return -3;
 		}
-	//	printf("Sending: 0x%02X, Received: 0x%02X\n", send_data, recv_data);
+	}
+
+	if( s_spi1_dma_error )
+	{
+		printf("SPI DMA transmission error: 0x%lx\n", (unsigned long)hspi1.ErrorCode);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Description:  Transfer a buffer on SPI1, short transfers are polled in one HAL call and
+ *               longer ones go through DMA in chunks of at most SPI_DMA_MAX_CHUNK bytes.
+ */
+int SPI_FLASH_Xfer(uint8_t *snd_buf, uint8_t *recv_buf, int bytes)
+{
+	static uint8_t		dummy_tx[SPI_DMA_THRESHOLD];
+	static uint8_t		dummy_rx[SPI_DMA_THRESHOLD];
+	HAL_StatusTypeDef	status;
+	uint16_t			chunk;
+	int					rv = 0;
 
+	if( bytes <= 0 )
+		return 0;
+
+	if( bytes < SPI_DMA_THRESHOLD )
+	{
+		if( snd_buf == NULL )
+		{
+			memset(dummy_tx, Dummy_Byte, bytes);
+		}
 
+		status = HAL_SPI_TransmitReceive(&hspi1, snd_buf ? snd_buf : dummy_tx,
+				recv_buf ? recv_buf : dummy_rx, bytes, SPI_TIMEOUT);
+		if( status != HAL_OK )
+		{
+			printf("SPI transmission failure: %d\n", status);
+			rv = -1;
+		}
 	}
+	else
+	{
+		while( bytes > 0 )
+		{
+			chunk = bytes > SPI_DMA_MAX_CHUNK ? SPI_DMA_MAX_CHUNK : bytes;
 
-	HAL_Delay(1);
+			rv = SPI_FLASH_DmaXfer(snd_buf, recv_buf, chunk);
+			if( rv < 0 )
+				break;
 
+			if( snd_buf != NULL )
+				snd_buf += chunk;
+			if( recv_buf != NULL )
+				recv_buf += chunk;
+			bytes -= chunk;
+		}
+	}
 
+	return rv;
 }
 
 /* page program */
-int New_SPI_FLASH_PageWrite( uint8_t *data, uint32_t addr, uint32_t size)
+static int SPI_FLASH_DoPageWrite( uint8_t *data, uint32_t addr, uint32_t size)
 {
 	uint32_t			first, last, page;
-	uint32_t			address, ofset, len;
-	uint8_t				buf[Page_Size+5];
+	uint32_t			ofset, len;
+	uint32_t			t0;
+	uint8_t				buf[SPI_FLASH_CMD_MAX];
 	int					bytes = 0;
+	int					rv;
 
-	if( addr + size > 0x400000 )
+	if( addr + size > s_flash_size )
 		return -1;
 
 
 	/* find the fist and the last page */
-	first = addr / Page_Size;
-	last = ( addr + size - 1 ) / Page_Size;
+	first = addr / s_flash.page_size;
+	last = ( addr + size - 1 ) / s_flash.page_size;
 	//printf("Norflash Write %ld Bytes to addr@0x%06X Begin...\r\n", size, addr );
 
-	/*Initial  address in page and offset in buffer */
-	address = addr;
+	/*Initial offset in buffer */
 	ofset = 0;
 
 	/* Start to write to all pages */
 	for( page = first; page <= last; page ++)
 	{
-		len = Page_Size - ( address % Page_Size );
+		len = s_flash.page_size - ( addr % s_flash.page_size );
 		len = len > size ? size : len;
-		bytes = 0;
 		//printf("Norflash write addr@0x%lx, %lu bytes,and the data is %s \r\n", addr, len, data);
 
+		/* Programming 0xFF leaves the erased cells as they are */
+		if( SPI_FLASH_BufBlank(data+ofset, len) )
+		{
+			s_stats.prog_skipped++;
+			addr  += len;
+			ofset += len;
+			size  -= len;
+			continue;
+		}
+		SPI_FLASH_StatProg(len);
 
-		buf[bytes++] = 0x02;
-		buf[bytes++] = (addr & 0xFF0000) >> 16 ;
-		buf[bytes++] = (addr & 0xFF00) >> 8 ;
-		buf[bytes++] = (addr & 0xFF);
+		bytes = SPI_FLASH_CmdAddr(buf, 0x02, addr);
 
-		/* send command and data */
-		memcpy(&buf[bytes], data+ofset, len);
-		bytes += len;
-		SPI1_FLASH_WriteEnable();
+		/* send command and data, the data goes out straight from the caller's buffer */
+		if( (rv = SPI1_FLASH_WriteEnable()) < 0 )
+			return rv;
+		t0 = SPI_FLASH_TRACE_BEGIN();
 		cs_low();
 
 		SPI_FLASH_Xfer(buf, NULL, bytes);
+		SPI_FLASH_Xfer(data+ofset, NULL, len);
 
 		cs_high();
 
-		SPI1_FLASH_WaitEnd();
+		rv = SPI1_FLASH_WaitEnd(s_flash.pp_max_ms);
+		SPI_FLASH_TRACE(0x02, addr, len, t0);
+		if( rv < 0 )
+			return rv;
 		addr  += len;
 		ofset += len;
 		size  -= len;
 
 	}
 
-	HAL_Delay(10);
-	printf("Norflash WriteByte@0x%06X done.\r\n", addr + size );
 	return 0;
 
 }
 
+/* Description:  Program and check the result with the verification mode of programs */
+static int SPI_FLASH_DoProgram(uint8_t *data, uint32_t addr, uint32_t size)
+{
+	int					rv;
+
+	rv = SPI_FLASH_DoPageWrite(data, addr, size);
+	if( rv == 0 && s_verify[SPI_FLASH_OP_PROGRAM] != SPI_FLASH_VERIFY_OFF )
+		rv = SPI_FLASH_DoVerify(addr, data, size, s_verify[SPI_FLASH_OP_PROGRAM]);
+
+	return rv;
+}
+
+/* Description:  Program policies of SPI_FLASH_DoProgram() for the pages of the job
+ *               engine: return 1 and count the page as skipped if data is all 0xFF.
+ */
+int SPI_FLASH_ProgSkip(const uint8_t *data, uint32_t len)
+{
+	if( !SPI_FLASH_BufBlank(data, len) )
+		return 0;
+
+	s_stats.prog_skipped++;
+	return 1;
+}
+
+/* Description:  Check a finished program job with the verification mode of programs,
+ *               the job engine owns the bus. Return 0 when verification is off.
+ */
+int SPI_FLASH_ProgVerify(uint32_t addr, const uint8_t *data, uint32_t len)
+{
+	if( s_verify[SPI_FLASH_OP_PROGRAM] == SPI_FLASH_VERIFY_OFF )
+		return 0;
+
+	return SPI_FLASH_DoVerify(addr, data, len, s_verify[SPI_FLASH_OP_PROGRAM]);
+}
+
+/* Description:  Program the write-combining buffer and empty it */
+static int SPI_FLASH_WcFlush(void)
+{
+	uint32_t			lo = s_wc_lo;
+	uint32_t			hi = s_wc_hi;
+
+	if( lo == hi )
+		return 0;
+
+	/* Empty it first, so the read-back of the verification is not patched */
+	s_wc_lo = s_wc_hi = 0;
+
+	return SPI_FLASH_DoProgram(s_wc_buf + lo, s_wc_addr + lo, hi - lo);
+}
+
+/* Description:  Whole pages are programmed at once, the partial ones are collected in
+ *               the write-combining buffer until the page is full, a write which does
+ *               not continue it arrives, SPI_FLASH_WriteFlush() or WC_TIMEOUT_MS.
+ *               An error of a deferred program is returned by the call which flushes it.
+ */
+int New_SPI_FLASH_PageWrite( uint8_t *data, uint32_t addr, uint32_t size)
+{
+	uint32_t			page_size = s_flash.page_size;
+	uint32_t			ofset, len;
+	int					rv = 0;
+
+	if( addr + size > s_flash_size )
+		return -1;
+
+	flash_job_pause();
+	SPI_FLASH_CacheInvalidate(addr, size);
+
+	if( s_wc_lo != s_wc_hi &&
+		(addr != s_wc_addr + s_wc_hi || HAL_GetTick() - s_wc_tick > WC_TIMEOUT_MS) )
+		rv = SPI_FLASH_WcFlush();
+
+	while( size > 0 && rv == 0 )
+	{
+		ofset = addr % page_size;
+
+		if( s_wc_lo == s_wc_hi && ofset == 0 && size >= page_size )
+		{
+			len = size / page_size * page_size;
+			rv = SPI_FLASH_DoProgram(data, addr, len);
+		}
+		else
+		{
+			if( s_wc_lo == s_wc_hi )
+			{
+				s_wc_addr = addr - ofset;
+				s_wc_lo = s_wc_hi = ofset;
+			}
+			else
+			{
+				s_stats.prog_combined++;
+			}
+
+			len = page_size - ofset;
+			len = len > size ? size : len;
+			memcpy(s_wc_buf + ofset, data, len);
+			s_wc_hi += len;
+			s_wc_tick = HAL_GetTick();
+
+			if( s_wc_hi == page_size )
+				rv = SPI_FLASH_WcFlush();
+		}
+
+		data += len;
+		addr += len;
+		size -= len;
+	}
+
+	flash_job_resume();
+
+	return rv;
+}
+
+int SPI_FLASH_WriteFlush(void)
+{
+	int					rv;
+
+	if( s_wc_lo == s_wc_hi )
+		return 0;
+
+	flash_job_pause();
+	rv = SPI_FLASH_WcFlush();
+	flash_job_resume();
+
+	return rv;
+}
+
+/* Description:  Program a write-combining buffer left alone for WC_TIMEOUT_MS,
+ *               called from the idle loops.
+ */
+void SPI_FLASH_WritePoll(void)
+{
+	if( s_wc_lo == s_wc_hi || HAL_GetTick() - s_wc_tick <= WC_TIMEOUT_MS )
+		return;
+
+	if( SPI_FLASH_WriteFlush() < 0 )
+		printf("Norflash deferred write@0x%lx failed\r\n", (unsigned long)s_wc_addr);
+}
+
 /* Read flash'ID */
 uint32_t SPI_FLASH_ReadId(void)
 {
@@ -359,20 +1268,369 @@ uint32_t SPI_FLASH_ReadId(void)
 	    return id;
 }
 
-void New_SPI_FLASH_BufferRead(uint32_t addr, uint8_t *buffer, uint32_t size)
+/* Description:  Fast Read (0x0B) followed by the dummy clocks the part asks for, which
+ *               is not limited to the low clock rate of the legacy 0x03 Read Data command.
+ */
+static void SPI_FLASH_DoRead(uint32_t addr, uint8_t *buffer, uint32_t size)
 {
-    uint8_t cmd[4];
+    uint8_t cmd[SPI_FLASH_CMD_MAX];
+    int bytes;
+    uint32_t t0 = SPI_FLASH_TRACE_BEGIN();
 
-    cmd[0] = 0x03; // Read Data command
-    cmd[1] = (addr >> 16) & 0xFF;
-    cmd[2] = (addr >> 8) & 0xFF;
-    cmd[3] = addr & 0xFF;
+    bytes = SPI_FLASH_ReadCmd(cmd, addr);
 
     cs_low();
-    SPI_FLASH_Xfer(cmd, NULL, 4);
+    SPI_FLASH_Xfer(cmd, NULL, bytes);
     SPI_FLASH_Xfer(NULL, buffer, size);
     cs_high();
+    SPI_FLASH_TRACE(cmd[0], addr, size, t0);
+    s_stats.bytes_read += size;
+
+    /* Show what the flash will hold once the write-combining buffer is programmed */
+    if( s_wc_lo != s_wc_hi && addr < s_wc_addr + s_wc_hi && s_wc_addr + s_wc_lo < addr + size )
+    {
+    	uint32_t from = addr > s_wc_addr + s_wc_lo ? addr : s_wc_addr + s_wc_lo;
+    	uint32_t to = addr + size < s_wc_addr + s_wc_hi ? addr + size : s_wc_addr + s_wc_hi;
+
+    	for( ; from < to; from++)
+    		buffer[from - addr] &= s_wc_buf[from - s_wc_addr];
+    }
+}
+
+/* Description:  Drop the cached pages which overlap [addr, addr+size), called before
+ *               anything programs or erases the flash.
+ */
+void SPI_FLASH_CacheInvalidate(uint32_t addr, uint32_t size)
+{
+	uint32_t			first = addr / s_flash.page_size;
+	uint32_t			last = (addr + size - 1) / s_flash.page_size;
+	int					set, way;
+
+	if( size == 0 )
+		return;
+
+	if( addr < s_erased_end && addr + size > s_erased_addr )
+		s_erased_addr = s_erased_end = 0;
+
+	for(set=0; set<FLASH_CACHE_SETS; set++)
+	{
+		for(way=0; way<FLASH_CACHE_WAYS; way++)
+		{
+			if( s_cache[set][way].page >= first && s_cache[set][way].page <= last )
+				s_cache[set][way].valid = 0;
+		}
+	}
+}
+
+/* Description:  Return the cache line of the page, reading it from the flash on a miss */
+static uint8_t *SPI_FLASH_CacheLookup(uint32_t page)
+{
+	struct flash_cache_line	   *line = s_cache[page % FLASH_CACHE_SETS];
+	int							set = page % FLASH_CACHE_SETS;
+	int							way, victim = 0;
+
+	for(way=0; way<FLASH_CACHE_WAYS; way++)
+	{
+		if( line[way].valid && line[way].page == page )
+		{
+			s_stats.cache_hits++;
+			line[way].stamp = ++s_cache_clock;
+			return s_cache_data[set][way];
+		}
+
+		if( !line[way].valid || (line[victim].valid && line[way].stamp < line[victim].stamp) )
+			victim = way;
+	}
+
+	s_stats.cache_misses++;
+	SPI_FLASH_DoRead(page * s_flash.page_size, s_cache_data[set][victim], s_flash.page_size);
+	line[victim].page = page;
+	line[victim].stamp = ++s_cache_clock;
+	line[victim].valid = 1;
+
+	return s_cache_data[set][victim];
+}
+
+void New_SPI_FLASH_BufferRead(uint32_t addr, uint8_t *buffer, uint32_t size)
+{
+    uint32_t ofset, len;
+
+    /* A background erase/program outside this range is suspended instead of waited */
+    flash_job_pause_read(addr, size);
+
+    if( size > FLASH_CACHE_BYPASS )
+    {
+    	s_stats.cache_bypass++;
+    	SPI_FLASH_DoRead(addr, buffer, size);
+    }
+
+    while( size > 0 && size <= FLASH_CACHE_BYPASS )
+    {
+    	ofset = addr % s_flash.page_size;
+    	len = s_flash.page_size - ofset;
+    	len = len > size ? size : len;
+
+    	memcpy(buffer, SPI_FLASH_CacheLookup(addr / s_flash.page_size) + ofset, len);
+    	addr += len;
+    	buffer += len;
+    	size -= len;
+    }
+
+    flash_job_resume();
+}
+
+/* Description:  Counters of the erase/program commands sent and elided */
+const struct spi_flash_stats *SPI_FLASH_GetStats(void)
+{
+	return &s_stats;
+}
+
+void SPI_FLASH_ResetStats(void)
+{
+	memset(&s_stats, 0, sizeof(s_stats));
+}
+
+/* Description:  Count an erase command of [addr, addr+size), a chip erase counts for
+ *               every block.
+ */
+void SPI_FLASH_StatErase(uint32_t addr, uint32_t size)
+{
+	uint32_t			block;
+	int					i;
+
+	if( addr == 0 && size == s_flash_size )
+	{
+		s_stats.chip_erases++;
+	}
+	else
+	{
+		s_stats.erase_issued++;
+		for(i=0; i<FLASH_ERASE_TYPES; i++)
+		{
+			if( s_flash.erase[i].size == size )
+				s_stats.erase_by_type[i]++;
+		}
+	}
+
+	for(block=addr/Block_Size; block<(addr+size+Block_Size-1)/Block_Size && block<SPI_FLASH_STAT_BLOCKS; block++)
+		s_stats.block_erases[block]++;
+}
+
+void SPI_FLASH_StatProg(uint32_t bytes)
+{
+	s_stats.prog_issued++;
+	s_stats.bytes_prog += bytes;
+}
+
+void SPI_FLASH_StatRead(uint32_t bytes)
+{
+	s_stats.bytes_read += bytes;
+}
+
+/* Description:  Add a BUSY wait of cycles CPU cycles to the log2 histogram, bucket n
+ *               counts the waits of [2^(n-1), 2^n) cycles.
+ */
+void SPI_FLASH_StatBusy(uint32_t cycles)
+{
+	int					bucket = cycles ? 32 - __builtin_clz(cycles) : 0;
+
+	if( bucket >= SPI_FLASH_BUSY_BUCKETS )
+		bucket = SPI_FLASH_BUSY_BUCKETS - 1;
+
+	s_stats.busy_hist[bucket]++;
+	s_stats.busy_cycles += cycles;
+}
+
+/* Description:  Print the counters on the console. SPI_FLASH_DUMP_BINARY sends the
+ *               "FLST" magic, the version and size of struct spi_flash_stats, the raw
+ *               little endian struct and its CRC16, for a host script to decode.
+ */
+void SPI_FLASH_DumpStats(int mode)
+{
+	uint32_t			hdr[2] = { SPI_FLASH_STATS_MAGIC, (SPI_FLASH_STATS_VERSION << 16) | sizeof(s_stats) };
+	uint16_t			crc;
+	uint32_t			block;
+	int					i;
+
+	if( mode == SPI_FLASH_DUMP_BINARY )
+	{
+		crc = crc16_checksum((unsigned char *)&s_stats, sizeof(s_stats));
+		fwrite(hdr, sizeof(hdr), 1, stdout);
+		fwrite(&s_stats, sizeof(s_stats), 1, stdout);
+		fwrite(&crc, sizeof(crc), 1, stdout);
+		fflush(stdout);
+		return;
+	}
+
+	printf("Norflash stats: read %lu B, programmed %lu B in %lu pages (%lu all-0xFF skipped, %lu combined)\r\n",
+			(unsigned long)s_stats.bytes_read, (unsigned long)s_stats.bytes_prog, (unsigned long)s_stats.prog_issued,
+			(unsigned long)s_stats.prog_skipped, (unsigned long)s_stats.prog_combined);
+	printf("  erases %lu (%lu blank skipped), chip erases %lu\r\n",
+			(unsigned long)s_stats.erase_issued, (unsigned long)s_stats.erase_skipped, (unsigned long)s_stats.chip_erases);
+	printf("  blank checks read %lu B in %lu ms\r\n",
+			(unsigned long)s_stats.blank_bytes, (unsigned long)(s_stats.blank_cycles / (SystemCoreClock / 1000)));
+	for(i=0; i<FLASH_ERASE_TYPES && s_flash.erase[i].size; i++)
+		printf("  %lu KB erases: %lu\r\n", (unsigned long)(s_flash.erase[i].size >> 10), (unsigned long)s_stats.erase_by_type[i]);
+	printf("  cache hits %lu, misses %lu, bypass %lu\r\n",
+			(unsigned long)s_stats.cache_hits, (unsigned long)s_stats.cache_misses, (unsigned long)s_stats.cache_bypass);
+
+	printf("  busy %lu ms, waits by cycles:\r\n", (unsigned long)(s_stats.busy_cycles / (SystemCoreClock / 1000)));
+	for(i=0; i<SPI_FLASH_BUSY_BUCKETS; i++)
+	{
+		if( s_stats.busy_hist[i] )
+			printf("    <2^%-2d %lu\r\n", i, (unsigned long)s_stats.busy_hist[i]);
+	}
+
+	/* Chip erases count for every block, only list the blocks erased on their own */
+	printf("  erases per 64KB block:");
+	for(block=0; block<SPI_FLASH_STAT_BLOCKS; block++)
+	{
+		if( s_stats.block_erases[block] > s_stats.chip_erases )
+			printf(" %lu:%u", (unsigned long)block, s_stats.block_erases[block]);
+	}
+	printf("\r\n");
+}
+
+/* Description:  Append a command to the trace ring, the oldest entry is overwritten
+ *               when it is full. Called from the job engine interrupts as well.
+ */
+#ifdef CONFIG_SPI_FLASH_TRACE
+void SPI_FLASH_TraceRecord(uint8_t opcode, uint32_t addr, uint32_t len, uint32_t start)
+{
+	struct spi_flash_trace	   *ent;
+	uint32_t					primask;
+
+	if( !s_trace_on )
+		return;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	ent = &s_trace[s_trace_head++ & (SPI_FLASH_TRACE_DEPTH - 1)];
+	__set_PRIMASK(primask);
+
+	ent->opcode = opcode;
+	ent->addr = addr;
+	ent->len = len;
+	ent->start = start;
+	ent->end = DWT->CYCCNT;
+}
+#endif
+
+void SPI_FLASH_TraceEnable(int on)
+{
+#ifdef CONFIG_SPI_FLASH_TRACE
+	s_trace_on = on ? 1 : 0;
+#endif
+}
+
+void SPI_FLASH_TraceReset(void)
+{
+#ifdef CONFIG_SPI_FLASH_TRACE
+	s_trace_head = 0;
+#endif
+}
+
+/* Description:  Send the trace ring on the console: the "FLTR" magic, the version and
+ *               size of struct spi_flash_trace, the ring depth, the number of entries
+ *               recorded since the reset, SystemCoreClock, then the raw little endian
+ *               ring and its CRC16. Entry (recorded % depth) is the oldest once the ring
+ *               has wrapped. Tests/host/tools/flash_trace decodes it into a timeline.
+ */
+void SPI_FLASH_DumpTrace(void)
+{
+#ifdef CONFIG_SPI_FLASH_TRACE
+	uint32_t			hdr[5] = { SPI_FLASH_TRACE_MAGIC, (SPI_FLASH_TRACE_VERSION << 16) | sizeof(struct spi_flash_trace),
+								   SPI_FLASH_TRACE_DEPTH, 0, 0 };
+	uint16_t			crc;
+	uint8_t				on = s_trace_on;
+
+	/* Printing goes through the UART only, but keep the job engine off the ring */
+	s_trace_on = 0;
+	hdr[3] = s_trace_head;
+	hdr[4] = SystemCoreClock;
+	crc = crc16_checksum((unsigned char *)s_trace, sizeof(s_trace));
+	fwrite(hdr, sizeof(hdr), 1, stdout);
+	fwrite(s_trace, sizeof(s_trace), 1, stdout);
+	fwrite(&crc, sizeof(crc), 1, stdout);
+	fflush(stdout);
+	s_trace_on = on;
+#else
+	printf("Norflash trace is not built in, define CONFIG_SPI_FLASH_TRACE\r\n");
+#endif
+}
+
+static void SPI_FLASH_SetPrescaler(uint32_t prescaler)
+{
+	__HAL_SPI_DISABLE(&hspi1);
+	MODIFY_REG(hspi1.Instance->CR1, SPI_CR1_BR, prescaler);
+	hspi1.Init.BaudRatePrescaler = prescaler;
+}
+
+/* Description:  Find the fastest prescaler which reads back the SFDP table and the first
+ *               page of the array exactly as they read at the power-on prescaler, each of
+ *               Calib_Rounds reads in a row, and run SPI1 Calib_Margin prescalers slower
+ *               than it: a board which only just passes when cold fails once warm. The
+ *               array is only compared when its page holds both 0 and 1 bits, a blank
+ *               page reads the same with a data line stuck high.
+ * Return     :  The selected prescaler.
+ */
+uint32_t SPI_FLASH_Calibrate(void)
+{
+	static const uint32_t	prescalers[] = {
+		SPI_BAUDRATEPRESCALER_2, SPI_BAUDRATEPRESCALER_4, SPI_BAUDRATEPRESCALER_8,
+		SPI_BAUDRATEPRESCALER_16, SPI_BAUDRATEPRESCALER_32, SPI_BAUDRATEPRESCALER_64,
+	};
+	uint8_t					ref_sfdp[Calib_Size], ref_data[Calib_Size];
+	uint8_t					buf[Calib_Size];
+	uint8_t					ones = 0x00, zeros = 0xFF;
+	uint32_t				safe = hspi1.Init.BaudRatePrescaler;
+	uint32_t				i, count = sizeof(prescalers)/sizeof(prescalers[0]);
+	int						round, use_data;
+
+	SPI_FLASH_ReadSfdp(0, ref_sfdp, sizeof(ref_sfdp));
+	/* Straight to the bus, a cached copy would hide read errors */
+	SPI_FLASH_DoRead(0, ref_data, sizeof(ref_data));
+	for(i=0; i<sizeof(ref_data); i++)
+	{
+		ones |= ref_data[i];
+		zeros &= ref_data[i];
+	}
+	use_data = ones != 0x00 && zeros != 0xFF;
+
+	for(i=0; i<count; i++)
+	{
+		if( prescalers[i] >= safe )
+			break;
+
+		SPI_FLASH_SetPrescaler(prescalers[i]);
+		for(round=0; round<Calib_Rounds; round++)
+		{
+			SPI_FLASH_ReadSfdp(0, buf, sizeof(buf));
+			if( memcmp(buf, ref_sfdp, sizeof(buf)) )
+				break;
+
+			if( !use_data )
+				continue;
+			SPI_FLASH_DoRead(0, buf, sizeof(buf));
+			if( memcmp(buf, ref_data, sizeof(buf)) )
+				break;
+		}
+
+		if( round == Calib_Rounds )
+			break;
+	}
+
+	/* Nothing faster than the power-on prescaler passed, or the margin reaches it */
+	if( i + Calib_Margin >= count || prescalers[i] >= safe || prescalers[i + Calib_Margin] >= safe )
+	{
+		SPI_FLASH_SetPrescaler(safe);
+		return safe;
+	}
 
+	i += Calib_Margin;
+	SPI_FLASH_SetPrescaler(prescalers[i]);
+	printf("Norflash SPI1 prescaler %lu selected\r\n", 2UL << (prescalers[i] >> 3));
+	return prescalers[i];
 }
 
 void test( void )
@@ -386,7 +1644,7 @@ void test( void )
 	if( rv != 0 )
 	{
 		printf("Write failed\n");
-	  	return -1;
+	  	return;
 	}
 	printf("write ok\n");
 
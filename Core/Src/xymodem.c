@@ -428,7 +428,9 @@ static int xy_await_header(struct xyz_ctxt *proto)
         return rc;
     proto->state = PROTO_STATE_NEGOCIATE_CRC;
     printf("header received, filename=%s, file length=%d\r\n", proto->filename, proto->file_len);
-    lfs_file_open(&lfs, &file, proto->filename, LFS_O_WRONLY | LFS_O_CREAT);
+    /* The length from the header lets littlefs keep the image in contiguous blocks */
+    lfs_port_file_open_size(&lfs, &file, proto->filename, LFS_O_WRONLY | LFS_O_CREAT,
+            proto->file_len > 0 ? proto->file_len : 0);
     if ( !proto->filename[0] )
         proto->state = PROTO_STATE_FINISHED_XFER;
 
@@ -525,7 +527,6 @@ int xymodem_handle(struct xyz_ctxt *proto)
                 blk.buf[xfer_max] = '\0';
                 printf(">>>File contains %d bytes: %s\n", xfer_max, blk.buf);
                 lfs_file_write(&lfs, &file, blk.buf, xfer_max);
-                lfs_sync(&lfs);
                 //rc = write(proto->fd, blk.buf, xfer_max);
                 proto->next_blk = ((blk.seq + 1) % 256);
                 proto->nb_received += rc;
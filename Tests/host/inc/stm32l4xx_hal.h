@@ -0,0 +1,141 @@
+/*
+ * stm32l4xx_hal.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Host stand-in for the STM32L4 HAL: only the types, macros and calls the
+ *  flash driver, the job engine and the littlefs port use. The calls are
+ *  implemented by sim/hal_sim.c on top of the simulated NOR parts.
+ */
+
+#ifndef STM32L4XX_HAL_H_
+#define STM32L4XX_HAL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef enum
+{
+	HAL_OK,
+	HAL_ERROR,
+	HAL_BUSY,
+	HAL_TIMEOUT,
+} HAL_StatusTypeDef;
+
+typedef struct
+{
+	volatile uint32_t	CR1;
+	volatile uint32_t	CR2;
+	volatile uint32_t	SR;
+	volatile uint32_t	DR;
+} SPI_TypeDef;
+
+typedef struct
+{
+	uint32_t			Mode;
+	uint32_t			BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct
+{
+	SPI_TypeDef		   *Instance;
+	SPI_InitTypeDef		Init;
+	volatile uint32_t	ErrorCode;
+	void			   *hdmatx;
+	void			   *hdmarx;
+} SPI_HandleTypeDef;
+
+typedef struct
+{
+	void			   *Instance;
+} DMA_HandleTypeDef;
+
+typedef struct
+{
+	void			   *Instance;
+} UART_HandleTypeDef;
+
+typedef struct
+{
+	volatile uint32_t	ODR;
+} GPIO_TypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET,
+} GPIO_PinState;
+
+/* The DWT cycle counter follows the simulated time at SystemCoreClock */
+typedef struct
+{
+	volatile uint32_t	CTRL;
+	volatile uint32_t	CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+	volatile uint32_t	DEMCR;
+} CoreDebug_Type;
+
+extern SPI_TypeDef	   *SPI1;
+extern SPI_TypeDef	   *SPI3;
+extern GPIO_TypeDef	   *GPIOA;
+extern DWT_Type		   *DWT;
+extern CoreDebug_Type  *CoreDebug;
+extern uint32_t			SystemCoreClock;
+
+#define RESET						0
+#define SET							1
+
+#define GPIO_PIN_4					((uint16_t)0x0010)
+#define GPIO_PIN_15					((uint16_t)0x8000)
+
+#define DWT_CTRL_CYCCNTENA_Msk		(1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk	(1UL << 24)
+
+#define SPI_CR1_BR					0x38
+#define SPI_BAUDRATEPRESCALER_2		0x00
+#define SPI_BAUDRATEPRESCALER_4		0x08
+#define SPI_BAUDRATEPRESCALER_8		0x10
+#define SPI_BAUDRATEPRESCALER_16	0x18
+#define SPI_BAUDRATEPRESCALER_32	0x20
+#define SPI_BAUDRATEPRESCALER_64	0x28
+#define SPI_BAUDRATEPRESCALER_128	0x30
+#define SPI_BAUDRATEPRESCALER_256	0x38
+
+#define MODIFY_REG(REG, CLEARMASK, SETMASK)	((REG) = (((REG) & ~(CLEARMASK)) | (SETMASK)))
+#define __HAL_SPI_ENABLE(h)			((void)(h))
+#define __HAL_SPI_DISABLE(h)		((void)(h))
+#define __NOP()						((void)0)
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state);
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi);
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *tx, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *rx, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *tx, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *rx, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size);
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi);
+
+/* Completion callbacks, defined by the driver */
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+
+/* PRIMASK only holds back the simulated DMA completion interrupts */
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t primask);
+
+#endif /* STM32L4XX_HAL_H_ */
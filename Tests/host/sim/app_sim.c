@@ -0,0 +1,23 @@
+/*
+ * app_sim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  What main.c provides to the drivers on the board.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "main.h"
+#include "lfs.h"
+
+lfs_t 						lfs;
+lfs_file_t 					file;
+lfs_dir_t 					dir;
+
+void Error_Handler(void)
+{
+	printf("Error_Handler\n");
+	exit(1);
+}
@@ -0,0 +1,267 @@
+/*
+ * hal_sim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  HAL calls of the host build on a simulated clock. Nothing runs in parallel:
+ *  the time only moves when the code under test spends it on the bus, waits in
+ *  HAL_Delay() or calls into the HAL (SIM_HAL_CALL_NS each), so a run gives the
+ *  same numbers on every machine. A DMA transfer moves its data at once but its
+ *  completion interrupt is delivered when the time reaches its end, and not
+ *  while PRIMASK is set.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "stm32l4xx_hal.h"
+#include "nor_sim.h"
+
+/* CPU time of one HAL call */
+#define SIM_HAL_CALL_NS		200
+
+/* SPI1 on APB2 and SPI3 on APB1 both run from the 80MHz HCLK */
+#define SIM_CORE_HZ			80000000
+
+static SPI_TypeDef			s_spi1, s_spi3;
+static GPIO_TypeDef			s_gpioa;
+static DWT_Type				s_dwt;
+static CoreDebug_Type		s_coredebug;
+
+SPI_TypeDef				   *SPI1 = &s_spi1;
+SPI_TypeDef				   *SPI3 = &s_spi3;
+GPIO_TypeDef			   *GPIOA = &s_gpioa;
+DWT_Type				   *DWT = &s_dwt;
+CoreDebug_Type			   *CoreDebug = &s_coredebug;
+uint32_t					SystemCoreClock = SIM_CORE_HZ;
+
+SPI_HandleTypeDef			hspi1;
+SPI_HandleTypeDef			hspi3;
+
+static uint64_t				s_now;
+static uint32_t				s_primask;
+static int					s_in_irq;
+
+/* The DMA transfer in flight and its completion */
+static struct
+{
+	SPI_HandleTypeDef	   *hspi;
+	void				  (*cplt)(SPI_HandleTypeDef *hspi);
+	uint64_t				due;
+	int						pending;
+	int						fault;
+} s_dma;
+
+static struct sim_spi_stats	s_spi_stats;
+
+static int sim_bus(SPI_HandleTypeDef *hspi)
+{
+	return hspi->Instance == SPI3 ? NOR_SIM_SPI3 : NOR_SIM_SPI1;
+}
+
+static uint32_t sim_spi_hz(SPI_HandleTypeDef *hspi)
+{
+	return SystemCoreClock / (2UL << ((hspi->Init.BaudRatePrescaler & SPI_CR1_BR) >> 3));
+}
+
+static uint64_t sim_byte_ns(SPI_HandleTypeDef *hspi)
+{
+	return 8ULL * 1000000000ULL / sim_spi_hz(hspi);
+}
+
+static void sim_irq(void)
+{
+	void				  (*cplt)(SPI_HandleTypeDef *hspi);
+
+	if( !s_dma.pending || s_now < s_dma.due || s_primask || s_in_irq )
+		return;
+
+	s_dma.pending = 0;
+	cplt = s_dma.cplt;
+	s_in_irq = 1;
+	cplt(s_dma.hspi);
+	s_in_irq = 0;
+}
+
+void sim_init(const struct nor_sim_part *part, const struct nor_sim_part *part3)
+{
+	s_now = 0;
+	s_primask = 0;
+	s_in_irq = 0;
+	memset(&s_dma, 0, sizeof(s_dma));
+	memset(&s_spi_stats, 0, sizeof(s_spi_stats));
+	memset(&s_dwt, 0, sizeof(s_dwt));
+	SystemCoreClock = SIM_CORE_HZ;
+
+	/* Same settings as MX_SPI1_Init() and MX_SPI3_Init() */
+	memset(&hspi1, 0, sizeof(hspi1));
+	hspi1.Instance = SPI1;
+	hspi1.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_128;
+	memset(&hspi3, 0, sizeof(hspi3));
+	hspi3.Instance = SPI3;
+	hspi3.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_32;
+
+	nor_sim_attach(NOR_SIM_SPI1, part ? part : &nor_sim_w25q256);
+	nor_sim_attach(NOR_SIM_SPI3, part3 ? part3 : &nor_sim_w25q128);
+}
+
+const struct sim_spi_stats *sim_spi_stats(void)
+{
+	return &s_spi_stats;
+}
+
+void sim_dma_fault(int fault)
+{
+	s_dma.fault = fault;
+}
+
+uint64_t sim_now_ns(void)
+{
+	return s_now;
+}
+
+void sim_advance(uint64_t ns)
+{
+	s_now += ns;
+	DWT->CYCCNT = (uint32_t)(s_now * (SystemCoreClock / 1000000) / 1000);
+	sim_irq();
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state)
+{
+	int					bus = pin == GPIO_PIN_15 ? NOR_SIM_SPI3 : NOR_SIM_SPI1;
+
+	if( port != GPIOA || (pin != GPIO_PIN_4 && pin != GPIO_PIN_15) )
+		return;
+
+	if( state == GPIO_PIN_SET && s_dma.pending && sim_bus(s_dma.hspi) == bus )
+		fprintf(stderr, "sim: CS of SPI%d released during a DMA transfer\n", bus == NOR_SIM_SPI1 ? 1 : 3);
+
+	nor_sim_select(bus, state == GPIO_PIN_RESET);
+}
+
+/* Clock the bytes through the part, tx NULL sends 0xFF and rx NULL drops */
+static void sim_spi_bytes(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx, uint16_t size)
+{
+	uint64_t			byte_ns = sim_byte_ns(hspi);
+	uint32_t			hz = sim_spi_hz(hspi);
+	uint8_t				out;
+	uint16_t			i;
+
+	for(i=0; i<size; i++)
+	{
+		out = nor_sim_byte(sim_bus(hspi), tx ? tx[i] : 0xFF, hz, byte_ns);
+		if( rx )
+			rx[i] = out;
+	}
+}
+
+static HAL_StatusTypeDef sim_spi_polled(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx, uint16_t size)
+{
+	if( s_dma.pending && s_dma.hspi == hspi )
+		return HAL_BUSY;
+
+	s_spi_stats.polled++;
+	sim_spi_bytes(hspi, tx, rx, size);
+	sim_advance(SIM_HAL_CALL_NS + size * sim_byte_ns(hspi));
+
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef sim_spi_dma(SPI_HandleTypeDef *hspi, const uint8_t *tx, uint8_t *rx, uint16_t size,
+		void (*cplt)(SPI_HandleTypeDef *hspi))
+{
+	if( s_dma.pending )
+		return HAL_BUSY;
+
+	s_spi_stats.dma++;
+	s_spi_stats.dma_bytes += size;
+	if( size > s_spi_stats.dma_max )
+		s_spi_stats.dma_max = size;
+
+	sim_spi_bytes(hspi, tx, rx, size);
+	s_dma.hspi = hspi;
+	s_dma.cplt = s_dma.fault == SIM_DMA_ERROR ? HAL_SPI_ErrorCallback : cplt;
+	s_dma.due = s_now + SIM_HAL_CALL_NS + size * sim_byte_ns(hspi);
+	s_dma.pending = s_dma.fault != SIM_DMA_LOST;
+	s_dma.fault = SIM_DMA_OK;
+	sim_advance(SIM_HAL_CALL_NS);
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Init(SPI_HandleTypeDef *hspi)
+{
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *tx, uint16_t size, uint32_t timeout)
+{
+	return sim_spi_polled(hspi, tx, NULL, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive(SPI_HandleTypeDef *hspi, uint8_t *rx, uint16_t size, uint32_t timeout)
+{
+	return sim_spi_polled(hspi, NULL, rx, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size, uint32_t timeout)
+{
+	return sim_spi_polled(hspi, tx, rx, size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *tx, uint16_t size)
+{
+	return sim_spi_dma(hspi, tx, NULL, size, HAL_SPI_TxCpltCallback);
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *rx, uint16_t size)
+{
+	return sim_spi_dma(hspi, NULL, rx, size, HAL_SPI_RxCpltCallback);
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *tx, uint8_t *rx, uint16_t size)
+{
+	return sim_spi_dma(hspi, tx, rx, size, HAL_SPI_TxRxCpltCallback);
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+	if( s_dma.hspi == hspi )
+		s_dma.pending = 0;
+	s_spi_stats.aborts++;
+	return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	sim_advance(SIM_HAL_CALL_NS);
+	return (uint32_t)(s_now / 1000000);
+}
+
+void HAL_Delay(uint32_t ms)
+{
+	sim_advance((uint64_t)ms * 1000000);
+}
+
+void __disable_irq(void)
+{
+	s_primask = 1;
+}
+
+void __enable_irq(void)
+{
+	s_primask = 0;
+	sim_irq();
+}
+
+uint32_t __get_PRIMASK(void)
+{
+	return s_primask;
+}
+
+void __set_PRIMASK(uint32_t primask)
+{
+	s_primask = primask;
+	sim_irq();
+}
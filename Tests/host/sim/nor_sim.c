@@ -0,0 +1,587 @@
+/*
+ * nor_sim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Behavioural model of a single-I/O SPI NOR part:
+ *  - 0x03/0x0B/0x13/0x0C read, 0x5A SFDP, 0x9F/0x90 ID, 0x05/0x35/0x15 status
+ *  - 0x06/0x04 write enable/disable, 0xB7/0xE9 4-byte address mode (with WEL
+ *    on some parts), 0x99 reset
+ *  - 0x02/0x12 page program: bits only go 1->0, the address wraps in the page
+ *  - 0x20/0x21, 0x52, 0xD8/0xDC, 0xC7/0x60 erase
+ *  - 0x75/0x7A and 0x35 or 0xB0/0x30 and 0x2B suspend/resume, per part
+ *  Programs and erases need WEL, take effect at CS high and keep BUSY set for
+ *  the typical time of the part. Commands other than status reads and suspend
+ *  are dropped while BUSY, like a real part does, and counted as ignored.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sfdp.h"
+#include "nor_sim.h"
+
+#define NOR_PAGE_SIZE		256
+#define NOR_SFDP_SIZE		256
+#define NOR_BFPT_OFFSET		0x80
+#define NOR_BFPT_DWORDS		16
+
+/* 3-byte addresses without 0xB7 reach the first 16MB only */
+#define NOR_3BYTE_MASK		0xFFFFFF
+
+struct nor_dev
+{
+	struct nor_sim_part		part;
+	uint8_t				   *mem;
+	uint8_t					sfdp[NOR_SFDP_SIZE];
+	uint32_t				sfdp_len;
+
+	uint8_t					selected;
+	uint8_t					cmd;
+	uint8_t					dropped;		/* cmd came in while BUSY */
+	uint32_t				pos;			/* bytes since CS low */
+	uint32_t				addr;
+
+	uint8_t					wel;
+	uint8_t					ads;
+	uint8_t					sus;
+	uint8_t					busy_cmd;
+	uint64_t				busy_until;
+	uint64_t				sus_left;
+
+	uint8_t					latch[NOR_PAGE_SIZE];
+	uint8_t					latched[NOR_PAGE_SIZE];
+
+	struct nor_sim_op_stats	ops[256];
+};
+
+const struct nor_sim_part nor_sim_w25q256 = {
+	.name		= "W25Q256JV",
+	.jedec_id	= 0xEF4019,
+	.size		= 32 << 20,
+	.addr_mode	= FLASH_ADDR_3OR4BYTE,
+	.ads_report	= NOR_SIM_ADS_SR3,
+	.suspend	= NOR_SIM_SUS_WINBOND,
+	.t			= { 133000000, 400, 45000, 120000, 150000, 80000, 20 },
+};
+
+const struct nor_sim_part nor_sim_w25q128 = {
+	.name		= "W25Q128JV",
+	.jedec_id	= 0xEF4018,
+	.size		= 16 << 20,
+	.addr_mode	= FLASH_ADDR_3BYTE,
+	.ads_report	= NOR_SIM_ADS_SR3,
+	.suspend	= NOR_SIM_SUS_WINBOND,
+	.t			= { 133000000, 400, 45000, 120000, 150000, 40000, 20 },
+};
+
+const struct nor_sim_part nor_sim_mx25l256 = {
+	.name		= "MX25L25645G",
+	.jedec_id	= 0xC22019,
+	.size		= 32 << 20,
+	.addr_mode	= FLASH_ADDR_3OR4BYTE,
+	.ads_report	= NOR_SIM_ADS_CR,
+	.suspend	= NOR_SIM_SUS_MACRONIX,
+	.t			= { 133000000, 330, 30000, 150000, 280000, 50000, 20 },
+};
+
+static struct nor_dev		s_dev[NOR_SIM_BUSES];
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = (v >> 8) & 0xFF;
+	p[2] = (v >> 16) & 0xFF;
+	p[3] = (v >> 24) & 0xFF;
+}
+
+/* BFPT DWORD10 erase time field: count-1 in [4:0], units of 1/16/128/1000 ms in [6:5] */
+static uint32_t sfdp_erase_field(uint32_t us)
+{
+	static const uint32_t	units[4] = { 1, 16, 128, 1000 };
+	uint32_t				ms = (us + 999) / 1000;
+	uint32_t				count;
+	int						u;
+
+	for(u=0; u<4; u++)
+	{
+		count = (ms + units[u] - 1) / units[u];
+		if( count <= 32 )
+			return ((count ? count : 1) - 1) | (u << 5);
+	}
+
+	return 0x7F;
+}
+
+/* BFPT DWORD12 suspend latency field: count-1 in [4:0], units of 128ns/1/8/64us in [6:5] */
+static uint32_t sfdp_suspend_field(uint32_t us)
+{
+	static const uint32_t	units[3] = { 1, 8, 64 };
+	uint32_t				count;
+	int						u;
+
+	for(u=0; u<3; u++)
+	{
+		count = (us + units[u] - 1) / units[u];
+		if( count <= 32 )
+			return ((count ? count : 1) - 1) | ((u + 1) << 5);
+	}
+
+	return 0x7F;
+}
+
+uint32_t nor_sim_build_sfdp(const struct nor_sim_part *part, uint8_t *buf, uint32_t len)
+{
+	uint8_t					bfpt[NOR_BFPT_DWORDS * 4];
+	uint32_t				pp, ce;
+
+	if( len < NOR_BFPT_OFFSET + sizeof(bfpt) )
+		return 0;
+
+	memset(buf, 0xFF, len);
+
+	/* SFDP header, revision 1.6, one parameter header: the BFPT */
+	memcpy(buf, "SFDP", 4);
+	buf[4] = 6;
+	buf[5] = 1;
+	buf[6] = 0;
+	buf[7] = 0xFF;
+	buf[8] = 0x00;
+	buf[9] = 6;
+	buf[10] = 1;
+	buf[11] = NOR_BFPT_DWORDS;
+	buf[12] = NOR_BFPT_OFFSET;
+	buf[13] = 0;
+	buf[14] = 0;
+	buf[15] = 0xFF;
+
+	memset(bfpt, 0xFF, sizeof(bfpt));
+	/* 4KB erase 0x20, 1-1-2 fast read, address bytes */
+	put32(bfpt + 0, 0xFF8020E5 | (1 << 16) | ((uint32_t)part->addr_mode << 17));
+	put32(bfpt + 4, part->size * 8 - 1);
+	put32(bfpt + 8, 0x6B08EB44);
+	put32(bfpt + 12, 0xBB423B08);
+	put32(bfpt + 16, 0xFFFFFFEE);
+	put32(bfpt + 20, 0xFF00FFFF);
+	put32(bfpt + 24, 0xFF00FFFF);
+	/* Erase types 4KB 0x20, 32KB 0x52, 64KB 0xD8 */
+	put32(bfpt + 28, 0x520F200C);
+	put32(bfpt + 32, 0x0000D810);
+	/* Typical erase times, max = 8 * typical */
+	put32(bfpt + 36, 3 | (sfdp_erase_field(part->t.tse_us) << 4) |
+			(sfdp_erase_field(part->t.tbe32_us) << 11) | (sfdp_erase_field(part->t.tbe64_us) << 18));
+	/* Page size, page program in 64us units, chip erase in 4s units */
+	pp = (part->t.tpp_us + 63) / 64;
+	ce = (part->t.tce_ms + 3999) / 4000;
+	put32(bfpt + 40, 3 | (8 << 4) | ((pp ? pp - 1 : 0) << 8) | (1 << 13) |
+			((ce ? ce - 1 : 0) << 24) | (2u << 29));
+	/* Suspend: erase suspend latency tSUS in us, opcodes of the vendor */
+	if( part->suspend == NOR_SIM_SUS_NONE )
+	{
+		put32(bfpt + 44, 0xFFFFFFFF);
+	}
+	else
+	{
+		put32(bfpt + 44, 0x007663E9 | sfdp_suspend_field(part->t.tsus_us) << 24);
+		put32(bfpt + 48, part->suspend == NOR_SIM_SUS_WINBOND ? 0x757A757A : 0xB030B030);
+	}
+	/* 4-byte address mode: 0xB7/0xE9, with or without WREN, none on a 3-byte part */
+	if( part->addr_mode == FLASH_ADDR_3BYTE )
+		put32(bfpt + 60, 0x800030F0);
+	else if( part->addr4_wren )
+		put32(bfpt + 60, 0x8200B0F0);
+	else
+		put32(bfpt + 60, 0x810070F0);
+
+	memcpy(buf + NOR_BFPT_OFFSET, bfpt, sizeof(bfpt));
+
+	return NOR_BFPT_OFFSET + sizeof(bfpt);
+}
+
+static struct nor_dev *nor_dev(int bus)
+{
+	return bus >= 0 && bus < NOR_SIM_BUSES ? &s_dev[bus] : NULL;
+}
+
+void nor_sim_attach(int bus, const struct nor_sim_part *part)
+{
+	struct nor_dev		   *d = nor_dev(bus);
+
+	free(d->mem);
+	memset(d, 0, sizeof(*d));
+	d->part = *part;
+	d->mem = malloc(part->size);
+	memset(d->mem, 0xFF, part->size);
+
+	if( part->sfdp )
+	{
+		d->sfdp_len = part->sfdp_len > NOR_SFDP_SIZE ? NOR_SFDP_SIZE : part->sfdp_len;
+		memset(d->sfdp, 0xFF, sizeof(d->sfdp));
+		memcpy(d->sfdp, part->sfdp, d->sfdp_len);
+	}
+	else
+	{
+		d->sfdp_len = nor_sim_build_sfdp(part, d->sfdp, sizeof(d->sfdp));
+	}
+
+	/* A 4-byte only part powers up in 4-byte address mode */
+	d->ads = part->addr_mode == FLASH_ADDR_4BYTE;
+}
+
+uint8_t *nor_sim_mem(int bus)
+{
+	return nor_dev(bus)->mem;
+}
+
+const struct nor_sim_op_stats *nor_sim_op(int bus, uint8_t opcode)
+{
+	return &nor_dev(bus)->ops[opcode];
+}
+
+void nor_sim_reset_stats(void)
+{
+	int					bus;
+
+	for(bus=0; bus<NOR_SIM_BUSES; bus++)
+		memset(s_dev[bus].ops, 0, sizeof(s_dev[bus].ops));
+}
+
+static int nor_busy(struct nor_dev *d)
+{
+	return sim_now_ns() < d->busy_until;
+}
+
+/* Address bytes and dummy bytes which follow the opcode */
+static int nor_addr_bytes(struct nor_dev *d, uint8_t cmd)
+{
+	switch( cmd )
+	{
+		case 0x5A:
+		case 0x90:
+			return 3;
+		case 0x03: case 0x0B: case 0x02:
+		case 0x20: case 0x52: case 0xD8:
+			return d->ads ? 4 : 3;
+		case 0x13: case 0x0C: case 0x12:
+		case 0x21: case 0xDC:
+			return 4;
+		default:
+			return 0;
+	}
+}
+
+static int nor_dummy_bytes(uint8_t cmd)
+{
+	return (cmd == 0x0B || cmd == 0x0C || cmd == 0x5A) ? 1 : 0;
+}
+
+static uint32_t nor_addr(struct nor_dev *d, uint32_t addr)
+{
+	if( nor_addr_bytes(d, d->cmd) == 3 )
+		addr &= NOR_3BYTE_MASK;
+	return addr % d->part.size;
+}
+
+/* Suspend opcode of the part, or resume if resume is set, 0 if it cannot suspend */
+static uint8_t nor_sus_cmd(struct nor_dev *d, int resume)
+{
+	switch( d->part.suspend )
+	{
+		case NOR_SIM_SUS_WINBOND:	return resume ? 0x7A : 0x75;
+		case NOR_SIM_SUS_MACRONIX:	return resume ? 0x30 : 0xB0;
+		default:					return 0;
+	}
+}
+
+/* Commands a part accepts while BUSY or suspended */
+static int nor_accepts(struct nor_dev *d, uint8_t cmd)
+{
+	int					program = (cmd == 0x02 || cmd == 0x12);
+	int					erase = (cmd == 0x20 || cmd == 0x21 || cmd == 0x52 || cmd == 0xD8 ||
+								 cmd == 0xDC || cmd == 0xC7 || cmd == 0x60);
+
+	if( nor_busy(d) )
+		return cmd == 0x05 || cmd == 0x35 || cmd == 0x15 || cmd == 0x2B || cmd == nor_sus_cmd(d, 0) || cmd == 0x99;
+
+	/* A suspended erase/program must be resumed first */
+	if( d->sus )
+		return !program && !erase;
+
+	return 1;
+}
+
+/* Data phase byte n of the current command */
+static uint8_t nor_data(struct nor_dev *d, uint8_t in, uint32_t n, int garbled)
+{
+	uint8_t				out = 0xFF;
+	uint32_t			a;
+
+	switch( d->cmd )
+	{
+		case 0x03: case 0x0B: case 0x13: case 0x0C:
+			out = d->mem[nor_addr(d, d->addr + n)];
+			break;
+
+		case 0x5A:
+			a = d->addr + n;
+			out = a < sizeof(d->sfdp) ? d->sfdp[a] : 0xFF;
+			break;
+
+		case 0x9F:
+			out = n < 3 ? (d->part.jedec_id >> (16 - 8 * n)) & 0xFF : 0xFF;
+			break;
+
+		case 0x90:
+			out = (n & 1) ? (d->part.jedec_id & 0xFF) - 1 : (d->part.jedec_id >> 16) & 0xFF;
+			break;
+
+		case 0x05:
+			out = (nor_busy(d) ? 0x01 : 0) | (d->wel ? 0x02 : 0);
+			break;
+
+		case 0x35:
+			out = (d->sus && d->part.suspend == NOR_SIM_SUS_WINBOND) ? 0x80 : 0;
+			break;
+
+		case 0x2B:
+			if( d->sus && d->part.suspend == NOR_SIM_SUS_MACRONIX )
+				out = (d->busy_cmd == 0x02 || d->busy_cmd == 0x12) ? 0x04 : 0x08;
+			else
+				out = 0;
+			break;
+
+		case 0x15:
+			if( d->part.ads_report == NOR_SIM_ADS_CR )
+				out = 0x07 | (d->ads ? 0x20 : 0);
+			else
+				out = d->ads ? 0x01 : 0;
+			break;
+
+		case 0x02: case 0x12:
+			a = (d->addr + n) % NOR_PAGE_SIZE;
+			d->latch[a] = in;
+			d->latched[a] = 1;
+			break;
+	}
+
+	/* Above the part's clock limit the read data does not make it back */
+	if( garbled )
+		out ^= 0x5A;
+
+	return out;
+}
+
+static void nor_start_busy(struct nor_dev *d, uint64_t us)
+{
+	d->busy_until = sim_now_ns() + us * 1000;
+	d->busy_cmd = d->cmd;
+	d->ops[d->cmd].busy_ns += us * 1000;
+	d->wel = 0;
+}
+
+static void nor_erase(struct nor_dev *d, uint32_t size, uint32_t us)
+{
+	uint32_t			base = nor_addr(d, d->addr) & ~(size - 1);
+
+	memset(d->mem + base, 0xFF, size);
+	nor_start_busy(d, us);
+}
+
+/* CS high: the command takes effect */
+static void nor_end(struct nor_dev *d)
+{
+	uint32_t			hdr = 1 + nor_addr_bytes(d, d->cmd) + nor_dummy_bytes(d->cmd);
+	uint32_t			base, i;
+
+	if( d->pos == 0 || d->dropped )
+		return;
+
+	switch( d->cmd )
+	{
+		case 0x06:
+			d->wel = 1;
+			break;
+
+		case 0x04:
+			d->wel = 0;
+			break;
+
+		case 0xB7:
+			if( d->part.addr_mode != FLASH_ADDR_3BYTE && (d->wel || !d->part.addr4_wren) )
+				d->ads = 1;
+			d->wel &= !d->part.addr4_wren;
+			break;
+
+		case 0xE9:
+			if( d->part.addr_mode != FLASH_ADDR_4BYTE && (d->wel || !d->part.addr4_wren) )
+				d->ads = 0;
+			d->wel &= !d->part.addr4_wren;
+			break;
+
+		case 0x99:
+			d->ads = d->part.addr_mode == FLASH_ADDR_4BYTE;
+			d->wel = 0;
+			d->sus = 0;
+			d->busy_until = 0;
+			break;
+
+		case 0x02: case 0x12:
+			if( !d->wel || d->pos <= hdr )
+				break;
+			base = nor_addr(d, d->addr) & ~(NOR_PAGE_SIZE - 1);
+			for(i=0; i<NOR_PAGE_SIZE; i++)
+			{
+				if( d->latched[i] )
+					d->mem[base + i] &= d->latch[i];
+			}
+			nor_start_busy(d, d->part.t.tpp_us);
+			break;
+
+		case 0x20: case 0x21:
+			if( d->wel && d->pos >= hdr )
+				nor_erase(d, 4096, d->part.t.tse_us);
+			break;
+
+		case 0x52:
+			if( d->wel && d->pos >= hdr )
+				nor_erase(d, 32768, d->part.t.tbe32_us);
+			break;
+
+		case 0xD8: case 0xDC:
+			if( d->wel && d->pos >= hdr )
+				nor_erase(d, 65536, d->part.t.tbe64_us);
+			break;
+
+		case 0xC7: case 0x60:
+			if( d->wel )
+			{
+				memset(d->mem, 0xFF, d->part.size);
+				nor_start_busy(d, (uint64_t)d->part.t.tce_ms * 1000);
+			}
+			break;
+
+	}
+
+	/* An operation within tSUS of its end completes instead of suspending */
+	if( d->cmd && d->cmd == nor_sus_cmd(d, 0) && nor_busy(d) && !d->sus &&
+		d->busy_until - sim_now_ns() > (uint64_t)d->part.t.tsus_us * 1000 )
+	{
+		d->sus_left = d->busy_until - sim_now_ns();
+		d->busy_until = sim_now_ns() + d->part.t.tsus_us * 1000;
+		d->sus = 1;
+	}
+	else if( d->cmd && d->cmd == nor_sus_cmd(d, 1) && d->sus )
+	{
+		d->busy_until = sim_now_ns() + d->sus_left;
+		d->sus = 0;
+	}
+}
+
+void nor_sim_select(int bus, int selected)
+{
+	struct nor_dev		   *d = nor_dev(bus);
+
+	if( !d || !d->mem || d->selected == selected )
+		return;
+
+	if( !selected )
+		nor_end(d);
+
+	d->selected = selected;
+	d->pos = 0;
+}
+
+uint8_t nor_sim_byte(int bus, uint8_t in, uint32_t spi_hz, uint64_t byte_ns)
+{
+	struct nor_dev		   *d = nor_dev(bus);
+	uint32_t				abytes, hdr;
+	uint8_t					out = 0xFF;
+
+	if( !d || !d->mem || !d->selected )
+		return 0xFF;
+
+	if( d->pos == 0 )
+	{
+		d->cmd = in;
+		d->addr = 0;
+		d->dropped = !nor_accepts(d, in);
+		memset(d->latched, 0, sizeof(d->latched));
+		if( d->dropped )
+			d->ops[in].ignored++;
+		else
+			d->ops[in].count++;
+	}
+	else if( !d->dropped )
+	{
+		abytes = nor_addr_bytes(d, d->cmd);
+		hdr = 1 + abytes + nor_dummy_bytes(d->cmd);
+		if( d->pos <= abytes )
+		{
+			d->addr = (d->addr << 8) | in;
+		}
+		else if( d->pos >= hdr )
+		{
+			out = nor_data(d, in, d->pos - hdr, spi_hz > d->part.t.spi_hz_max);
+			d->ops[d->cmd].bytes++;
+		}
+	}
+
+	d->ops[d->cmd].bus_ns += byte_ns;
+	d->pos++;
+
+	return out;
+}
+
+static const char *nor_op_name(uint8_t op)
+{
+	switch( op )
+	{
+		case 0x02: return "page program";
+		case 0x03: return "read";
+		case 0x04: return "write disable";
+		case 0x05: return "read SR1";
+		case 0x06: return "write enable";
+		case 0x0B: return "fast read";
+		case 0x15: return "read SR3/CR";
+		case 0x2B: return "read SCUR";
+		case 0x30: return "resume";
+		case 0x20: return "erase 4K";
+		case 0x35: return "read SR2";
+		case 0x52: return "erase 32K";
+		case 0x5A: return "read SFDP";
+		case 0x75: return "suspend";
+		case 0x7A: return "resume";
+		case 0x9F: return "read JEDEC ID";
+		case 0xB0: return "suspend";
+		case 0xB7: return "enter 4-byte";
+		case 0xC7: return "chip erase";
+		case 0xD8: return "erase 64K";
+		case 0xE9: return "exit 4-byte";
+		default:   return "";
+	}
+}
+
+void nor_sim_report(int bus)
+{
+	struct nor_dev		   *d = nor_dev(bus);
+	const struct nor_sim_op_stats *op;
+	uint64_t				total = 0;
+	int						i;
+
+	printf("%s on SPI%d, %llu us simulated\n", d->part.name, bus == NOR_SIM_SPI1 ? 1 : 3,
+			(unsigned long long)(sim_now_ns() / 1000));
+	printf("  op  %-14s %8s %8s %10s %12s %12s %10s\n", "", "count", "ignored", "bytes", "bus us", "busy us", "avg us");
+	for(i=0; i<256; i++)
+	{
+		op = &d->ops[i];
+		if( !op->count && !op->ignored )
+			continue;
+
+		total += op->bus_ns + op->busy_ns;
+		printf("  %02X  %-14s %8u %8u %10llu %12.1f %12.1f %10.2f\n", i, nor_op_name(i), op->count, op->ignored,
+				(unsigned long long)op->bytes, op->bus_ns / 1000.0, op->busy_ns / 1000.0,
+				op->count ? (op->bus_ns + op->busy_ns) / 1000.0 / op->count : 0.0);
+	}
+	printf("  total %.1f us\n", total / 1000.0);
+}
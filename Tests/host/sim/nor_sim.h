@@ -0,0 +1,118 @@
+/*
+ * nor_sim.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Simulated SPI NOR parts behind the host HAL shim, one on SPI1 (CS PA4) and
+ *  one on SPI3 (CS PA15). The parts decode the opcodes the drivers send, keep
+ *  the array contents with the program/erase semantics of a real part, and run
+ *  on a simulated clock: every SPI byte costs 8 SCK periods at the prescaled
+ *  bus clock, and programs/erases keep BUSY set for the configured times.
+ */
+
+#ifndef NOR_SIM_H_
+#define NOR_SIM_H_
+
+#include <stdint.h>
+
+#define NOR_SIM_BUSES		2
+#define NOR_SIM_SPI1		0
+#define NOR_SIM_SPI3		1
+
+/* How the part reports 4-byte address mode after 0xB7 */
+#define NOR_SIM_ADS_SR3		0		/* Winbond: Status Register-3 (0x15) bit0 */
+#define NOR_SIM_ADS_CR		1		/* Macronix: configuration register (0x15) bit5, ODS in [2:0] */
+
+/* Erase/program suspend of the part */
+#define NOR_SIM_SUS_NONE		0
+#define NOR_SIM_SUS_WINBOND		1		/* 0x75/0x7A, SUS in Status Register-2 (0x35) bit7 */
+#define NOR_SIM_SUS_MACRONIX	2		/* 0xB0/0x30, PSB/ESB in security register (0x2B) bit2/3 */
+
+/* Typical operation times, in us unless noted */
+struct nor_sim_timing
+{
+	uint32_t			spi_hz_max;		/* reads above this clock return garbage */
+	uint32_t			tpp_us;
+	uint32_t			tse_us;			/* 4KB */
+	uint32_t			tbe32_us;
+	uint32_t			tbe64_us;
+	uint32_t			tce_ms;
+	uint32_t			tsus_us;		/* suspend latency */
+};
+
+struct nor_sim_part
+{
+	const char		   *name;
+	uint32_t			jedec_id;
+	uint32_t			size;
+	uint8_t				addr_mode;		/* FLASH_ADDR_3BYTE etc. */
+	uint8_t				ads_report;		/* NOR_SIM_ADS_* */
+	uint8_t				addr4_wren;		/* 0xB7/0xE9 need WEL */
+	uint8_t				suspend;		/* NOR_SIM_SUS_* */
+	const uint8_t	   *sfdp;			/* SFDP space, NULL to build one from the fields above */
+	uint32_t			sfdp_len;
+	struct nor_sim_timing	t;
+};
+
+/* Per opcode counters, time is the bus time plus the BUSY time it caused */
+struct nor_sim_op_stats
+{
+	uint32_t			count;
+	uint32_t			ignored;		/* sent while BUSY, dropped by the part */
+	uint64_t			bytes;			/* data bytes after the opcode/address/dummy */
+	uint64_t			bus_ns;
+	uint64_t			busy_ns;
+};
+
+extern const struct nor_sim_part	nor_sim_w25q256;
+extern const struct nor_sim_part	nor_sim_w25q128;
+extern const struct nor_sim_part	nor_sim_mx25l256;
+
+/* Reset the clock and put a blank part on every bus, SPI1 gets part, SPI3 gets
+ * part3, NULL for the W25Q256/W25Q128 defaults. Also sets up hspi1/hspi3. */
+void sim_init(const struct nor_sim_part *part, const struct nor_sim_part *part3);
+
+/* Simulated time since sim_init() */
+uint64_t sim_now_ns(void);
+
+/* Advance the simulated time, delivering the DMA completions which fall due */
+void sim_advance(uint64_t ns);
+
+/* Transfers seen by the HAL shim, reset by sim_init() */
+struct sim_spi_stats
+{
+	uint32_t			polled;			/* polled HAL_SPI_* calls */
+	uint32_t			dma;			/* HAL_SPI_*_DMA calls */
+	uint32_t			dma_max;		/* longest DMA transfer, bytes */
+	uint64_t			dma_bytes;
+	uint32_t			aborts;
+};
+
+const struct sim_spi_stats *sim_spi_stats(void);
+
+/* Make the next DMA transfer fail: SIM_DMA_LOST never completes, SIM_DMA_ERROR
+ * completes through HAL_SPI_ErrorCallback() */
+#define SIM_DMA_OK			0
+#define SIM_DMA_LOST		1
+#define SIM_DMA_ERROR		2
+void sim_dma_fault(int fault);
+
+/* Array contents of the part on a bus, writable to prepare a test */
+uint8_t *nor_sim_mem(int bus);
+
+const struct nor_sim_op_stats *nor_sim_op(int bus, uint8_t opcode);
+void nor_sim_reset_stats(void);
+
+/* Print the per opcode count, bytes and simulated time of a bus */
+void nor_sim_report(int bus);
+
+/* Build the SFDP space of a part from its geometry and timing, return the size */
+uint32_t nor_sim_build_sfdp(const struct nor_sim_part *part, uint8_t *buf, uint32_t len);
+
+/* Bus side of the parts, used by the HAL shim only */
+void nor_sim_attach(int bus, const struct nor_sim_part *part);
+void nor_sim_select(int bus, int selected);
+uint8_t nor_sim_byte(int bus, uint8_t in, uint32_t spi_hz, uint64_t byte_ns);
+
+#endif /* NOR_SIM_H_ */
@@ -0,0 +1,23 @@
+/*
+ * sim_check.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ */
+
+#ifndef SIM_CHECK_H_
+#define SIM_CHECK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Stop the test with the failing condition, the Makefile reports the exit status */
+#define CHECK(cond)		do { \
+		if( !(cond) ) \
+		{ \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			exit(1); \
+		} \
+	} while( 0 )
+
+#endif /* SIM_CHECK_H_ */
@@ -0,0 +1,94 @@
+/*
+ * test_blank_check.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Blank check of the range erase: a used block costs one chunk read per
+ *  sector before its erase, a blank one is read in full and not erased, and
+ *  the erase verification is done while erasing so SPI_FLASH_AutoVerify()
+ *  does not read the range a second time. The stats show the reads.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define BLOCK_ADDR		0x10000
+#define BLOCK_SIZE		65536
+
+static uint8_t				s_page[256];
+
+static int count_ops(uint8_t cmd)
+{
+	return nor_sim_op(NOR_SIM_SPI1, cmd)->count;
+}
+
+/* Erase the block and verify it like the callers of SPI_FLASH_EraseRange() do */
+static void erase_block(void)
+{
+	nor_sim_reset_stats();
+	SPI_FLASH_ResetStats();
+	CHECK(SPI_FLASH_EraseRange(BLOCK_ADDR, BLOCK_SIZE) == 0);
+	CHECK(SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, BLOCK_ADDR, NULL, BLOCK_SIZE) == 0);
+}
+
+int main(void)
+{
+	const struct spi_flash_stats   *st;
+	uint8_t						   *mem;
+	uint32_t						i;
+
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+	st = SPI_FLASH_GetStats();
+
+	/* A used block: the first sample is programmed, the block is erased and read
+	 * once to verify it */
+	memset(mem + BLOCK_ADDR, 0x00, BLOCK_SIZE);
+	erase_block();
+	CHECK(count_ops(0xD8) == 1 && st->erase_skipped == 0);
+	CHECK(st->blank_bytes == 256);
+	CHECK(st->bytes_read == 256 + BLOCK_SIZE);
+	for(i=0; i<BLOCK_SIZE; i++)
+		CHECK(mem[BLOCK_ADDR + i] == 0xFF);
+
+	/* A blank block: read in full by the check, not erased, not read again */
+	erase_block();
+	CHECK(count_ops(0xD8) == 0 && st->erase_skipped == 1);
+	CHECK(st->blank_bytes == BLOCK_SIZE && st->bytes_read == BLOCK_SIZE);
+	printf("blank 64KB block: check read %lu B in %llu us\n", (unsigned long)st->blank_bytes,
+			(unsigned long long)(st->blank_cycles / (SystemCoreClock / 1000000)));
+	CHECK(st->blank_cycles > 0);
+
+	/* Programmed only at the end of a sector: all 16 samples are blank, the full
+	 * read stops at the programmed chunk */
+	mem[BLOCK_ADDR + 0x2FFF] = 0x00;
+	erase_block();
+	CHECK(count_ops(0xD8) == 1);
+	CHECK(st->blank_bytes == 16 * 256 + 0x3000 - 3 * 256);
+	CHECK(st->bytes_read == st->blank_bytes + BLOCK_SIZE);
+
+	/* A write into the range after the erase: the verify reads it and fails */
+	memset(s_page, 0x5A, sizeof(s_page));
+	CHECK(SPI_FLASH_EraseRange(BLOCK_ADDR, BLOCK_SIZE) == 0);
+	CHECK(New_SPI_FLASH_PageWrite(s_page, BLOCK_ADDR + 0x8000, sizeof(s_page)) == 0);
+	CHECK(SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, BLOCK_ADDR, NULL, BLOCK_SIZE) == -1);
+
+	/* The verify of a range the erase did not cover still reads */
+	SPI_FLASH_ResetStats();
+	CHECK(SPI_FLASH_EraseRange(BLOCK_ADDR, 4096) == 0);
+	CHECK(SPI_FLASH_AutoVerify(SPI_FLASH_OP_ERASE, BLOCK_ADDR, NULL, 8192) == 0);
+	CHECK(st->bytes_read == st->blank_bytes + 8192);
+
+	/* Erase verification off: only the check reads */
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+	memset(mem + BLOCK_ADDR, 0x00, BLOCK_SIZE);
+	erase_block();
+	CHECK(count_ops(0xD8) == 1 && st->bytes_read == st->blank_bytes);
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * test_cache.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Page cache benchmark: the flash accesses of littlefs are recorded during an
+ *  upload (files written in 1KB chunks like the X/YMODEM receiver does) and a
+ *  boot (mount, then an ELF image read header, program headers and segments
+ *  like do_load_elf()), and replayed against the page cache. Reads go through
+ *  New_SPI_FLASH_BufferRead(), programs and erases invalidate their range.
+ *  The hit rate is reported for the FLASH_CACHE_SETS x FLASH_CACHE_WAYS the
+ *  driver was built with, "make bench" builds it for several geometries.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define TRACE_MAX		65536
+
+enum { TRACE_READ, TRACE_WRITE };
+
+struct trace_ent
+{
+	uint8_t				op;
+	uint32_t			addr;
+	uint32_t			size;
+};
+
+extern lfs_t 				lfs;
+extern lfs_file_t 			file;
+extern struct lfs_config	cfg;
+
+static struct trace_ent		s_trace[TRACE_MAX];
+static uint32_t				s_trace_len;
+static uint32_t				s_lfs_base;
+static uint8_t				s_data[96 * 1024];
+static uint8_t				s_buf[8192];
+
+static void trace_add(int op, uint32_t addr, uint32_t size)
+{
+	CHECK(s_trace_len < TRACE_MAX);
+	s_trace[s_trace_len].op = op;
+	s_trace[s_trace_len].addr = addr;
+	s_trace[s_trace_len].size = size;
+	s_trace_len++;
+}
+
+static int trace_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
+	trace_add(TRACE_READ, s_lfs_base + block * c->block_size + off, size);
+	return lfs_read(c, block, off, buffer, size);
+}
+
+static int trace_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+	trace_add(TRACE_WRITE, s_lfs_base + block * c->block_size + off, size);
+	return lfs_write(c, block, off, buffer, size);
+}
+
+static int trace_erase(const struct lfs_config *c, lfs_block_t block)
+{
+	trace_add(TRACE_WRITE, s_lfs_base + block * c->block_size, c->block_size);
+	return lfs_SectorErase(c, block);
+}
+
+/* Write the image and a few small files in 1KB chunks */
+static void upload(void)
+{
+	char					name[16];
+	uint32_t				off, len;
+	int						i;
+
+	CHECK(lfs_port_file_open(&lfs, &file, "app.elf", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) == 0);
+	for(off=0; off<sizeof(s_data); off+=len)
+	{
+		len = sizeof(s_data) - off > 1024 ? 1024 : sizeof(s_data) - off;
+		CHECK(lfs_file_write(&lfs, &file, s_data + off, len) == (lfs_ssize_t)len);
+	}
+	CHECK(lfs_port_file_close(&lfs, &file) == 0);
+
+	for(i=0; i<4; i++)
+	{
+		sprintf(name, "cfg%d", i);
+		CHECK(lfs_port_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) == 0);
+		CHECK(lfs_file_write(&lfs, &file, s_data + i * 100, 100) == 100);
+		CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	}
+}
+
+/* Mount, read the boot config and load the image the way do_load_elf() does: the
+ * ELF header, each program header after a seek, then each segment */
+static void boot(void)
+{
+	uint32_t				off, len;
+	int						i;
+
+	CHECK(lfs_mount(&lfs, &cfg) == 0);
+
+	CHECK(lfs_port_file_open(&lfs, &file, "cfg0", LFS_O_RDONLY) == 0);
+	CHECK(lfs_file_read(&lfs, &file, s_buf, 100) == 100);
+	CHECK(lfs_port_file_close(&lfs, &file) == 0);
+
+	CHECK(lfs_port_file_open(&lfs, &file, "app.elf", LFS_O_RDONLY) == 0);
+	CHECK(lfs_file_read(&lfs, &file, s_buf, 52) == 52);
+	for(i=0; i<4; i++)
+	{
+		CHECK(lfs_file_seek(&lfs, &file, 52 + i * 32, LFS_SEEK_SET) >= 0);
+		CHECK(lfs_file_read(&lfs, &file, s_buf, 32) == 32);
+	}
+	for(i=0; i<4; i++)
+	{
+		CHECK(lfs_file_seek(&lfs, &file, 4096 + i * 20480, LFS_SEEK_SET) >= 0);
+		for(off=0; off<20480; off+=len)
+		{
+			len = 20480 - off > sizeof(s_buf) ? sizeof(s_buf) : 20480 - off;
+			CHECK(lfs_file_read(&lfs, &file, s_buf, len) == (lfs_ssize_t)len);
+		}
+	}
+	CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	CHECK(lfs_port_unmount(&lfs) == 0);
+}
+
+/* Replay the recorded trace against the page cache, report the hit rate */
+static void replay(const char *name)
+{
+	const struct spi_flash_stats   *st = SPI_FLASH_GetStats();
+	uint64_t						t0;
+	uint32_t						i, reads = 0, small = 0, pages;
+
+	SPI_FLASH_CacheInvalidate(0, SPI_FLASH_GetSize());
+	SPI_FLASH_ResetStats();
+	t0 = sim_now_ns();
+	for(i=0; i<s_trace_len; i++)
+	{
+		if( s_trace[i].op == TRACE_WRITE )
+		{
+			SPI_FLASH_CacheInvalidate(s_trace[i].addr, s_trace[i].size);
+			continue;
+		}
+
+		New_SPI_FLASH_BufferRead(s_trace[i].addr, s_buf, s_trace[i].size);
+		reads++;
+		small += s_trace[i].size <= 2 * 256;
+	}
+
+	pages = st->cache_hits + st->cache_misses;
+	CHECK(st->cache_bypass == reads - small);
+	CHECK(small > 0 && pages >= small);
+	printf("%-6s cache %dx%d: %lu reads, %lu bypass, %lu page hits, %lu misses, hit rate %lu%%, %llu us\n",
+			name, FLASH_CACHE_SETS, FLASH_CACHE_WAYS, (unsigned long)reads, (unsigned long)st->cache_bypass,
+			(unsigned long)st->cache_hits, (unsigned long)st->cache_misses, (unsigned long)(st->cache_hits * 100 / pages),
+			(unsigned long long)((sim_now_ns() - t0) / 1000));
+}
+
+int main(void)
+{
+	uint32_t				i;
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 11 + (i >> 9);
+
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	s_lfs_base = flash_part_find("littlefs")->offset;
+	initialize_filesystem();
+
+	cfg.read = trace_read;
+	cfg.prog = trace_prog;
+	cfg.erase = trace_erase;
+
+	s_trace_len = 0;
+	upload();
+	CHECK(lfs_port_unmount(&lfs) == 0);
+	replay("upload");
+
+	s_trace_len = 0;
+	boot();
+	replay("boot");
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * test_dma.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  SPI1 transfer engine: short transfers are polled, long ones go through DMA in
+ *  chunks of at most 0xFFFF bytes, completions arrive from the DMA interrupt, and
+ *  a lost or failed completion is reported instead of hanging.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_job.h"
+#include "spi.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define BASE		0x100000
+#define LEN			200000
+
+static uint8_t				s_buf[LEN];
+static int					s_done_calls;
+static int					s_done_status;
+
+static void xfer_done(int status)
+{
+	s_done_calls++;
+	s_done_status = status;
+}
+
+/* Read [addr, addr+len) with the fast read header and one SPI_FLASH_Xfer() */
+static int xfer_read(uint32_t addr, uint8_t *buf, int len)
+{
+	uint8_t				cmd[SPI_FLASH_CMD_MAX];
+	int					bytes, rv;
+
+	bytes = SPI_FLASH_ReadCmd(cmd, addr);
+	SPI_FLASH_Select();
+	SPI_FLASH_Xfer(cmd, NULL, bytes);
+	rv = SPI_FLASH_Xfer(NULL, buf, len);
+	SPI_FLASH_Deselect();
+
+	return rv;
+}
+
+int main(void)
+{
+	const struct sim_spi_stats	*st;
+	struct sim_spi_stats		 before;
+	struct flash_job			 job;
+	uint8_t						*mem;
+	uint64_t					 t0, wire_ns;
+	uint32_t					 i;
+
+	sim_init(NULL, NULL);
+	st = sim_spi_stats();
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	for(i=0; i<LEN; i++)
+		mem[BASE + i] = i ^ (i >> 9);
+	CHECK(SPI_FLASH_Init() == 0);
+
+	/* Below SPI_DMA_THRESHOLD the transfer is polled in a single HAL call */
+	before = *st;
+	CHECK(xfer_read(BASE, s_buf, 15) == 0);
+	CHECK(st->dma == before.dma && st->polled == before.polled + 2);
+	CHECK(!memcmp(s_buf, mem + BASE, 15));
+
+	before = *st;
+	CHECK(xfer_read(BASE, s_buf, 16) == 0);
+	CHECK(st->dma == before.dma + 1 && st->polled == before.polled + 1);
+	CHECK(!memcmp(s_buf, mem + BASE, 16));
+
+	/* 200000 bytes: three full 0xFFFF chunks and the rest, at wire speed */
+	before = *st;
+	memset(s_buf, 0, sizeof(s_buf));
+	t0 = sim_now_ns();
+	CHECK(xfer_read(BASE, s_buf, LEN) == 0);
+	wire_ns = (uint64_t)LEN * 8 * 1000000000ULL / (SystemCoreClock / (2UL << ((hspi1.Init.BaudRatePrescaler & SPI_CR1_BR) >> 3)));
+	printf("read %d B in %llu us, wire time %llu us\n", LEN,
+			(unsigned long long)((sim_now_ns() - t0) / 1000), (unsigned long long)(wire_ns / 1000));
+	CHECK(st->dma == before.dma + 4 && st->dma_max == 0xFFFF);
+	CHECK(st->dma_bytes - before.dma_bytes == LEN);
+	CHECK(!memcmp(s_buf, mem + BASE, LEN));
+	CHECK(sim_now_ns() - t0 < wire_ns + wire_ns / 100);
+
+	/* A started chunk completes from the interrupt when its bytes are out, not before
+	 * and not while interrupts are masked */
+	SPI_FLASH_Select();
+	CHECK(SPI_FLASH_XferStart(NULL, s_buf, 1000, xfer_done) == 0);
+	sim_advance(1000 * 100);
+	CHECK(s_done_calls == 0);
+	__disable_irq();
+	sim_advance(1000 * 400);
+	CHECK(s_done_calls == 0);
+	__enable_irq();
+	CHECK(s_done_calls == 1 && s_done_status == 0);
+	SPI_FLASH_Deselect();
+
+	/* A lost completion times out and aborts, an error completion fails */
+	before = *st;
+	sim_dma_fault(SIM_DMA_LOST);
+	t0 = sim_now_ns();
+	CHECK(xfer_read(BASE, s_buf, 100) == -3);
+	CHECK(st->aborts == before.aborts + 1);
+	CHECK(sim_now_ns() - t0 >= 1000000000ULL);
+
+	sim_dma_fault(SIM_DMA_ERROR);
+	CHECK(xfer_read(BASE, s_buf, 100) == -1);
+
+	/* and the next transfer works again */
+	memset(s_buf, 0, 1000);
+	CHECK(xfer_read(BASE, s_buf, 1000) == 0);
+	CHECK(!memcmp(s_buf, mem + BASE, 1000));
+
+	/* The job engine splits its reads the same way */
+	before = *st;
+	memset(s_buf, 0, sizeof(s_buf));
+	memset(&job, 0, sizeof(job));
+	job.type = FLASH_JOB_READ;
+	job.addr = BASE;
+	job.buf = s_buf;
+	job.len = 150000;
+	CHECK(flash_job_submit(&job) == 0);
+	CHECK(flash_job_wait(&job) == 0);
+	CHECK(st->dma == before.dma + 3);
+	CHECK(!memcmp(s_buf, mem + BASE, 150000));
+
+	printf("OK\n");
+	return 0;
+}
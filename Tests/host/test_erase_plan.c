@@ -0,0 +1,122 @@
+/*
+ * test_erase_plan.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Erase planner: the sectors which cover a range are erased with the fewest
+ *  64KB/32KB/4KB commands, every command aligned to its size, and nothing
+ *  outside the range. The time is compared with erasing 4KB at a time.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "spi_flash.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define MAX_OPS		64
+
+static struct flash_erase_op	s_ops[MAX_OPS];
+
+/* Check the plan of [addr, addr+size) covers exactly the sectors of the range */
+static int check_plan(uint32_t addr, uint32_t size)
+{
+	uint32_t			start = addr / 4096 * 4096;
+	uint32_t			end = (addr + size + 4095) / 4096 * 4096;
+	uint32_t			next, bigger;
+	int					n, i;
+
+	n = SPI_FLASH_PlanErase(addr, size, s_ops, MAX_OPS);
+	CHECK(n >= 0);
+
+	next = start;
+	for(i=0; i<n; i++)
+	{
+		CHECK(s_ops[i].addr == next);
+		CHECK(s_ops[i].addr % s_ops[i].size == 0);
+		CHECK(s_ops[i].cmd == (s_ops[i].size == 65536 ? 0xD8 : s_ops[i].size == 32768 ? 0x52 : 0x20));
+
+		/* No bigger command would have fitted at this address */
+		for(bigger=32768; bigger<=65536; bigger*=2)
+		{
+			if( bigger > s_ops[i].size )
+				CHECK(s_ops[i].addr % bigger != 0 || s_ops[i].addr + bigger > end);
+		}
+		next += s_ops[i].size;
+	}
+	CHECK(next == end);
+
+	return n;
+}
+
+static int count_ops(uint8_t cmd)
+{
+	return nor_sim_op(NOR_SIM_SPI1, cmd)->count;
+}
+
+int main(void)
+{
+	struct nor_sim_part		part;
+	uint8_t				   *mem;
+	uint64_t				t0, t_plan, t_4k;
+	uint32_t				i, addr, size;
+
+	part = nor_sim_w25q256;
+	sim_init(&part, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+
+	CHECK(SPI_FLASH_PlanErase(0x1000, 0, s_ops, MAX_OPS) == 0);
+
+	/* A few bytes in one sector */
+	CHECK(check_plan(0x1234, 10) == 1);
+	CHECK(s_ops[0].addr == 0x1000 && s_ops[0].size == 4096);
+
+	/* 4KB up to the 32KB boundary, one 32KB, one 64KB, then 32KB and 4KB to the end */
+	CHECK(check_plan(0x1000, 0x2D000) == 16);
+	CHECK(s_ops[7].addr == 0x8000 && s_ops[7].size == 32768);
+	CHECK(s_ops[8].addr == 0x10000 && s_ops[8].size == 65536);
+	CHECK(s_ops[9].addr == 0x20000 && s_ops[9].size == 32768);
+	CHECK(s_ops[10].addr == 0x28000 && s_ops[10].size == 4096);
+
+	/* 1MB aligned is 16 block erases */
+	CHECK(check_plan(0x100000, 0x100000) == 16);
+
+	/* Not enough room for the plan */
+	CHECK(SPI_FLASH_PlanErase(0x1000, 0x2D000, s_ops, 4) == -1);
+
+	/* Random ranges */
+	srand(3);
+	for(i=0; i<2000; i++)
+	{
+		addr = rand() % (4 << 20);
+		size = 1 + rand() % (192 << 10);
+		check_plan(addr, size);
+	}
+
+	/* On the part: the planned commands erase the range and nothing else */
+	memset(mem, 0x00, 0x40000);
+	nor_sim_reset_stats();
+	t0 = sim_now_ns();
+	CHECK(SPI_FLASH_EraseRange(0x1000, 0x2D000) == 0);
+	t_plan = sim_now_ns() - t0;
+	CHECK(count_ops(0x20) == 13 && count_ops(0x52) == 2 && count_ops(0xD8) == 1);
+	CHECK(mem[0xFFF] == 0x00 && mem[0x2E000] == 0x00);
+	for(i=0x1000; i<0x2E000; i++)
+		CHECK(mem[i] == 0xFF);
+
+	/* The same range 4KB at a time */
+	memset(mem, 0x00, 0x40000);
+	t0 = sim_now_ns();
+	for(addr=0x1000; addr<0x2E000; addr+=4096)
+		CHECK(SPI_FLASH_EraseRange(addr, 4096) == 0);
+	t_4k = sim_now_ns() - t0;
+
+	printf("erase 180KB: planned %llu ms, 4KB only %llu ms\n",
+			(unsigned long long)(t_plan / 1000000), (unsigned long long)(t_4k / 1000000));
+	CHECK(t_plan < t_4k);
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,67 @@
+/*
+ * test_file_slots.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  File cache slots of lfs_port_file_open()/lfs_port_file_close(): a slot is
+ *  taken per open file and given back by its close, a second close or the
+ *  close of a file whose open failed is refused and leaves the slots of the
+ *  open files alone.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define SLOTS		4
+
+extern lfs_t 				lfs;
+
+static lfs_file_t			s_file[SLOTS + 1];
+
+int main(void)
+{
+	char					path[16];
+	uint8_t					buf[16];
+	int						i;
+
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	initialize_filesystem();
+
+	/* Every slot in use, one more open fails */
+	for(i=0; i<SLOTS; i++)
+	{
+		sprintf(path, "f%d", i);
+		CHECK(lfs_port_file_open(&lfs, &s_file[i], path, LFS_O_RDWR | LFS_O_CREAT) == 0);
+	}
+	CHECK(lfs_port_file_open(&lfs, &s_file[SLOTS], "f4", LFS_O_RDWR | LFS_O_CREAT) == LFS_ERR_NOMEM);
+
+	/* A close frees one slot, its second close does not free another */
+	CHECK(lfs_port_file_close(&lfs, &s_file[0]) == 0);
+	CHECK(lfs_port_file_open(&lfs, &s_file[SLOTS], "f4", LFS_O_RDWR | LFS_O_CREAT) == 0);
+	CHECK(lfs_port_file_close(&lfs, &s_file[0]) == LFS_ERR_BADF);
+	CHECK(lfs_port_file_open(&lfs, &s_file[0], "f0", LFS_O_RDONLY) == LFS_ERR_NOMEM);
+
+	/* The files still open keep working */
+	CHECK(lfs_file_write(&lfs, &s_file[SLOTS], "slot", 4) == 4);
+	CHECK(lfs_port_file_close(&lfs, &s_file[SLOTS]) == 0);
+
+	/* A failed open takes no slot and cannot be closed */
+	CHECK(lfs_port_file_open(&lfs, &s_file[0], "none", LFS_O_RDONLY) == LFS_ERR_NOENT);
+	CHECK(lfs_port_file_close(&lfs, &s_file[0]) == LFS_ERR_BADF);
+	CHECK(lfs_port_file_open(&lfs, &s_file[0], "f4", LFS_O_RDONLY) == 0);
+	CHECK(lfs_file_read(&lfs, &s_file[0], buf, sizeof(buf)) == 4 && !memcmp(buf, "slot", 4));
+
+	for(i=0; i<SLOTS; i++)
+		CHECK(lfs_port_file_close(&lfs, &s_file[i]) == 0);
+	CHECK(lfs_port_unmount(&lfs) == 0);
+
+	printf("OK\n");
+	return 0;
+}
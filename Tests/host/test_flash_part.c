@@ -0,0 +1,126 @@
+/*
+ * test_flash_part.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Partition table: a blank part gets the built-in layout, a version 1 table
+ *  is migrated to version 2 with the lfshint partition taken from the start
+ *  of scratch and erased, the other partitions stay where they were, and a
+ *  corrupted table is not overwritten. The sim memory is written behind the
+ *  driver, so its page cache is dropped before each table is read.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "crc16.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+/* The layout of the version 1 tables on the field */
+static const struct flash_part		s_v1[] = {
+	{ "ptable",   0x000000, 0x010000,             FLASH_PART_TABLE },
+	{ "image0",   0x010000, 0x270000,             FLASH_PART_RAW },
+	{ "image1",   0x280000, 0x280000,             FLASH_PART_RAW },
+	{ "littlefs", 0x500000, 0x500000,             FLASH_PART_LFS },
+	{ "scratch",  0xA00000, FLASH_PART_SIZE_REST, FLASH_PART_SCRATCH },
+};
+
+static void write_v1(uint8_t *mem, int count)
+{
+	struct flash_part_table		table;
+
+	memset(&table, 0xFF, sizeof(table));
+	table.magic = FLASH_PART_MAGIC;
+	table.version = 1;
+	table.count = count;
+	memcpy(table.part, s_v1, count * sizeof(s_v1[0]));
+	table.crc = crc16_checksum((unsigned char *)&table, offsetof(struct flash_part_table, crc));
+	memcpy(mem + FLASH_PART_TABLE_ADDR, &table, sizeof(table));
+}
+
+static void check_part(const char *name, uint32_t offset, uint32_t size)
+{
+	const struct flash_part	   *part = flash_part_find(name);
+
+	CHECK(part != NULL);
+	CHECK(part->offset == offset && part->size == size);
+}
+
+static uint16_t table_version(const uint8_t *mem)
+{
+	return ((const struct flash_part_table *)(mem + FLASH_PART_TABLE_ADDR))->version;
+}
+
+int main(void)
+{
+	uint8_t				   *mem;
+	uint32_t				i;
+
+	/* Blank part: the built-in version 2 layout is written */
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+	SPI_FLASH_CacheInvalidate(0, SPI_FLASH_GetSize());
+	CHECK(flash_part_init() == 0);
+	CHECK(table_version(mem) == FLASH_PART_VERSION);
+	check_part("ptable", 0, 0x10000);
+	check_part("image0", 0x10000, 0x270000);
+	check_part("littlefs", 0x500000, 0x500000);
+	check_part("lfshint", 0xA00000, 0x10000);
+	check_part("scratch", 0xA10000, (32 << 20) - 0xA10000);
+	flash_part_dump();
+
+	/* Version 1 with data in scratch: lfshint is carved from it and erased */
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	write_v1(mem, 5);
+	memset(mem + 0xA00000, 0x5A, 0x20000);
+	memset(mem + 0x500000, 0x11, 0x1000);
+	CHECK(SPI_FLASH_Init() == 0);
+	SPI_FLASH_CacheInvalidate(0, SPI_FLASH_GetSize());
+	CHECK(flash_part_init() == 0);
+	CHECK(table_version(mem) == FLASH_PART_VERSION);
+	check_part("ptable", 0, 0x10000);
+	check_part("image1", 0x280000, 0x280000);
+	check_part("littlefs", 0x500000, 0x500000);
+	check_part("lfshint", 0xA00000, 0x10000);
+	check_part("scratch", 0xA10000, (32 << 20) - 0xA10000);
+	for(i=0; i<0x10000; i++)
+		CHECK(mem[0xA00000 + i] == 0xFF);
+	CHECK(mem[0xA10000] == 0x5A && mem[0x500000] == 0x11);
+
+	/* Loaded as version 2 from then on, nothing is erased again */
+	memset(mem + 0xA00000, 0x00, 4);
+	SPI_FLASH_CacheInvalidate(0xA00000, 4);
+	CHECK(flash_part_init() == 0);
+	check_part("lfshint", 0xA00000, 0x10000);
+	CHECK(mem[0xA00000] == 0x00);
+
+	/* Version 1 without a scratch partition: no hints, the rest stays */
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	write_v1(mem, 4);
+	CHECK(SPI_FLASH_Init() == 0);
+	SPI_FLASH_CacheInvalidate(0, SPI_FLASH_GetSize());
+	CHECK(flash_part_init() == 0);
+	CHECK(table_version(mem) == FLASH_PART_VERSION);
+	CHECK(flash_part_find("lfshint") == NULL);
+	check_part("littlefs", 0x500000, 0x500000);
+
+	/* A corrupted table: the built-in layout in RAM, the sector is left alone */
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	write_v1(mem, 5);
+	mem[FLASH_PART_TABLE_ADDR + 20] ^= 0x01;
+	CHECK(SPI_FLASH_Init() == 0);
+	SPI_FLASH_CacheInvalidate(0, SPI_FLASH_GetSize());
+	CHECK(flash_part_init() == 0);
+	check_part("lfshint", 0xA00000, 0x10000);
+	CHECK(table_version(mem) == 1);
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * test_lfs_geometry.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  littlefs geometry of init_lfs_config(): the block is the smallest erase of
+ *  the part, the blocks cover the partition up to the end of the part, the
+ *  lookahead has a bit per block and metadata_max bounds the compaction of
+ *  parts with big erase blocks only. Then the upload and mount times and the
+ *  space used of the derived configuration against the old fixed one.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+extern lfs_t 				lfs;
+extern lfs_file_t 			file;
+extern struct lfs_config	cfg;
+
+int init_lfs_config(void);
+
+/* Result of one configuration */
+struct bench
+{
+	uint64_t			upload_us;
+	uint64_t			mount_us;
+	uint32_t			used;		/* bytes in use */
+};
+
+static uint8_t				s_sfdp[256];
+static uint8_t				s_data[32 * 1024];
+
+/* Bring up part on SPI1 and derive the configuration, return the partition */
+static const struct flash_part *setup(const struct nor_sim_part *part)
+{
+	const struct flash_part	   *lfs_part;
+
+	sim_init(part, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	CHECK((lfs_part = flash_part_find("littlefs")) != NULL);
+	CHECK(init_lfs_config() == 0);
+
+	return lfs_part;
+}
+
+static void check_lookahead(void)
+{
+	CHECK(cfg.lookahead_size % 8 == 0);
+	if( cfg.lookahead_size < 256 )
+		CHECK(cfg.lookahead_size * 8 >= cfg.block_count && cfg.lookahead_size * 8 < cfg.block_count + 64);
+}
+
+static void test_config(void)
+{
+	const struct flash_part	   *part;
+	struct nor_sim_part			sim;
+
+	/* W25Q256: 4KB sectors, 1KB caches */
+	part = setup(NULL);
+	CHECK(cfg.block_size == 4096);
+	CHECK(cfg.block_count == part->size / 4096);
+	CHECK(cfg.read_size == 256 && cfg.prog_size == 256 && cfg.cache_size == 1024);
+	CHECK(cfg.metadata_max == 0);
+	check_lookahead();
+	printf("W25Q256: %lu blocks of %lu, cache %lu, lookahead %lu\n",
+			(unsigned long)cfg.block_count, (unsigned long)cfg.block_size, (unsigned long)cfg.cache_size,
+			(unsigned long)cfg.lookahead_size);
+
+	/* A part with 64KB erases only: 64KB blocks, compaction bounded to 4KB */
+	sim = nor_sim_w25q256;
+	sim.jedec_id = 0xEF4099;
+	sim.sfdp_len = nor_sim_build_sfdp(&sim, s_sfdp, sizeof(s_sfdp));
+	memset(s_sfdp + 0x80 + 28, 0, 8);
+	s_sfdp[0x80 + 28] = 16;
+	s_sfdp[0x80 + 29] = 0xD8;
+	sim.sfdp = s_sfdp;
+	part = setup(&sim);
+	CHECK(SPI_FLASH_GetInfo()->erase[0].size == 65536 && SPI_FLASH_GetInfo()->erase[1].size == 0);
+	CHECK(cfg.block_size == 65536 && cfg.block_count == part->size / 65536);
+	CHECK(cfg.metadata_max == 4096);
+	check_lookahead();
+
+	/* A part smaller than the partition table: the blocks stop at the end of the part */
+	sim = nor_sim_w25q256;
+	sim.jedec_id = 0xEF4099;
+	sim.size = 8 << 20;
+	sim.addr_mode = FLASH_ADDR_3BYTE;
+	part = setup(&sim);
+	CHECK(part->offset < sim.size);
+	CHECK(cfg.block_size == 4096 && cfg.block_count == (sim.size - part->offset) / 4096);
+	check_lookahead();
+}
+
+/* Format with the configuration in cfg, write a firmware image and small files
+ * in 1KB chunks, then mount again. Fill in the upload and mount times and the
+ * bytes in use */
+static void run_workload(const char *name, struct bench *res)
+{
+	char					path[16];
+	uint64_t				t0;
+	uint32_t				off, len, size;
+	lfs_ssize_t				used;
+	int						i;
+
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+	CHECK(lfs_format(&lfs, &cfg) == 0);
+	CHECK(lfs_mount(&lfs, &cfg) == 0);
+
+	t0 = sim_now_ns();
+	for(i=0; i<24; i++)
+	{
+		size = i == 0 ? sizeof(s_data) : 64 + i * 40;
+		sprintf(path, "f%d", i);
+		CHECK(lfs_port_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) == 0);
+		for(off=0; off<size; off+=len)
+		{
+			len = size - off > 1024 ? 1024 : size - off;
+			CHECK(lfs_file_write(&lfs, &file, s_data + off, len) == (lfs_ssize_t)len);
+		}
+		CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	}
+	CHECK(lfs_sync(&cfg) == 0);
+	res->upload_us = (sim_now_ns() - t0) / 1000;
+
+	CHECK((used = lfs_fs_size(&lfs)) > 0);
+	res->used = used * cfg.block_size;
+	CHECK(lfs_unmount(&lfs) == 0);
+
+	t0 = sim_now_ns();
+	CHECK(lfs_mount(&lfs, &cfg) == 0);
+	res->mount_us = (sim_now_ns() - t0) / 1000;
+
+	CHECK(lfs_port_file_open(&lfs, &file, "f0", LFS_O_RDONLY) == 0);
+	CHECK(lfs_file_size(&lfs, &file) == sizeof(s_data));
+	CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	CHECK(lfs_unmount(&lfs) == 0);
+
+	printf("%-8s %6lu x %-5lu cache %4lu lookahead %3lu: upload %7llu us, mount %6llu us, %7lu B used\n",
+			name, (unsigned long)cfg.block_count, (unsigned long)cfg.block_size, (unsigned long)cfg.cache_size,
+			(unsigned long)cfg.lookahead_size, (unsigned long long)res->upload_us,
+			(unsigned long long)res->mount_us, (unsigned long)res->used);
+}
+
+static void test_bench(void)
+{
+	struct bench			derived, fixed, small;
+
+	/* Derived from the part */
+	setup(NULL);
+	run_workload("derived", &derived);
+
+	/* The fixed configuration before: 64 x 64KB blocks, one page caches */
+	setup(NULL);
+	cfg.block_size = 65536;
+	cfg.block_count = 64;
+	cfg.cache_size = 256;
+	cfg.lookahead_size = 16;
+	run_workload("64KB", &fixed);
+
+	/* 4KB blocks with one page caches */
+	setup(NULL);
+	cfg.cache_size = 256;
+	run_workload("4KB/256", &small);
+
+	/* Small files take a 4KB block instead of a 64KB one, and a compaction erases
+	 * 4KB; the bigger caches cost a little mount time and save upload time */
+	CHECK(derived.used * 8 < fixed.used);
+	CHECK(derived.upload_us < fixed.upload_us && derived.upload_us < small.upload_us);
+	CHECK(derived.mount_us < fixed.mount_us);
+}
+
+int main(void)
+{
+	uint32_t				i;
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 3 + (i >> 10);
+
+	test_config();
+	test_bench();
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,320 @@
+/*
+ * test_lfs_hint.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  littlefs mount hint, with the port built with CONFIG_LFS_MOUNT_HINT: a mount
+ *  from the hint allocates the same blocks as a full lfs_mount() of the same
+ *  flash for less reading, a commit to a subdirectory by another writer, a
+ *  corrupted record and a record which passes its CRC but not the flash all
+ *  fall back to the full mount, and the hint partition is erased once its
+ *  slots are used up.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "crc16.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define HINT_MAGIC		0x48534C46
+#define HINT_SLOT		512
+
+/* The record of littlefs_port.c */
+struct hint_rec
+{
+	uint32_t					magic;
+	uint32_t					generation;
+	struct lfs_mount_hint		hint;
+	uint16_t					crc;
+	uint16_t					reserved;
+	uint32_t					state;
+};
+
+extern lfs_t 				lfs;
+extern lfs_file_t 			file;
+extern struct lfs_config	cfg;
+
+static const struct flash_part *s_part;
+static const struct flash_part *s_hint_part;
+static uint8_t				   *s_mem;
+
+static uint8_t				s_data[16 * 1024];
+static uint8_t				s_buf[16 * 1024];
+static uint8_t				s_image[0x510000];	/* littlefs and lfshint */
+static uint8_t				s_after[0x500000];
+
+/* Another writer on the same flash, which does not know about the hint */
+static lfs_t				s_other;
+static struct lfs_config	s_other_cfg;
+static uint8_t				s_other_cache[1024];
+
+static int other_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size)
+{
+	New_SPI_FLASH_BufferRead(s_part->offset + block * c->block_size + off, buffer, size);
+	return 0;
+}
+
+static int other_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+	return New_SPI_FLASH_PageWrite((uint8_t *)buffer, s_part->offset + block * c->block_size + off, size) < 0 ? LFS_ERR_IO : 0;
+}
+
+static int other_erase(const struct lfs_config *c, lfs_block_t block)
+{
+	return SPI_FLASH_EraseRange(s_part->offset + block * c->block_size, c->block_size) < 0 ? LFS_ERR_IO : 0;
+}
+
+static int other_sync(const struct lfs_config *c)
+{
+	return SPI_FLASH_WriteFlush() < 0 ? LFS_ERR_IO : 0;
+}
+
+static struct hint_rec *record(int slot)
+{
+	return (struct hint_rec *)(s_mem + s_hint_part->offset + slot * HINT_SLOT);
+}
+
+/* Index of the last record, -1 if there is none */
+static int last_slot(void)
+{
+	int							slot;
+
+	for(slot=0; (slot + 1) * HINT_SLOT <= s_hint_part->size; slot++)
+	{
+		if( record(slot)->magic != HINT_MAGIC )
+			break;
+	}
+	return slot - 1;
+}
+
+/* Mount through the port, return 1 if it was from the hint: the lookahead is already
+ * filled, a full mount leaves it to the first allocation */
+static int port_mount(void)
+{
+	CHECK(lfs_port_mount(&lfs) == 0);
+	return lfs.lookahead.size > 0;
+}
+
+static void write_file(lfs_t *fs, const char *path, uint32_t size, int flags)
+{
+	struct lfs_file_config		fcfg = { .buffer = s_other_cache };
+	lfs_file_t					f;
+
+	if( fs == &lfs )
+	{
+		CHECK(lfs_port_file_open(fs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | flags) == 0);
+		CHECK(lfs_file_write(fs, &file, s_data, size) == (lfs_ssize_t)size);
+		CHECK(lfs_port_file_close(fs, &file) == 0);
+	}
+	else
+	{
+		CHECK(lfs_file_opencfg(fs, &f, path, LFS_O_WRONLY | LFS_O_CREAT | flags, &fcfg) == 0);
+		CHECK(lfs_file_write(fs, &f, s_data, size) == (lfs_ssize_t)size);
+		CHECK(lfs_file_close(fs, &f) == 0);
+	}
+}
+
+/* The file holds the first size bytes of s_data, or an append of the first size - first
+ * bytes after the first first ones */
+static void check_file(const char *path, uint32_t first, uint32_t size)
+{
+	CHECK(lfs_port_file_open(&lfs, &file, path, LFS_O_RDONLY) == 0);
+	CHECK(lfs_file_size(&lfs, &file) == (lfs_soff_t)size);
+	CHECK(lfs_file_read(&lfs, &file, s_buf, first) == (lfs_ssize_t)first);
+	CHECK(!memcmp(s_buf, s_data, first));
+	CHECK(lfs_file_read(&lfs, &file, s_buf, size - first) == (lfs_ssize_t)(size - first));
+	CHECK(!memcmp(s_buf, s_data, size - first));
+	CHECK(lfs_port_file_close(&lfs, &file) == 0);
+}
+
+static void save_image(void)
+{
+	CHECK(SPI_FLASH_WriteFlush() == 0);
+	memcpy(s_image, s_mem + s_part->offset, sizeof(s_image));
+}
+
+static void load_image(void)
+{
+	memcpy(s_mem + s_part->offset, s_image, sizeof(s_image));
+	SPI_FLASH_CacheInvalidate(s_part->offset, sizeof(s_image));
+}
+
+/* New files in the root and in d after a mount, the blocks they take come from the
+ * lookahead the mount left */
+static void workload(void)
+{
+	char						path[16];
+	int							i;
+
+	for(i=0; i<4; i++)
+	{
+		sprintf(path, "n%d", i);
+		write_file(&lfs, path, 3000 + i * 2500, LFS_O_TRUNC);
+	}
+	write_file(&lfs, "d/log", 6000, LFS_O_APPEND);
+	CHECK(lfs_sync(&cfg) == 0);
+	CHECK(SPI_FLASH_WriteFlush() == 0);
+}
+
+/* The hinted mount gets the seed of a full one and then allocates the same blocks */
+static void test_same_alloc(void)
+{
+	uint32_t					seed, bytes_hint, bytes_full;
+
+	save_image();
+	SPI_FLASH_ResetStats();
+	CHECK(port_mount());
+	seed = lfs.seed;
+	workload();
+	bytes_hint = SPI_FLASH_GetStats()->bytes_read;
+	CHECK(lfs_unmount(&lfs) == 0);
+	memcpy(s_after, s_mem + s_part->offset, sizeof(s_after));
+
+	load_image();
+	SPI_FLASH_ResetStats();
+	CHECK(lfs_mount(&lfs, &cfg) == 0);
+	CHECK(lfs.seed == seed);
+	workload();
+	bytes_full = SPI_FLASH_GetStats()->bytes_read;
+	CHECK(lfs_unmount(&lfs) == 0);
+
+	CHECK(!memcmp(s_after, s_mem + s_part->offset, sizeof(s_after)));
+	printf("hint: mount and writes read %lu B from the hint, %lu B after lfs_mount\n",
+			(unsigned long)bytes_hint, (unsigned long)bytes_full);
+	CHECK(bytes_hint < bytes_full);
+	load_image();
+}
+
+/* Another writer appends to d/log: only the pair of d changes, the hint must not be used */
+static void test_other_writer(void)
+{
+	int							slot = last_slot();
+
+	save_image();
+	CHECK(lfs_mount(&s_other, &s_other_cfg) == 0);
+	write_file(&s_other, "d/log", 12000, LFS_O_APPEND);
+	CHECK(lfs_unmount(&s_other) == 0);
+	CHECK(SPI_FLASH_WriteFlush() == 0);
+	CHECK(!memcmp(s_mem + s_part->offset, s_image, 2 * cfg.block_size));
+	CHECK(record(slot)->state == 0xFFFFFFFF);
+
+	CHECK(!port_mount());
+	CHECK(record(slot)->state != 0xFFFFFFFF);
+
+	/* The blocks of the other writer are not handed out again */
+	write_file(&lfs, "n9", sizeof(s_data), LFS_O_TRUNC);
+	check_file("d/log", 10000, 10000 + 12000);
+	check_file("n9", sizeof(s_data), sizeof(s_data));
+	CHECK(lfs_port_unmount(&lfs) == 0);
+	CHECK(last_slot() == slot + 1 && record(slot + 1)->generation == record(slot)->generation + 1);
+	CHECK(port_mount());
+	check_file("d/log", 10000, 10000 + 12000);
+	CHECK(lfs_port_unmount(&lfs) == 0);
+}
+
+/* A record which fails its CRC, then one with a valid CRC whose seed is not the flash's */
+static void test_bad_record(void)
+{
+	struct hint_rec			   *rec;
+	int							slot = last_slot();
+
+	rec = record(slot);
+	rec->hint.bitmap[3] ^= 0x10;
+	SPI_FLASH_CacheInvalidate(s_hint_part->offset, s_hint_part->size);
+	CHECK(!port_mount());
+	check_file("n9", sizeof(s_data), sizeof(s_data));
+	CHECK(lfs_port_unmount(&lfs) == 0);
+
+	/* The mount did not use the hint, a new one is saved */
+	CHECK(last_slot() == slot + 1);
+	rec = record(slot + 1);
+	CHECK(rec->generation == record(slot)->generation + 1);
+	rec->hint.seed ^= 0x01;
+	rec->crc = crc16_checksum((unsigned char *)rec, offsetof(struct hint_rec, crc));
+	SPI_FLASH_CacheInvalidate(s_hint_part->offset, s_hint_part->size);
+	CHECK(!port_mount());
+	CHECK(rec->state != 0xFFFFFFFF);
+	write_file(&lfs, "n8", 100, LFS_O_TRUNC);
+	CHECK(lfs_port_unmount(&lfs) == 0);
+	CHECK(last_slot() == slot + 2);
+	CHECK(port_mount());
+	CHECK(lfs_port_unmount(&lfs) == 0);
+}
+
+/* Records until the partition is full, the next one erases it and goes to slot 0 */
+static void test_wrap(void)
+{
+	uint32_t					generation = 0;
+	int							slots = s_hint_part->size / HINT_SLOT;
+	int							n, slot;
+
+	for(n=0; n<=slots; n++)
+	{
+		slot = last_slot();
+		generation = record(slot)->generation;
+		CHECK(port_mount());
+		write_file(&lfs, "w", 200 + n, LFS_O_TRUNC);
+		CHECK(lfs_port_unmount(&lfs) == 0);
+
+		if( slot == slots - 1 )
+			break;
+		CHECK(last_slot() == slot + 1);
+	}
+	CHECK(n < slots);
+
+	/* The partition was erased, the generation goes on */
+	CHECK(last_slot() == 0 && record(0)->generation == generation + 1);
+	CHECK(record(1)->magic == 0xFFFFFFFF && record(slots - 1)->magic == 0xFFFFFFFF);
+	CHECK(port_mount());
+	CHECK(lfs_port_unmount(&lfs) == 0);
+}
+
+int main(void)
+{
+	char						path[16];
+	uint32_t					i;
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 13 + (i >> 8);
+
+	sim_init(NULL, NULL);
+	s_mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+	s_part = flash_part_find("littlefs");
+	s_hint_part = flash_part_find("lfshint");
+	CHECK(s_part && s_hint_part && s_hint_part->offset == s_part->offset + s_part->size);
+	CHECK(sizeof(struct hint_rec) <= HINT_SLOT);
+
+	/* Files in the root and a subdirectory with its own metadata pair */
+	initialize_filesystem();
+	CHECK(lfs_mkdir(&lfs, "d") == 0);
+	write_file(&lfs, "d/log", 10000, 0);
+	for(i=0; i<6; i++)
+	{
+		sprintf(path, "f%lu", (unsigned long)i);
+		write_file(&lfs, path, 2000 + i * 2000, 0);
+	}
+	CHECK(lfs_port_unmount(&lfs) == 0);
+	CHECK(last_slot() == 0 && record(0)->generation == 0);
+
+	s_other_cfg = cfg;
+	s_other_cfg.read = other_read;
+	s_other_cfg.prog = other_prog;
+	s_other_cfg.erase = other_erase;
+	s_other_cfg.sync = other_sync;
+	CHECK(cfg.cache_size <= sizeof(s_other_cache));
+
+	test_same_alloc();
+	test_other_writer();
+	test_bad_record();
+	test_wrap();
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,203 @@
+/*
+ * test_lfs_pair.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  littlefs on the pair of the SPI1 and SPI3 simulated parts, built twice with
+ *  the port and this file compiled with CONFIG_LFS_STRIPED or CONFIG_LFS_MIRRORED
+ *  (build/test_lfs_stripe, build/test_lfs_mirror). Both builds first check the
+ *  stripe and the mirror devices: the stripes land on the part and at the
+ *  address of the split, the partition of the SPI1 map is the same
+ *  range on both parts, the jobs of SPI1 overlap the blocking SPI3 operations,
+ *  and the files read back after a new mount.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "spi3_flash.h"
+#include "flash_dev.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#if !defined(CONFIG_LFS_STRIPED) && !defined(CONFIG_LFS_MIRRORED)
+#error "build with CONFIG_LFS_STRIPED or CONFIG_LFS_MIRRORED"
+#endif
+
+#define STRIPE			4096
+#define FILES			8
+
+extern lfs_t 				lfs;
+extern lfs_file_t 			file;
+extern struct lfs_config	cfg;
+
+static uint8_t				s_data[48 * 1024];
+static uint8_t				s_buf[48 * 1024];
+
+static uint32_t file_size(int f)
+{
+	return f == 0 ? sizeof(s_data) : 100 + f * 1500;
+}
+
+static int blank(const uint8_t *p, uint32_t len)
+{
+	uint32_t				i;
+
+	for(i=0; i<len; i++)
+	{
+		if( p[i] != 0xFF )
+			return 0;
+	}
+	return 1;
+}
+
+/* Pair addresses on the parts: stripe n is on part n & 1 at (n >> 1) * STRIPE, an
+ * erase of the pair is the half range on both, at the same time */
+static void test_split(void)
+{
+	struct flash_dev		pair;
+	uint8_t				   *mem1 = nor_sim_mem(NOR_SIM_SPI1);
+	uint8_t				   *mem3 = nor_sim_mem(NOR_SIM_SPI3);
+	uint32_t				base = 0x1800000;	/* 0xC00000 on both parts */
+	uint64_t				t0, erase_us;
+
+	CHECK(flash_dev_stripe_init(&pair, &flash_dev_spi1, &flash_dev_spi3, STRIPE) == 0);
+	CHECK(pair.erase_size == 2 * 4096 && pair.size == 2 * (16 << 20));
+
+	memset(mem1 + base / 2, 0x00, 2 * STRIPE);
+	memset(mem3 + base / 2, 0x00, 2 * STRIPE);
+	t0 = sim_now_ns();
+	CHECK(flash_dev_erase(&pair, base, 4 * STRIPE) == 0);
+	erase_us = (sim_now_ns() - t0) / 1000;
+	CHECK(blank(mem1 + base / 2, 2 * STRIPE) && blank(mem3 + base / 2, 2 * STRIPE));
+	printf("stripe: 16KB erase of the pair %llu us\n", (unsigned long long)erase_us);
+	/* Two sectors on each part, the SPI1 job runs while SPI3 erases */
+	CHECK(erase_us >= 2 * nor_sim_w25q256.t.tse_us && erase_us < 2 * nor_sim_w25q256.t.tse_us + 5000);
+	CHECK(flash_dev_erase(&pair, base + 4096, 8192) == -2);
+
+	/* From the middle of stripe 0 to the middle of stripe 3 */
+	CHECK(flash_dev_prog(&pair, base + 1000, s_data, 3 * STRIPE) == 0);
+	CHECK(flash_dev_sync(&pair) == 0);
+	CHECK(!memcmp(mem1 + base / 2 + 1000, s_data, STRIPE - 1000));
+	CHECK(!memcmp(mem3 + base / 2, s_data + STRIPE - 1000, STRIPE));
+	CHECK(!memcmp(mem1 + base / 2 + STRIPE, s_data + 2 * STRIPE - 1000, STRIPE));
+	CHECK(!memcmp(mem3 + base / 2 + STRIPE, s_data + 3 * STRIPE - 1000, 1000));
+	CHECK(blank(mem3 + base / 2 + STRIPE + 1000, STRIPE - 1000));
+
+	memset(s_buf, 0, 3 * STRIPE);
+	CHECK(flash_dev_read(&pair, base + 1000, s_buf, 3 * STRIPE) == 0);
+	CHECK(!memcmp(s_buf, s_data, 3 * STRIPE));
+	CHECK(flash_dev_read(&pair, pair.size - 16, s_buf, 32) == -2);
+}
+
+/* Both parts hold the same data, long reads are split over them */
+static void test_mirror(void)
+{
+	struct flash_dev		pair;
+	uint8_t				   *mem1 = nor_sim_mem(NOR_SIM_SPI1);
+	uint8_t				   *mem3 = nor_sim_mem(NOR_SIM_SPI3);
+	uint32_t				base = 0xC00000;
+	uint32_t				reads1, reads3;
+
+	CHECK(flash_dev_mirror_init(&pair, &flash_dev_spi1, &flash_dev_spi3) == 0);
+	CHECK(pair.erase_size == 4096 && pair.size == 16 << 20);
+
+	memset(mem1 + base, 0x00, 8192);
+	memset(mem3 + base, 0x00, 8192);
+	CHECK(flash_dev_erase(&pair, base, 8192) == 0);
+	CHECK(flash_dev_prog(&pair, base + 100, s_data, 8000) == 0);
+	CHECK(flash_dev_sync(&pair) == 0);
+	CHECK(!memcmp(mem1 + base + 100, s_data, 8000) && !memcmp(mem3 + base + 100, s_data, 8000));
+
+	/* A long read takes half from each part: the SPI3 half is in the data of its part */
+	mem3[base + 8000] ^= 0x01;
+	reads1 = SPI_FLASH_GetStats()->bytes_read;
+	reads3 = nor_sim_op(NOR_SIM_SPI3, SPI3_FLASH_GetInfo()->fast_read_cmd)->bytes;
+	CHECK(flash_dev_read(&pair, base + 100, s_buf, 8000) == 0);
+	CHECK(s_buf[7900] == (s_data[7900] ^ 0x01));
+	mem3[base + 8000] ^= 0x01;
+	CHECK(SPI_FLASH_GetStats()->bytes_read - reads1 < 8000);
+	CHECK(nor_sim_op(NOR_SIM_SPI3, SPI3_FLASH_GetInfo()->fast_read_cmd)->bytes - reads3 < 8000);
+}
+
+/* Files on the pair, a new mount reads them back */
+static void test_lfs(void)
+{
+	const struct flash_part	   *part = flash_part_find("littlefs");
+	uint8_t					   *mem1 = nor_sim_mem(NOR_SIM_SPI1);
+	uint8_t					   *mem3 = nor_sim_mem(NOR_SIM_SPI3);
+	char						path[16];
+	uint32_t					off, len;
+	int							f;
+
+	initialize_filesystem();
+#if defined(CONFIG_LFS_STRIPED)
+	/* Twice the partition of the SPI1 map, in blocks of a sector of each part */
+	CHECK(cfg.block_size == 2 * 4096);
+	CHECK(cfg.block_count == 2 * part->size / cfg.block_size);
+#else
+	CHECK(cfg.block_size == 4096);
+	CHECK(cfg.block_count == part->size / cfg.block_size);
+#endif
+
+	for(f=0; f<FILES; f++)
+	{
+		sprintf(path, "f%d", f);
+		CHECK(lfs_port_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) == 0);
+		for(off=0; off<file_size(f); off+=len)
+		{
+			len = file_size(f) - off > 1000 ? 1000 : file_size(f) - off;
+			CHECK(lfs_file_write(&lfs, &file, s_data + off, len) == (lfs_ssize_t)len);
+		}
+		CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	}
+	CHECK(lfs_port_unmount(&lfs) == 0);
+
+	/* Everything is inside the partition on both parts */
+	CHECK(blank(mem1 + 0x10000, part->offset - 0x10000));
+	CHECK(blank(mem3, part->offset));
+	CHECK(blank(mem1 + part->offset + part->size, 0x100000));
+	CHECK(blank(mem3 + part->offset + part->size, 0x100000));
+	CHECK(!blank(mem1 + part->offset, part->size) && !blank(mem3 + part->offset, part->size));
+#if defined(CONFIG_LFS_MIRRORED)
+	CHECK(!memcmp(mem1 + part->offset, mem3 + part->offset, part->size));
+#endif
+
+	CHECK(lfs_mount(&lfs, &cfg) == 0);
+	for(f=0; f<FILES; f++)
+	{
+		sprintf(path, "f%d", f);
+		memset(s_buf, 0, file_size(f));
+		CHECK(lfs_port_file_open(&lfs, &file, path, LFS_O_RDONLY) == 0);
+		CHECK(lfs_file_read(&lfs, &file, s_buf, sizeof(s_buf)) == (lfs_ssize_t)file_size(f));
+		CHECK(!memcmp(s_buf, s_data, file_size(f)));
+		CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	}
+	CHECK(lfs_port_unmount(&lfs) == 0);
+}
+
+int main(void)
+{
+	uint32_t				i;
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 11 + (i >> 9);
+
+	/* W25Q256 on SPI1, W25Q128 on SPI3 */
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	CHECK(flash_dev_init() == 0);
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+
+	test_split();
+	test_mirror();
+	test_lfs();
+
+	nor_sim_report(NOR_SIM_SPI1);
+	nor_sim_report(NOR_SIM_SPI3);
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * test_prog_verify.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Program policies of the job engine against the blocking driver: pages of
+ *  0xFF are not programmed and, with program verification on, a program which
+ *  does not read back fails. The littlefs port queues its small programs as
+ *  jobs, the failure comes back from the next lfs_sync().
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_job.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define BASE		0x40000
+
+extern struct lfs_config	cfg;
+
+static uint8_t				s_data[768];
+
+static int count_prog(void)
+{
+	return nor_sim_op(NOR_SIM_SPI1, 0x02)->count;
+}
+
+static int run_job(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	struct flash_job		job;
+
+	memset(&job, 0, sizeof(job));
+	job.type = FLASH_JOB_PROGRAM;
+	job.addr = addr;
+	job.buf = buf;
+	job.len = len;
+	CHECK(flash_job_submit(&job) == 0);
+	return flash_job_wait(&job);
+}
+
+/* Fill the page with 0x00 behind the driver, a program there cannot read back */
+static void spoil(uint8_t *mem, uint32_t addr, uint32_t len)
+{
+	memset(mem + addr, 0x00, len);
+	SPI_FLASH_CacheInvalidate(addr, len);
+}
+
+int main(void)
+{
+	const struct spi_flash_stats   *st;
+	const struct flash_part		   *part;
+	uint8_t						   *mem;
+	uint32_t						addr, reads, i;
+
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	st = SPI_FLASH_GetStats();
+
+	/* Three pages, the middle one all 0xFF */
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i < 256 || i >= 512 ? i * 3 + 1 : 0xFF;
+
+	/* Blocking and job programs both skip the blank page */
+	nor_sim_reset_stats();
+	SPI_FLASH_ResetStats();
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE, sizeof(s_data)) == 0);
+	CHECK(count_prog() == 2 && st->prog_skipped == 1);
+	nor_sim_reset_stats();
+	SPI_FLASH_ResetStats();
+	CHECK(run_job(BASE + 4096, s_data, sizeof(s_data)) == 0);
+	CHECK(count_prog() == 2 && st->prog_skipped == 1);
+	CHECK(!memcmp(mem + BASE + 4096, s_data, sizeof(s_data)));
+
+	/* A job of 0xFF only finishes without a command */
+	nor_sim_reset_stats();
+	CHECK(run_job(BASE + 4096 + 256, s_data + 256, 256) == 0);
+	CHECK(count_prog() == 0);
+
+	/* Verification off: a page which does not take the data is not noticed */
+	spoil(mem, BASE + 8192, 256);
+	reads = st->bytes_read;
+	CHECK(run_job(BASE + 8192, s_data, 256) == 0);
+	CHECK(st->bytes_read == reads);
+
+	/* On: both paths read the program back and fail the same way */
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_PROGRAM, SPI_FLASH_VERIFY_COMPARE);
+	CHECK(run_job(BASE + 12288, s_data, sizeof(s_data)) == 0);
+	CHECK(st->bytes_read - reads == sizeof(s_data));
+	spoil(mem, BASE + 16384, 256);
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE + 16384, 256) == -1);
+	spoil(mem, BASE + 20480, 256);
+	CHECK(run_job(BASE + 20480, s_data, 256) == -1);
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_PROGRAM, SPI_FLASH_VERIFY_HASH);
+	CHECK(run_job(BASE + 20480, s_data, 256) == -1);
+
+	/* littlefs: the queued program of a spoilt block fails its sync, an erase fixes it */
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_PROGRAM, SPI_FLASH_VERIFY_COMPARE);
+	initialize_filesystem();
+	part = flash_part_find("littlefs");
+	addr = part->offset + (cfg.block_count - 1) * cfg.block_size;
+	CHECK(lfs_SectorErase(&cfg, cfg.block_count - 1) == 0);
+	spoil(mem, addr, 256);
+	CHECK(lfs_write(&cfg, cfg.block_count - 1, 0, s_data, 256) == LFS_ERR_OK);
+	CHECK(lfs_sync(&cfg) == LFS_ERR_IO);
+	CHECK(lfs_sync(&cfg) == LFS_ERR_OK);
+
+	CHECK(lfs_SectorErase(&cfg, cfg.block_count - 1) == 0);
+	nor_sim_reset_stats();
+	CHECK(lfs_write(&cfg, cfg.block_count - 1, 0, s_data, 512) == LFS_ERR_OK);
+	CHECK(lfs_sync(&cfg) == LFS_ERR_OK);
+	CHECK(count_prog() == 1 && !memcmp(mem + addr, s_data, 512));
+
+	printf("OK\n");
+	return 0;
+}
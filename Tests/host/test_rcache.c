@@ -0,0 +1,161 @@
+/*
+ * test_rcache.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  littlefs read cache lines, with the port built with CONFIG_LFS_RCACHE: the
+ *  same filesystem is mounted and read with rcache_lines 0, the baseline, and
+ *  with the lines of the port. The reads take turns with lookups of another
+ *  file like a directory walk does, the lines must read fewer bytes from the
+ *  flash in less time and return the same data.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_part.h"
+#include "littlefs_port.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define FILES			12
+#define CHUNK			512
+
+extern lfs_t 				lfs;
+extern lfs_file_t 			file;
+extern struct lfs_config	cfg;
+
+/* Result of one run */
+struct bench
+{
+	uint64_t			mount_us;
+	uint64_t			read_us;
+	uint32_t			mount_bytes;	/* read from the flash by the mount */
+	uint32_t			read_bytes;
+	uint32_t			cache_hits;		/* pages served by the driver page cache */
+};
+
+static uint8_t				s_data[80 * 1024];
+static uint8_t				s_read[80 * 1024];
+
+static uint32_t file_size(int f)
+{
+	return 3000 + f * 7000;
+}
+
+static void fill(int f)
+{
+	uint32_t				i;
+
+	for(i=0; i<file_size(f); i++)
+		s_data[i] = i * 7 + f;
+}
+
+/* Files of 3KB to 80KB in three directories, written in 1KB chunks */
+static void populate(void)
+{
+	char					path[16];
+	uint32_t				off, len;
+	int						f;
+
+	for(f=0; f<3; f++)
+	{
+		sprintf(path, "d%d", f);
+		CHECK(lfs_mkdir(&lfs, path) == 0);
+	}
+	for(f=0; f<FILES; f++)
+	{
+		fill(f);
+		sprintf(path, "d%d/f%d", f % 3, f);
+		CHECK(lfs_port_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) == 0);
+		for(off=0; off<file_size(f); off+=len)
+		{
+			len = file_size(f) - off > 1024 ? 1024 : file_size(f) - off;
+			CHECK(lfs_file_write(&lfs, &file, s_data + off, len) == (lfs_ssize_t)len);
+		}
+		CHECK(lfs_port_file_close(&lfs, &file) == 0);
+	}
+	CHECK(lfs_port_unmount(&lfs) == 0);
+}
+
+/* Mount with lines read cache lines, then read every file twice in CHUNK reads
+ * with a lookup of another file after each read */
+static void run_workload(lfs_size_t lines, struct bench *res)
+{
+	char					path[16];
+	struct lfs_info			info;
+	uint64_t				t0;
+	uint32_t				off, len;
+	int						rep, f;
+
+	cfg.rcache_lines = lines;
+	SPI_FLASH_CacheInvalidate(0, SPI_FLASH_GetSize());
+	SPI_FLASH_ResetStats();
+	t0 = sim_now_ns();
+	CHECK(lfs_mount(&lfs, &cfg) == 0);
+	res->mount_us = (sim_now_ns() - t0) / 1000;
+	res->mount_bytes = SPI_FLASH_GetStats()->bytes_read;
+
+	SPI_FLASH_ResetStats();
+	t0 = sim_now_ns();
+	for(rep=0; rep<2; rep++)
+	{
+		for(f=0; f<FILES; f++)
+		{
+			sprintf(path, "d%d/f%d", f % 3, f);
+			CHECK(lfs_port_file_open(&lfs, &file, path, LFS_O_RDONLY) == 0);
+			for(off=0; off<file_size(f); off+=len)
+			{
+				len = file_size(f) - off > CHUNK ? CHUNK : file_size(f) - off;
+				CHECK(lfs_file_read(&lfs, &file, s_read + off, len) == (lfs_ssize_t)len);
+				CHECK(lfs_stat(&lfs, "d1/f1", &info) == 0 && info.size == file_size(1));
+			}
+			CHECK(lfs_port_file_close(&lfs, &file) == 0);
+
+			fill(f);
+			CHECK(!memcmp(s_read, s_data, file_size(f)));
+		}
+	}
+	res->read_us = (sim_now_ns() - t0) / 1000;
+	res->read_bytes = SPI_FLASH_GetStats()->bytes_read;
+	res->cache_hits = SPI_FLASH_GetStats()->cache_hits;
+
+	lfs_port_rcache_report(&lfs);
+	CHECK(lfs_port_unmount(&lfs) == 0);
+
+	printf("rcache %lu lines: mount %6llu us %7lu B, reads %8llu us %8lu B, %6lu page cache hits\n",
+			(unsigned long)lines, (unsigned long long)res->mount_us, (unsigned long)res->mount_bytes,
+			(unsigned long long)res->read_us, (unsigned long)res->read_bytes, (unsigned long)res->cache_hits);
+}
+
+int main(void)
+{
+	struct bench			base, lines;
+	lfs_size_t				count, n;
+
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_part_init() == 0);
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+	initialize_filesystem();
+	count = cfg.rcache_lines;
+	CHECK(count > 0 && cfg.rcache_buffer != NULL && cfg.rcache_line_size == cfg.read_size);
+	populate();
+
+	/* Fewer lines for the curve, the last run is the port configuration */
+	run_workload(0, &base);
+	for(n=1; n<count; n*=2)
+		run_workload(n, &lines);
+	run_workload(count, &lines);
+
+	/* The metadata of the lookups stays in a line across the data reads */
+	CHECK(lines.read_bytes < base.read_bytes);
+	CHECK(lines.read_us < base.read_us);
+	CHECK(lines.mount_bytes <= base.mount_bytes);
+	printf("rcache: %lu%% of the baseline bytes, %llu%% of its time\n",
+			(unsigned long)((uint64_t)lines.read_bytes * 100 / base.read_bytes),
+			(unsigned long long)(lines.read_us * 100 / base.read_us));
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * test_sfdp.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  BFPT parser on the SFDP spaces of the parts in the known table, and the
+ *  4-byte address mode selection with the method and status bit it found.
+ *  The dumps are the datasheet SFDP tables of the parts, byte for byte in
+ *  SFDP address order; BFPT DWORDs are shown as the 32-bit values.
+ */
+
+#include <string.h>
+#include "sfdp.h"
+#include "spi_flash.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define DW(v)		(v) & 0xFF, ((v) >> 8) & 0xFF, ((v) >> 16) & 0xFF, ((uint32_t)(v) >> 24) & 0xFF
+
+/* W25Q256JV: SFDP 1.6, BFPT at 0x80 and 4-byte address instruction table at 0xD0 */
+static const uint8_t		s_w25q256jv[] = {
+	/* 0x00 */ 'S', 'F', 'D', 'P', 0x06, 0x01, 0x01, 0xFF,
+	/* 0x08 */ 0x00, 0x06, 0x01, 0x10, 0x80, 0x00, 0x00, 0xFF,
+	/* 0x10 */ 0x84, 0x00, 0x01, 0x02, 0xD0, 0x00, 0x00, 0xFF,
+	[0x80] =
+	DW(0xFFFB20E5), DW(0x0FFFFFFF), DW(0x6B08EB44), DW(0xBB423B08),
+	DW(0xFFFFFFFE), DW(0x0000FFFF), DW(0xEB40FFFF), DW(0x520F200C),
+	DW(0x0000D810), DW(0x00A60236), DW(0xE214EA82), DW(0x337663E9),
+	DW(0x757A757A), DW(0x5CD5A2F7), DW(0xFF4DF719), DW(0xA5F970E9),
+	[0xD0] =
+	DW(0xFFFFFE7F), DW(0xDCD85221),
+};
+
+/* MX25L25645G: SFDP 1.6, BFPT at 0x30, Macronix table at 0x110, 4BAIT at 0xC0 */
+static const uint8_t		s_mx25l25645g[] = {
+	/* 0x00 */ 'S', 'F', 'D', 'P', 0x06, 0x01, 0x02, 0xFF,
+	/* 0x08 */ 0x00, 0x06, 0x01, 0x10, 0x30, 0x00, 0x00, 0xFF,
+	/* 0x10 */ 0xC2, 0x00, 0x01, 0x04, 0x10, 0x01, 0x00, 0xFF,
+	/* 0x18 */ 0x84, 0x00, 0x01, 0x02, 0xC0, 0x00, 0x00, 0xFF,
+	[0x30] =
+	DW(0xFFFB20E5), DW(0x0FFFFFFF), DW(0x6B08EB44), DW(0xBB043B08),
+	DW(0xFFFFFFFE), DW(0xFF00FFFF), DW(0xEB44FFFF), DW(0x520F200C),
+	DW(0xFF00D810), DW(0x00C549D6), DW(0xE304DF82), DW(0x38670344),
+	DW(0xB030B030), DW(0x5CD5BDF7), DW(0xFF299E4A), DW(0x85F950F0),
+	[0xC0] =
+	DW(0xFFFFFE7F), DW(0xDCD85221),
+};
+
+static uint8_t				s_sfdp[256];
+
+static void check_erase(const struct spi_flash_info *info)
+{
+	CHECK(info->erase[0].size == 65536 && info->erase[0].cmd == 0xD8);
+	CHECK(info->erase[1].size == 32768 && info->erase[1].cmd == 0x52);
+	CHECK(info->erase[2].size == 4096 && info->erase[2].cmd == 0x20);
+	CHECK(info->erase[3].size == 0);
+}
+
+static void test_parse(void)
+{
+	struct spi_flash_info	info;
+
+	/* W25Q256JV: 3 or 4-byte, 0xB7/0xE9 without WREN */
+	CHECK(sfdp_parse(s_w25q256jv, sizeof(s_w25q256jv), &info) == 0);
+	CHECK(info.size == 32 << 20 && info.page_size == 256);
+	CHECK(info.addr_mode == FLASH_ADDR_3OR4BYTE);
+	CHECK(info.dual_read_cmd == 0x3B && info.dual_read_dummy == 8);
+	check_erase(&info);
+	CHECK(info.addr4.enter == 0xB7 && info.addr4.exit == 0xE9 && !info.addr4.wren);
+	CHECK(info.addr4.status_cmd == 0);
+	CHECK(info.suspend.suspend == 0x75 && info.suspend.resume == 0x7A && info.suspend.max_us == 20);
+	CHECK(!flash_info_can_suspend(&info));
+
+	/* The status register is per vendor: SR3 bit0 */
+	flash_info_merge(&info, flash_info_lookup(0xEF4019));
+	CHECK(!strcmp(info.name, "W25Q256"));
+	CHECK(info.addr4.status_cmd == 0x15 && info.addr4.status_mask == 0x01);
+	CHECK(info.suspend.status_cmd == 0x35 && info.suspend.status_mask == 0x80);
+	CHECK(flash_info_can_suspend(&info));
+
+	/* MX25L25645G: same methods, the status is configuration register bit5 */
+	CHECK(sfdp_parse(s_mx25l25645g, sizeof(s_mx25l25645g), &info) == 0);
+	CHECK(info.size == 32 << 20 && info.page_size == 256);
+	CHECK(info.addr_mode == FLASH_ADDR_3OR4BYTE);
+	check_erase(&info);
+	CHECK(info.addr4.enter == 0xB7 && info.addr4.exit == 0xE9 && !info.addr4.wren);
+	flash_info_merge(&info, flash_info_lookup(0xC22019));
+	CHECK(info.addr4.status_cmd == 0x15 && info.addr4.status_mask == 0x20);
+	CHECK(info.suspend.suspend == 0xB0 && info.suspend.resume == 0x30 && info.suspend.max_us == 25);
+	CHECK(info.suspend.status_cmd == 0x2B && info.suspend.status_mask == 0x0C);
+
+	/* A dump cut before DWORD16 falls back to 0xB7/0xE9 */
+	memset(s_sfdp, 0xFF, sizeof(s_sfdp));
+	memcpy(s_sfdp, s_mx25l25645g, 0x30 + 9 * 4);
+	s_sfdp[0x0B] = 9;
+	CHECK(sfdp_parse(s_sfdp, sizeof(s_sfdp), &info) == 0);
+	CHECK(info.addr4.enter == 0xB7 && info.addr4.exit == 0xE9);
+
+	/* DWORD12 bit31 set: no suspend */
+	memcpy(s_sfdp, s_mx25l25645g, sizeof(s_mx25l25645g));
+	s_sfdp[0x30 + 47] |= 0x80;
+	CHECK(sfdp_parse(s_sfdp, sizeof(s_sfdp), &info) == 0);
+	CHECK(info.suspend.suspend == 0 && !flash_info_can_suspend(&info));
+
+	/* An erased DWORD16 is not read as "always 4-byte" */
+	memcpy(s_sfdp, s_w25q256jv, sizeof(s_w25q256jv));
+	memset(s_sfdp + 0x80 + 60, 0xFF, 4);
+	CHECK(sfdp_parse(s_sfdp, sizeof(s_sfdp), &info) == 0);
+	CHECK(info.addr_mode == FLASH_ADDR_3OR4BYTE && info.addr4.enter == 0xB7);
+
+	/* WREN before 0xB7 and 0xE9 */
+	s_sfdp[0x80 + 60] = 0x00;
+	s_sfdp[0x80 + 61] = 0x80;
+	s_sfdp[0x80 + 62] = 0x00;
+	s_sfdp[0x80 + 63] = 0x82;
+	CHECK(sfdp_parse(s_sfdp, sizeof(s_sfdp), &info) == 0);
+	CHECK(info.addr4.enter == 0xB7 && info.addr4.exit == 0xE9 && info.addr4.wren);
+
+	/* Only register methods: no opcode from SFDP, the ISSI table has 0xB7/0x29 */
+	s_sfdp[0x80 + 61] = 0x00;
+	s_sfdp[0x80 + 62] = 0x02;
+	s_sfdp[0x80 + 63] = 0x88;
+	CHECK(sfdp_parse(s_sfdp, sizeof(s_sfdp), &info) == 0);
+	CHECK(info.addr4.enter == 0 && info.addr4.exit == 0);
+	flash_info_merge(&info, flash_info_lookup(0x9D6019));
+	CHECK(info.addr4.enter == 0xB7 && info.addr4.exit == 0x29);
+	CHECK(info.addr4.status_cmd == 0x16 && info.addr4.status_mask == 0x80);
+
+	/* No signature, no BFPT */
+	s_sfdp[0] = 0;
+	CHECK(sfdp_parse(s_sfdp, sizeof(s_sfdp), &info) == -1);
+}
+
+/* Run SPI_FLASH_Init() on part, return its result */
+static int init_on(const struct nor_sim_part *part)
+{
+	sim_init(part, NULL);
+	return SPI_FLASH_Init();
+}
+
+static void test_addr_mode(void)
+{
+	static struct nor_sim_part	part;
+	static uint8_t				data[256];
+	uint8_t					   *mem;
+
+	memset(data, 0x3C, sizeof(data));
+
+	/* Winbond: ADS in SR3 bit0 */
+	CHECK(init_on(NULL) == 0);
+	CHECK(SPI_FLASH_GetSize() == 32 << 20);
+	CHECK(nor_sim_op(NOR_SIM_SPI1, 0xB7)->count == 1);
+	CHECK(nor_sim_op(NOR_SIM_SPI1, 0x15)->count == 1);
+
+	/* Macronix from its datasheet SFDP: CR bit5, the ODS bits [2:0] are set too */
+	part = nor_sim_mx25l256;
+	part.sfdp = s_mx25l25645g;
+	part.sfdp_len = sizeof(s_mx25l25645g);
+	CHECK(init_on(&part) == 0);
+	CHECK(!strcmp(SPI_FLASH_GetInfo()->name, "MX25L256"));
+	CHECK(SPI_FLASH_GetSize() == 32 << 20);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(New_SPI_FLASH_PageWrite(data, 0x1800000, sizeof(data)) == 0);
+	CHECK(!memcmp(mem + 0x1800000, data, sizeof(data)) && mem[0x800000] == 0xFF);
+
+	/* A part which needs WREN before 0xB7, as its SFDP says */
+	part = nor_sim_w25q256;
+	part.addr4_wren = 1;
+	CHECK(init_on(&part) == 0);
+	CHECK(SPI_FLASH_GetSize() == 32 << 20);
+
+	/* The same part behind an SFDP which leaves the WREN out: enter fails, 0xE9 is
+	 * sent and the driver stays on the first 16MB */
+	nor_sim_build_sfdp(&part, s_sfdp, sizeof(s_sfdp));
+	s_sfdp[0x80 + 61] = 0x70;
+	s_sfdp[0x80 + 63] = 0x81;
+	part.sfdp = s_sfdp;
+	part.sfdp_len = sizeof(s_sfdp);
+	CHECK(init_on(&part) == -1);
+	CHECK(SPI_FLASH_GetSize() == 16 << 20);
+	CHECK(nor_sim_op(NOR_SIM_SPI1, 0xE9)->count == 2);
+	CHECK(New_SPI_FLASH_PageWrite(data, 0xFFFF00, sizeof(data)) == 0);
+	CHECK(!memcmp(nor_sim_mem(NOR_SIM_SPI1) + 0xFFFF00, data, sizeof(data)));
+
+	/* A 32MB part with 3-byte addresses only never gets 0xB7 */
+	part = nor_sim_w25q256;
+	part.jedec_id = 0xEF4099;
+	part.addr_mode = FLASH_ADDR_3BYTE;
+	CHECK(init_on(&part) == -1);
+	CHECK(SPI_FLASH_GetSize() == 16 << 20);
+	CHECK(nor_sim_op(NOR_SIM_SPI1, 0xB7)->count == 0);
+}
+
+int main(void)
+{
+	test_parse();
+	test_addr_mode();
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * test_sim.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  The simulated part against the real driver: identification, the program and
+ *  erase semantics, and the simulated time of each operation against the model.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "spi.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+/* Fast chip erase, so the test does not poll BUSY for 80 simulated seconds */
+static struct nor_sim_part	s_part;
+
+static uint8_t				s_data[65536];
+static uint8_t				s_buf[65536];
+
+/* Simulated us spent by the call */
+#define ELAPSED_US(call)	({ uint64_t _t0 = sim_now_ns(); call; (sim_now_ns() - _t0) / 1000; })
+
+int main(void)
+{
+	uint8_t				   *mem;
+	uint64_t				us;
+	uint32_t				i;
+
+	s_part = nor_sim_w25q256;
+	s_part.t.tce_ms = 500;
+	sim_init(&s_part, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 7 + (i >> 8);
+
+	/* Identified from the SFDP tables, 4-byte addressing, one prescaler
+	 * below the fastest clock that reads back */
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(SPI_FLASH_GetInfo()->jedec_id == 0xEF4019);
+	CHECK(SPI_FLASH_GetSize() == 32 << 20);
+	CHECK(hspi1.Init.BaudRatePrescaler == SPI_BAUDRATEPRESCALER_4);
+
+	/* One page program: command + 256 bytes at 20MHz, then tPP */
+	us = ELAPSED_US(CHECK(New_SPI_FLASH_PageWrite(s_data, 0x1000000, 256) == 0));
+	printf("page program %llu us\n", (unsigned long long)us);
+	CHECK(!memcmp(mem + 0x1000000, s_data, 256));
+	CHECK(us >= s_part.t.tpp_us && us < s_part.t.tpp_us + 150);
+
+	/* Programming only clears bits */
+	memset(s_buf, 0x0F, 256);
+	CHECK(New_SPI_FLASH_PageWrite(s_buf, 0x1000000, 256) == 0);
+	for(i=0; i<256; i++)
+		CHECK(mem[0x1000000 + i] == (s_data[i] & 0x0F));
+
+	/* The erases alone, without the read-back of the erase verification */
+	SPI_FLASH_SetVerify(SPI_FLASH_OP_ERASE, SPI_FLASH_VERIFY_OFF);
+
+	/* 4KB erase of a programmed sector costs tSE */
+	us = ELAPSED_US(CHECK(SPI_FLASH_EraseRange(0x1000000, 4096) == 0));
+	printf("4KB erase %llu us\n", (unsigned long long)us);
+	CHECK(mem[0x1000000] == 0xFF);
+	CHECK(us >= s_part.t.tse_us && us < s_part.t.tse_us + 500);
+
+	/* 64KB of data, then a 64KB erase costs tBE64 */
+	CHECK(New_SPI_FLASH_PageWrite(s_data, 0x20000, sizeof(s_data)) == 0);
+	CHECK(!memcmp(mem + 0x20000, s_data, sizeof(s_data)));
+
+	/* 64KB read at 20MHz is 26.2ms on the wire */
+	us = ELAPSED_US(New_SPI_FLASH_BufferRead(0x20000, s_buf, sizeof(s_buf)));
+	printf("64KB read %llu us\n", (unsigned long long)us);
+	CHECK(!memcmp(s_buf, s_data, sizeof(s_buf)));
+	CHECK(us >= 26214 && us < 27000);
+
+	us = ELAPSED_US(CHECK(SPI_FLASH_EraseRange(0x20000, 65536) == 0));
+	printf("64KB erase %llu us\n", (unsigned long long)us);
+	CHECK(nor_sim_op(NOR_SIM_SPI1, 0xD8)->count == 1);
+	CHECK(us >= s_part.t.tbe64_us && us < s_part.t.tbe64_us + 2000);
+
+	/* Chip erase */
+	mem[0x1FFFFFF] = 0;
+	us = ELAPSED_US(CHECK(SPI_Flash_ChipErase() == 0));
+	printf("chip erase %llu us\n", (unsigned long long)us);
+	CHECK(mem[0x1FFFFFF] == 0xFF);
+	CHECK(us >= s_part.t.tce_ms * 1000);
+
+	/* The driver never sent a command the busy part dropped */
+	for(i=0; i<256; i++)
+		CHECK(nor_sim_op(NOR_SIM_SPI1, i)->ignored == 0);
+
+	nor_sim_report(NOR_SIM_SPI1);
+
+	/* A part good for 30MHz: 40MHz garbles, 20MHz passes, one prescaler of margin */
+	s_part.t.spi_hz_max = 30000000;
+	sim_init(&s_part, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(hspi1.Init.BaudRatePrescaler == SPI_BAUDRATEPRESCALER_8);
+
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * test_spi3.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  SPI3 driver: identification and 4-byte address mode with the same method
+ *  and status bit as SPI1, reads with the fast read of the descriptor.
+ */
+
+#include <string.h>
+#include "spi3_flash.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+static uint8_t				s_data[4096];
+static uint8_t				s_buf[4096];
+static uint8_t				s_sfdp[256];
+
+int main(void)
+{
+	struct nor_sim_part		part;
+	uint8_t				   *mem;
+	uint32_t				i;
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 13 + (i >> 8);
+
+	/* W25Q128 on SPI3: 3-byte, the whole 16MB, no 0xB7 */
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI3);
+	CHECK(SPI3_FLASH_Init() == 0);
+	CHECK(SPI3_FLASH_GetSize() == 16 << 20);
+	CHECK(nor_sim_op(NOR_SIM_SPI3, 0xB7)->count == 0);
+
+	memcpy(mem + 0xFFF000, s_data, sizeof(s_data));
+	CHECK(SPI3_FLASH_Read(0xFFF000, s_buf, sizeof(s_buf)) == 0);
+	CHECK(!memcmp(s_buf, s_data, sizeof(s_buf)));
+	CHECK(nor_sim_op(NOR_SIM_SPI3, SPI3_FLASH_GetInfo()->fast_read_cmd)->count == 1);
+
+	/* Macronix on SPI3: 4-byte mode confirmed by CR bit5, data above 16MB */
+	part = nor_sim_mx25l256;
+	sim_init(NULL, &part);
+	mem = nor_sim_mem(NOR_SIM_SPI3);
+	CHECK(SPI3_FLASH_Init() == 0);
+	CHECK(SPI3_FLASH_GetSize() == 32 << 20);
+	CHECK(nor_sim_op(NOR_SIM_SPI3, 0xB7)->count == 1);
+
+	CHECK(SPI3_FLASH_EraseRange(0x1800000, sizeof(s_data)) == 0);
+	CHECK(SPI3_FLASH_Program(0x1800000, s_data, sizeof(s_data)) == 0);
+	CHECK(!memcmp(mem + 0x1800000, s_data, sizeof(s_data)) && mem[0x800000] == 0xFF);
+	memset(s_buf, 0, sizeof(s_buf));
+	CHECK(SPI3_FLASH_Read(0x1800000, s_buf, sizeof(s_buf)) == 0);
+	CHECK(!memcmp(s_buf, s_data, sizeof(s_buf)));
+
+	/* The same part when 0xB7 needs WREN the descriptor does not know of: 0xE9 is
+	 * sent and only the first 16MB are used */
+	part.sfdp_len = nor_sim_build_sfdp(&nor_sim_mx25l256, s_sfdp, sizeof(s_sfdp));
+	part.sfdp = s_sfdp;
+	part.addr4_wren = 1;
+	sim_init(NULL, &part);
+	CHECK(SPI3_FLASH_Init() == 0);
+	CHECK(SPI3_FLASH_GetSize() == 16 << 20);
+	CHECK(nor_sim_op(NOR_SIM_SPI3, 0xE9)->count == 2);
+	CHECK(SPI3_FLASH_Read(0xFFFFF0, s_buf, 32) == -2);
+
+	printf("OK\n");
+	return 0;
+}
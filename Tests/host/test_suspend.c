@@ -0,0 +1,183 @@
+/*
+ * test_suspend.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Erase suspend/resume of the job engine on the simulated parts: a read
+ *  outside the erased range is served in the middle of the erase with the
+ *  opcodes and status bit of the part, parts whose suspend the descriptor
+ *  does not know make the read wait, an erase which ends before the suspend
+ *  takes effect just completes, and a stream of reads cannot starve it. A
+ *  blocking read waits for the queued programs of its range.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_job.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define ERASE_ADDR		0x10000
+#define READ_ADDR		0x200000
+#define READ_LEN		4096
+
+static uint8_t				s_buf[READ_LEN];
+static uint8_t				s_prog[256];
+static uint64_t				s_done_ns;
+
+static void job_done(struct flash_job *job, int status)
+{
+	s_done_ns = sim_now_ns();
+}
+
+static void job_init(struct flash_job *job, enum flash_job_type type, uint32_t addr, uint8_t *buf, uint32_t len)
+{
+	memset(job, 0, sizeof(*job));
+	job->type = type;
+	job->addr = addr;
+	job->buf = buf;
+	job->len = len;
+}
+
+/* Erase 64KB and read READ_LEN bytes elsewhere delay_ms later, return when the
+ * read finished, relative to the erase command */
+static uint64_t erase_and_read(uint32_t delay_ms, uint64_t *erase_ns)
+{
+	struct flash_job		erase, read;
+	uint8_t				   *mem = nor_sim_mem(NOR_SIM_SPI1);
+	uint64_t				t0;
+	uint32_t				i;
+
+	memset(mem + ERASE_ADDR, 0x00, 65536);
+	for(i=0; i<READ_LEN; i++)
+		mem[READ_ADDR + i] = i * 3;
+
+	job_init(&erase, FLASH_JOB_ERASE, ERASE_ADDR, NULL, 65536);
+	job_init(&read, FLASH_JOB_READ, READ_ADDR, s_buf, READ_LEN);
+	read.cb = job_done;
+
+	t0 = sim_now_ns();
+	CHECK(flash_job_submit(&erase) == 0);
+	HAL_Delay(delay_ms);
+	CHECK(flash_job_submit(&read) == 0);
+	CHECK(flash_job_wait(&read) == 0);
+	CHECK(!memcmp(s_buf, mem + READ_ADDR, READ_LEN));
+	CHECK(flash_job_wait(&erase) == 0);
+	*erase_ns = sim_now_ns() - t0;
+
+	for(i=0; i<65536; i++)
+		CHECK(mem[ERASE_ADDR + i] == 0xFF);
+
+	return s_done_ns - t0;
+}
+
+static int count_ops(uint8_t cmd)
+{
+	return nor_sim_op(NOR_SIM_SPI1, cmd)->count;
+}
+
+int main(void)
+{
+	struct nor_sim_part		part;
+	struct flash_job		erase, read, prog;
+	uint64_t				read_ns, erase_ns;
+	uint32_t				reads;
+
+	/* Winbond: 0x75/0x7A, SUS in SR2 bit7 */
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(flash_info_can_suspend(SPI_FLASH_GetInfo()));
+	read_ns = erase_and_read(5, &erase_ns);
+	printf("W25Q256: read done after %llu us, erase after %llu us\n",
+			(unsigned long long)(read_ns / 1000), (unsigned long long)(erase_ns / 1000));
+	CHECK(read_ns < 7000000);
+	CHECK(erase_ns >= nor_sim_w25q256.t.tbe64_us * 1000ULL);
+	CHECK(count_ops(0x75) == 1 && count_ops(0x7A) == 1 && count_ops(0x35) >= 1);
+	CHECK(count_ops(0xB0) == 0 && count_ops(0x2B) == 0);
+
+	/* Macronix: 0xB0/0x30, ESB in the security register, 0x35 means nothing */
+	sim_init(&nor_sim_mx25l256, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(SPI_FLASH_GetInfo()->suspend.suspend == 0xB0);
+	read_ns = erase_and_read(5, &erase_ns);
+	printf("MX25L256: read done after %llu us, erase after %llu us\n",
+			(unsigned long long)(read_ns / 1000), (unsigned long long)(erase_ns / 1000));
+	CHECK(read_ns < 7000000);
+	CHECK(count_ops(0xB0) == 1 && count_ops(0x30) == 1 && count_ops(0x2B) >= 1);
+	CHECK(count_ops(0x75) == 0 && count_ops(0x35) == 0);
+	CHECK(nor_sim_op(NOR_SIM_SPI1, 0xB0)->ignored == 0);
+
+	/* A part without suspend in SFDP: the read waits for the erase */
+	part = nor_sim_w25q256;
+	part.jedec_id = 0xEF4099;
+	part.suspend = NOR_SIM_SUS_NONE;
+	sim_init(&part, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(!flash_info_can_suspend(SPI_FLASH_GetInfo()));
+	read_ns = erase_and_read(5, &erase_ns);
+	CHECK(read_ns >= part.t.tbe64_us * 1000ULL);
+	CHECK(count_ops(0x75) == 0);
+
+	/* A part which can suspend per SFDP, but not in the table: no status bit to
+	 * tell a suspended erase from a finished one, so it is not suspended */
+	part.suspend = NOR_SIM_SUS_WINBOND;
+	sim_init(&part, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	CHECK(SPI_FLASH_GetInfo()->suspend.suspend == 0x75);
+	CHECK(!flash_info_can_suspend(SPI_FLASH_GetInfo()));
+	read_ns = erase_and_read(5, &erase_ns);
+	CHECK(read_ns >= part.t.tbe64_us * 1000ULL);
+	CHECK(count_ops(0x75) == 0);
+
+	/* An erase which is within tSUS of its end when the suspend comes completes,
+	 * the status bit is clear and the engine moves on */
+	part = nor_sim_w25q256;
+	part.t.tbe64_us = 2000;
+	part.t.tsus_us = 2000;
+	sim_init(&part, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	read_ns = erase_and_read(1, &erase_ns);
+	CHECK(count_ops(0x75) >= 1 && count_ops(0x7A) == 0);
+	CHECK(erase_ns < 10000000);
+
+	/* Reads back to back during one 64KB erase: at most one suspend per ms of
+	 * erase progress and SUSPEND_MAX in all, then the erase runs to its end */
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	memset(nor_sim_mem(NOR_SIM_SPI1) + ERASE_ADDR, 0x00, 65536);
+	job_init(&erase, FLASH_JOB_ERASE, ERASE_ADDR, NULL, 65536);
+	CHECK(flash_job_submit(&erase) == 0);
+	for(reads=0; erase.status == FLASH_JOB_PENDING; reads++)
+	{
+		job_init(&read, FLASH_JOB_READ, READ_ADDR, s_buf, 256);
+		CHECK(flash_job_submit(&read) == 0);
+		CHECK(flash_job_wait(&read) == 0);
+	}
+	CHECK(erase.status == 0);
+	printf("%u reads during a 64KB erase, %d suspends\n", reads, count_ops(0x75));
+	CHECK(count_ops(0x75) <= 64 && count_ops(0x75) == count_ops(0x7A));
+	CHECK(count_ops(0x75) > 10);
+
+	/* A blocking read of a range with a program queued behind a running erase:
+	 * the erase is not suspended for it, the read returns the programmed data */
+	sim_init(NULL, NULL);
+	CHECK(SPI_FLASH_Init() == 0);
+	memset(nor_sim_mem(NOR_SIM_SPI1) + ERASE_ADDR, 0x00, 65536);
+	memset(nor_sim_mem(NOR_SIM_SPI1) + READ_ADDR, 0xFF, 256);
+	for(reads=0; reads<256; reads++)
+		s_prog[reads] = reads * 5 + 1;
+	job_init(&erase, FLASH_JOB_ERASE, ERASE_ADDR, NULL, 65536);
+	job_init(&prog, FLASH_JOB_PROGRAM, READ_ADDR, s_prog, 256);
+	CHECK(flash_job_submit(&erase) == 0);
+	CHECK(flash_job_submit(&prog) == 0);
+	HAL_Delay(5);
+	CHECK(prog.status == FLASH_JOB_PENDING);
+	New_SPI_FLASH_BufferRead(READ_ADDR, s_buf, 256);
+	CHECK(erase.status == 0 && prog.status == 0);
+	CHECK(!memcmp(s_buf, s_prog, 256));
+	CHECK(count_ops(0x75) == 0);
+
+	printf("OK\n");
+	return 0;
+}
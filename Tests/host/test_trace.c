@@ -0,0 +1,120 @@
+/*
+ * test_trace.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Command trace, built with CONFIG_SPI_FLASH_TRACE: the dump of
+ *  SPI_FLASH_DumpTrace() is captured from the console and decoded by the
+ *  host decoder of tools/, the timeline is in start order and the latency of
+ *  each opcode is the time the simulated part took. A wrapped ring keeps the
+ *  last commands, a corrupted dump is refused.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "spi_flash.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+#include "trace_decode.h"
+
+static uint8_t				s_data[8192];
+static uint8_t				s_dump[64 * 1024];
+
+/* Run SPI_FLASH_DumpTrace() with the console in a file, after some text like a
+ * terminal capture has, return the bytes captured */
+static size_t capture_dump(void)
+{
+	FILE				   *fp = tmpfile();
+	size_t					len;
+	int						saved;
+
+	CHECK(fp != NULL);
+	fflush(stdout);
+	saved = dup(1);
+	dup2(fileno(fp), 1);
+	printf("> trace\r\n");
+	SPI_FLASH_DumpTrace();
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+
+	rewind(fp);
+	len = fread(s_dump, 1, sizeof(s_dump), fp);
+	fclose(fp);
+	CHECK(len < sizeof(s_dump));
+
+	return len;
+}
+
+static uint32_t cycles_of_us(uint32_t us)
+{
+	return us * (SystemCoreClock / 1000000);
+}
+
+int main(void)
+{
+	struct trace_dump		dump;
+	uint8_t				   *mem;
+	size_t					len;
+	uint32_t				i;
+
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 5 + 3;
+
+	/* A 64KB erase, 4 pages programmed, one streaming read */
+	SPI_FLASH_TraceReset();
+	memset(mem + 0x10000, 0x00, 65536);
+	CHECK(SPI_FLASH_EraseRange(0x10000, 65536) == 0);
+	CHECK(New_SPI_FLASH_PageWrite(s_data, 0x10000, 1024) == 0);
+	New_SPI_FLASH_BufferRead(0x10000, s_data, sizeof(s_data));
+
+	len = capture_dump();
+	CHECK(trace_decode(s_dump, len, &dump) > 0);
+	CHECK(dump.recorded == dump.count && dump.depth == SPI_FLASH_TRACE_DEPTH);
+	CHECK(dump.clock_hz == SystemCoreClock);
+	trace_print_timeline(&dump, stdout);
+	trace_print_stats(&dump, stdout);
+
+	CHECK(dump.op[0xD8].count == 1 && dump.op[0xD8].bytes == 65536);
+	CHECK(dump.op[0xD8].min >= cycles_of_us(nor_sim_w25q256.t.tbe64_us));
+	CHECK(dump.op[0x02].count == 4 && dump.op[0x02].bytes == 1024);
+	CHECK(dump.op[0x02].min >= cycles_of_us(nor_sim_w25q256.t.tpp_us));
+	CHECK(dump.op[0x02].max < cycles_of_us(nor_sim_w25q256.t.tpp_us + 150));
+	CHECK(dump.ent[0].opcode != 0x02 && dump.ent[dump.count - 1].len == sizeof(s_data));
+	for(i=1; i<dump.count; i++)
+		CHECK((int32_t)(dump.ent[i].start - dump.ent[i - 1].start) >= 0);
+	trace_free(&dump);
+
+	/* 300 page programs in a 256 entry ring: the last 256, oldest first */
+	SPI_FLASH_TraceReset();
+	for(i=0; i<300; i++)
+		CHECK(New_SPI_FLASH_PageWrite(s_data, 0x20000 + i * 256, 256) == 0);
+	len = capture_dump();
+	CHECK(trace_decode(s_dump, len, &dump) == SPI_FLASH_TRACE_DEPTH);
+	CHECK(dump.recorded == 300 && dump.op[0x02].count == SPI_FLASH_TRACE_DEPTH);
+	for(i=0; i<dump.count; i++)
+		CHECK(dump.ent[i].addr == 0x20000 + (300 - SPI_FLASH_TRACE_DEPTH + i) * 256);
+	trace_free(&dump);
+
+	/* Off: nothing recorded */
+	SPI_FLASH_TraceReset();
+	SPI_FLASH_TraceEnable(0);
+	CHECK(New_SPI_FLASH_PageWrite(s_data, 0x40000, 256) == 0);
+	SPI_FLASH_TraceEnable(1);
+	len = capture_dump();
+	CHECK(trace_decode(s_dump, len, &dump) == 0);
+	trace_free(&dump);
+
+	/* A flipped bit fails the CRC, a capture without the magic has no dump */
+	s_dump[len - 10] ^= 0x01;
+	CHECK(trace_decode(s_dump, len, &dump) == -2);
+	CHECK(trace_decode(s_dump, 12, &dump) == -1);
+	CHECK(trace_decode(s_dump, len - 1, &dump) == -2);
+
+	printf("OK\n");
+	return 0;
+}
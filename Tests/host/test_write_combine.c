@@ -0,0 +1,105 @@
+/*
+ * test_write_combine.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Write-combining buffer: small sequential writes into one page are programmed
+ *  once, reads see the buffered bytes before they are programmed, a write which
+ *  does not continue the buffer, SPI_FLASH_WriteFlush() and the timeout of
+ *  SPI_FLASH_WritePoll() program it, and an erase of its page, blocking or by
+ *  the job engine, drops it.
+ */
+
+#include <string.h>
+#include "spi_flash.h"
+#include "flash_job.h"
+#include "nor_sim.h"
+#include "sim_check.h"
+
+#define BASE		0x40000
+
+static uint8_t				s_data[1024];
+static uint8_t				s_buf[1024];
+
+static int count_prog(void)
+{
+	return nor_sim_op(NOR_SIM_SPI1, 0x02)->count;
+}
+
+int main(void)
+{
+	const struct spi_flash_stats   *st;
+	struct flash_job				job;
+	uint8_t						   *mem;
+	uint32_t						i;
+
+	sim_init(NULL, NULL);
+	mem = nor_sim_mem(NOR_SIM_SPI1);
+	CHECK(SPI_FLASH_Init() == 0);
+	st = SPI_FLASH_GetStats();
+
+	for(i=0; i<sizeof(s_data); i++)
+		s_data[i] = i * 7 + 1;
+
+	/* 16 sequential 16-byte writes fill one page: a single program */
+	nor_sim_reset_stats();
+	SPI_FLASH_ResetStats();
+	for(i=0; i<16; i++)
+		CHECK(New_SPI_FLASH_PageWrite(s_data + i * 16, BASE + i * 16, 16) == 0);
+	CHECK(count_prog() == 1);
+	CHECK(st->prog_issued == 1 && st->prog_combined == 15);
+	CHECK(!memcmp(mem + BASE, s_data, 256));
+
+	/* A partial page stays in the buffer, reads see it */
+	nor_sim_reset_stats();
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE + 300, 10) == 0);
+	CHECK(count_prog() == 0 && mem[BASE + 300] == 0xFF);
+	New_SPI_FLASH_BufferRead(BASE + 290, s_buf, 30);
+	for(i=0; i<30; i++)
+		CHECK(s_buf[i] == (i >= 10 && i < 20 ? s_data[i - 10] : 0xFF));
+
+	/* A write which does not continue the buffer programs it */
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE + 400, 10) == 0);
+	CHECK(count_prog() == 1 && !memcmp(mem + BASE + 300, s_data, 10));
+
+	/* WritePoll() leaves a young buffer, programs one older than the timeout */
+	SPI_FLASH_WritePoll();
+	CHECK(count_prog() == 1);
+	HAL_Delay(100);
+	SPI_FLASH_WritePoll();
+	CHECK(count_prog() == 2 && !memcmp(mem + BASE + 400, s_data, 10));
+
+	/* An unaligned write over several pages: the head is buffered, the whole pages
+	 * are programmed directly, the tail waits for the flush */
+	nor_sim_reset_stats();
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE + 4096 + 156, 700) == 0);
+	CHECK(count_prog() == 3);
+	CHECK(SPI_FLASH_WriteFlush() == 0);
+	CHECK(count_prog() == 4);
+	CHECK(!memcmp(mem + BASE + 4096 + 156, s_data, 700));
+	CHECK(SPI_FLASH_WriteFlush() == 0 && count_prog() == 4);
+
+	/* An erase of the page drops the buffered bytes */
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE + 8192 + 5, 10) == 0);
+	CHECK(SPI_FLASH_EraseRange(BASE + 8192, 4096) == 0);
+	CHECK(SPI_FLASH_WriteFlush() == 0);
+	CHECK(count_prog() == 4 && mem[BASE + 8192 + 5] == 0xFF);
+	New_SPI_FLASH_BufferRead(BASE + 8192, s_buf, 32);
+	for(i=0; i<32; i++)
+		CHECK(s_buf[i] == 0xFF);
+
+	/* So does an erase job of the engine */
+	CHECK(New_SPI_FLASH_PageWrite(s_data, BASE + 12288 + 5, 10) == 0);
+	memset(&job, 0, sizeof(job));
+	job.type = FLASH_JOB_ERASE;
+	job.addr = BASE + 12288;
+	job.len = 4096;
+	CHECK(flash_job_submit(&job) == 0);
+	CHECK(flash_job_wait(&job) == 0);
+	CHECK(SPI_FLASH_WriteFlush() == 0);
+	CHECK(count_prog() == 4 && mem[BASE + 12288 + 5] == 0xFF);
+
+	printf("OK\n");
+	return 0;
+}
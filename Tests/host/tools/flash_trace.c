@@ -0,0 +1,74 @@
+/*
+ * flash_trace.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Print the timeline and the per opcode latency of a SPI flash command trace.
+ *  The input is the console captured while the board ran SPI_FLASH_DumpTrace(),
+ *  built with CONFIG_SPI_FLASH_TRACE:
+ *
+ *    flash_trace capture.bin			timeline and latency
+ *    flash_trace -s capture.bin		latency only
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "trace_decode.h"
+
+int main(int argc, char **argv)
+{
+	struct trace_dump		dump;
+	uint8_t				   *buf;
+	FILE				   *fp;
+	long					len;
+	int						stats_only = 0;
+	int						rv;
+
+	if( argc > 1 && !strcmp(argv[1], "-s") )
+	{
+		stats_only = 1;
+		argc--;
+		argv++;
+	}
+	if( argc != 2 )
+	{
+		fprintf(stderr, "usage: flash_trace [-s] capture.bin\n");
+		return 2;
+	}
+
+	if( !(fp = fopen(argv[1], "rb")) )
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	buf = malloc(len > 0 ? len : 1);
+	if( !buf || fread(buf, 1, len, fp) != (size_t)len )
+	{
+		fprintf(stderr, "%s: read failed\n", argv[1]);
+		return 1;
+	}
+	fclose(fp);
+
+	rv = trace_decode(buf, len, &dump);
+	if( rv == -1 )
+		fprintf(stderr, "%s: no trace dump found\n", argv[1]);
+	else if( rv < 0 )
+		fprintf(stderr, "%s: trace dump truncated, of another version or corrupted\n", argv[1]);
+	if( rv < 0 )
+		return 1;
+
+	if( !stats_only )
+	{
+		trace_print_timeline(&dump, stdout);
+		printf("\n");
+	}
+	trace_print_stats(&dump, stdout);
+
+	trace_free(&dump);
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * trace_decode.c
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Decoder of the SPI_FLASH_DumpTrace() binary dump: the header, the ring in
+ *  the order the commands were recorded, the CRC16. The host is little endian
+ *  like the target.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "crc16.h"
+#include "trace_decode.h"
+
+#define TRACE_HDR_WORDS		5
+
+/* Reference start of the sort, the start of the oldest entry */
+static uint32_t				s_ref;
+
+static const char *trace_op_name(uint8_t op)
+{
+	switch( op )
+	{
+	case 0x02:	return "PP";
+	case 0x03:	return "READ";
+	case 0x0B:	return "FAST_READ";
+	case 0x0C:	return "FAST_READ4";
+	case 0x13:	return "READ4";
+	case 0x20:	return "SE";
+	case 0x30:	return "RESUME";
+	case 0x52:	return "BE32";
+	case 0x5A:	return "SFDP";
+	case 0x75:	return "SUSPEND";
+	case 0x7A:	return "RESUME";
+	case 0x9F:	return "RDID";
+	case 0xB0:	return "SUSPEND";
+	case 0xC7:	return "CE";
+	case 0xD8:	return "BE64";
+	default:	return "";
+	}
+}
+
+static int trace_cmp(const void *a, const void *b)
+{
+	int32_t				sa = ((const struct spi_flash_trace *)a)->start - s_ref;
+	int32_t				sb = ((const struct spi_flash_trace *)b)->start - s_ref;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+int trace_decode(const uint8_t *buf, size_t len, struct trace_dump *dump)
+{
+	uint32_t			hdr[TRACE_HDR_WORDS];
+	uint32_t			magic = SPI_FLASH_TRACE_MAGIC;
+	const uint8_t	   *ring;
+	size_t				pos, ring_len;
+	uint32_t			i, oldest;
+	uint16_t			crc;
+	struct trace_op_stats *st;
+	uint32_t			cycles;
+
+	memset(dump, 0, sizeof(*dump));
+
+	/* The dump follows whatever the console printed before it */
+	for(pos=0; pos+sizeof(hdr)<=len; pos++)
+	{
+		if( !memcmp(buf + pos, &magic, sizeof(magic)) )
+			break;
+	}
+	if( pos + sizeof(hdr) > len )
+		return -1;
+
+	memcpy(hdr, buf + pos, sizeof(hdr));
+	if( hdr[1] != ((SPI_FLASH_TRACE_VERSION << 16) | sizeof(struct spi_flash_trace)) || hdr[2] == 0 )
+		return -2;
+
+	ring = buf + pos + sizeof(hdr);
+	ring_len = (size_t)hdr[2] * sizeof(struct spi_flash_trace);
+	if( pos + sizeof(hdr) + ring_len + sizeof(crc) > len )
+		return -2;
+	memcpy(&crc, ring + ring_len, sizeof(crc));
+	if( crc != crc16_checksum((unsigned char *)ring, ring_len) )
+		return -2;
+
+	dump->depth = hdr[2];
+	dump->recorded = hdr[3];
+	dump->clock_hz = hdr[4];
+	dump->count = dump->recorded < dump->depth ? dump->recorded : dump->depth;
+	dump->ent = malloc((dump->count ? dump->count : 1) * sizeof(struct spi_flash_trace));
+	if( !dump->ent )
+		return -2;
+
+	/* Oldest first: entry (recorded % depth) once the ring has wrapped */
+	oldest = dump->recorded > dump->depth ? dump->recorded % dump->depth : 0;
+	for(i=0; i<dump->count; i++)
+		memcpy(&dump->ent[i], ring + (size_t)((oldest + i) % dump->depth) * sizeof(struct spi_flash_trace),
+				sizeof(struct spi_flash_trace));
+
+	/* Entries are recorded when the command completes, a short one of the job engine
+	 * can end inside a long one, order them by start */
+	if( dump->count )
+	{
+		s_ref = dump->ent[0].start;
+		qsort(dump->ent, dump->count, sizeof(struct spi_flash_trace), trace_cmp);
+	}
+
+	for(i=0; i<dump->count; i++)
+	{
+		st = &dump->op[dump->ent[i].opcode];
+		cycles = dump->ent[i].end - dump->ent[i].start;
+		if( st->count == 0 || cycles < st->min )
+			st->min = cycles;
+		if( cycles > st->max )
+			st->max = cycles;
+		st->count++;
+		st->bytes += dump->ent[i].len;
+		st->total += cycles;
+	}
+
+	return dump->count;
+}
+
+void trace_free(struct trace_dump *dump)
+{
+	free(dump->ent);
+	dump->ent = NULL;
+	dump->count = 0;
+}
+
+/* Cycles to us */
+static double trace_us(const struct trace_dump *dump, double cycles)
+{
+	return cycles * 1e6 / dump->clock_hz;
+}
+
+void trace_print_timeline(const struct trace_dump *dump, FILE *out)
+{
+	const struct spi_flash_trace   *ent;
+	uint32_t						i;
+
+	fprintf(out, "%u commands of %u recorded, %u Hz\n", dump->count, dump->recorded, dump->clock_hz);
+	fprintf(out, "%12s %10s %10s  %-2s %-10s %10s %8s\n", "start us", "dur us", "gap us", "op", "", "addr", "len");
+	for(i=0; i<dump->count; i++)
+	{
+		ent = &dump->ent[i];
+		fprintf(out, "%12.1f %10.1f %10.1f  %02X %-10s 0x%08X %8u\n",
+				trace_us(dump, (int32_t)(ent->start - dump->ent[0].start)),
+				trace_us(dump, ent->end - ent->start),
+				i ? trace_us(dump, (int32_t)(ent->start - ent[-1].end)) : 0.0,
+				ent->opcode, trace_op_name(ent->opcode), ent->addr, ent->len);
+	}
+}
+
+void trace_print_stats(const struct trace_dump *dump, FILE *out)
+{
+	const struct trace_op_stats	   *st;
+	int								op;
+
+	fprintf(out, "%-2s %-10s %8s %10s %10s %10s %10s %12s\n",
+			"op", "", "count", "bytes", "min us", "avg us", "max us", "total us");
+	for(op=0; op<256; op++)
+	{
+		st = &dump->op[op];
+		if( st->count == 0 )
+			continue;
+		fprintf(out, "%02X %-10s %8u %10llu %10.1f %10.1f %10.1f %12.1f\n", op, trace_op_name(op),
+				st->count, (unsigned long long)st->bytes, trace_us(dump, st->min),
+				trace_us(dump, (double)st->total / st->count), trace_us(dump, st->max),
+				trace_us(dump, st->total));
+	}
+}
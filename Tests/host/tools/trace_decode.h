@@ -0,0 +1,49 @@
+/*
+ * trace_decode.h
+ *
+ *  Created on: Oct 17, 2026
+ *      Author: lizhao
+ *
+ *  Host side decoder of the command trace dumped by SPI_FLASH_DumpTrace().
+ */
+
+#ifndef TRACE_DECODE_H_
+#define TRACE_DECODE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include "spi_flash.h"
+
+/* Latency of one opcode over the decoded entries, in CPU cycles */
+struct trace_op_stats
+{
+	uint32_t			count;
+	uint64_t			bytes;
+	uint64_t			total;
+	uint32_t			min;
+	uint32_t			max;
+};
+
+/* A decoded dump, entries sorted by start time */
+struct trace_dump
+{
+	uint32_t					depth;
+	uint32_t					recorded;	/* since the reset, more than depth once wrapped */
+	uint32_t					clock_hz;
+	uint32_t					count;		/* entries in ent[] */
+	struct spi_flash_trace	   *ent;
+	struct trace_op_stats		op[256];
+};
+
+/* Find the dump in a console capture and decode it into dump, ent is allocated.
+ * Return: the number of entries, -1 if there is no dump, -2 if it is truncated,
+ * of another version or its CRC16 does not match */
+int trace_decode(const uint8_t *buf, size_t len, struct trace_dump *dump);
+void trace_free(struct trace_dump *dump);
+
+/* Print the timeline, one line per command in us from the first one, and the
+ * per opcode count and latency */
+void trace_print_timeline(const struct trace_dump *dump, FILE *out);
+void trace_print_stats(const struct trace_dump *dump, FILE *out);
+
+#endif /* TRACE_DECODE_H_ */